@@ -12,10 +12,11 @@ using std::sort;
 #include "Game.h"
 #include "MasterEntityList.h"
 #include "PI_Utils.h"
+#include "PI_JobPool.h"
 
 Game Game::m_instance;
 HANDLE Game::hRenderThread = 0;
-extern CRITICAL_SECTION g_cs;
+const unsigned int Game::EntityCullRangeSize = 256;
 
 unsigned int __stdcall spawnRenderThread(void *v)
 {
@@ -39,6 +40,13 @@ unsigned int __stdcall spawnRenderThread(void *v)
 	}
 	logger << "PI_GUI::Init() successful.\n";
 
+	// The GUI sprites, particles and font share a page, so they're drawn without switching textures.
+	// Anything it can't pack is loaded on its own later.
+	if (renderer.LoadAtlas("DATA\\sprites.pat"))
+		renderer.PinAsset("DATA\\sprites.pat");
+	else
+		logger << "Failed to load DATA\\sprites.pat.\n";
+
 	// TEST:: Load the font.
 	if (!gui.LoadFont("DATA\\stencil"))
 	{
@@ -46,8 +54,6 @@ unsigned int __stdcall spawnRenderThread(void *v)
 		return false;
 	}
 
-	renderer.SetRenderList(Game::GetInstance().GetRenderList());
-
 	// Main rendering loop - update returns false once a shutdown state is set.
 	while (renderer.Update());
 	renderer.Shutdown();
@@ -67,39 +73,50 @@ bool Game::Init(void)
 	if (hRenderThread)
 		logger << "Render thread spawned successfully.\n";
 
+	// Find out what every level needs up front, so the next one can be prefetched.
+	if (!levels.Load("DATA"))
+	{
+		ERRORBOX("No level scripts were found in DATA!");
+		return false;
+	}
+
+	// Let artists see their changes without restarting.
+	if (!renderer.WatchAssetDirectory("DATA"))
+		logger << "Asset hot-reloading is unavailable.\n";
+
 	// The game was succesfully initialized.
 	logger << "Game::Init() successful!\n";
 	state = LoadState;
 	return true;
 }
 
-// Load the current level assets and entities.
+// Request the current level assets and load its entities.
+// The level is finished by UpdateLoading once the assets are resident.
 //
 // Returns:		True if successful.
 bool Game::LoadLevel(void)
 {
-	// Load the level script.
-	const int MaxLen = 1000;
-	char levelScriptName[MaxLen];
-	sprintf_s(levelScriptName, MaxLen, "DATA\\level%d.PLS", curLevel);
-	ifstream fin(levelScriptName, /*ios_base::binary |*/ ios_base::in);
-	if (!fin.is_open())
+	const PI_LevelManifest::PI_Level *pLevel = levels.GetLevel(curLevel);
+	if (!pLevel)
 		return false;
 
-	// Load the assets.
+	// Request the assets. The renderer streams them in between frames, anything the
+	// last level also used is still resident, and the rest may already be prefetched.
+	numFailedAssets = 0;
+	renderer.RequestLevelAssets(pLevel->vAssets, OnLevelAssetLoaded, this);
+
+#if 0 // TODO:: Update the entity script exporter.
+
+	// Load the level script, skip the asset list, and read all the entities in.
+	ifstream fin(pLevel->scriptName.c_str(), /*ios_base::binary |*/ ios_base::in);
+	if (!fin.is_open())
+		return false;
 	unsigned int numAssets;
 	(fin >> numAssets).get();
-	vector<string> assetList(numAssets);
+	string assetName;
 	for (unsigned int i = 0; i < numAssets; i++)
-		getline(fin, assetList[i]);
-	renderer.SetAssetList(&assetList);
+		getline(fin, assetName);
 
-	// Wait for the renderer to finish loading before moving on.
-	while (renderer.GetState() == PI_Render::LoadAssetState);
-
-#if 0 // TODO:: Update the entity script exporter.
-
-	// Read all the entities in.
 	PI_Mat44 worldMat;
 	string entityName;
 	while (getline(fin, entityName))
@@ -124,8 +141,44 @@ bool Game::LoadLevel(void)
 			// File is corrupted.
 			return false;
 	}
+	fin.close();
 #endif
-	
+
+	state = LoadingState;
+	return true;
+}
+
+// Show the level's loading progress, and finish loading once every asset is resident.
+void Game::UpdateLoading(void)
+{
+	unsigned int numFinished, numRequested;
+	renderer.GetAssetProgress(numFinished, numRequested);
+	if (numFinished == numRequested)
+	{
+		if (numFailedAssets)
+			ERRORBOX("Some of the level's assets failed to load!");
+
+		// The level can't be played without its player, so give up rather than retrying every frame.
+		if (!FinishLoadLevel())
+		{
+			state = ShutdownState;
+			PostQuitMessage(-1);
+		}
+		return;
+	}
+
+	// There's nothing to look at yet, so the frame is just the progress.
+	ostringstream out;
+	out << "Loading... " << numFinished * 100 / numRequested << '%';
+	gui.DrawString(out, 10, 40, 24);
+	renderer.CommitFrame();
+}
+
+// Set up everything that needs the level's assets.
+//
+// Returns:		True if successful.
+bool Game::FinishLoadLevel(void)
+{
 	// Init the player.
 	if (!player.Init())
 	{
@@ -135,34 +188,69 @@ bool Game::LoadLevel(void)
 
 	// Set up the reticle GUI element.
 	unsigned int texName;
-	if (!renderer.GetTextureHandle("DATA\\Reticle.tga", texName))
+	PI_AtlasRegion texRegion;
+	if (!renderer.GetTextureRegion("DATA\\Reticle.tga", texName, texRegion))
 	{
 		ERRORBOX("Failed to load DATA\\Reticle.tga!");
 		return false;
 	}
-	reticleGUI.SetTextureName(texName);
+	reticleGUI.SetTextureName(texName, texRegion);
 	reticleGUI.SetDimensions(64, 64);
 	reticleGUI.SetColor(0, 1.0f, 0.125f, 1.0f);
 
 	// Lights, camera...
 	light.SetDirection(0.33f, 0.75f, 0.33f);
-	renderer.SetActiveDLight(&light);
 
+	if (renderer.GetViewportHeight())
+		camera.SetPerspective(45, float(renderer.GetViewportWidth()) / renderer.GetViewportHeight(), 1, 650);
 	camera.MoveTo(PI_Vec3(0,50,30));
 	camera.LookAt(PI_Vec3(0,0,0));
-	renderer.SetActiveCam(&camera);
-	renderer.SetUpdateCameraState();
+	camera.UpdateFrustum();
+
+	// Start decoding the next level's assets while this one is played.
+	const PI_LevelManifest::PI_Level *pNextLevel = levels.GetLevel(curLevel + 1);
+	if (pNextLevel)
+		renderer.PrefetchAssets(pNextLevel->vAssets);
 
 	// All world entities should be ready to go.
-	fin.close();
 	state = PlayState;
 	return true;
 }
 
+// Count each level asset that fails to load.
+void Game::OnLevelAssetLoaded(const char *filename, bool loaded, void *pUserData)
+{
+	if (!loaded)
+		InterlockedIncrement(&((Game *)pUserData)->numFailedAssets);
+}
+
 // Release the current level assets and entities.
 void Game::UnloadLevel(void)
 {
 	renderer.SetUnloadState();
+	DeleteEntities();
+}
+
+// Switch to another level. Assets the two levels share stay resident,
+// and the rest of the current level's assets are released once the new level is in.
+//
+// In:			level			The level to switch to.
+//
+// Returns:		False if there's no such level.
+bool Game::ChangeLevel(unsigned int level)
+{
+	if (!levels.GetLevel(level))
+		return false;
+
+	DeleteEntities();
+	curLevel = level;
+	state = LoadState;
+	return true;
+}
+
+// Release the current level's entities.
+void Game::DeleteEntities(void)
+{
 	const unsigned int NumEntities = (unsigned int)vEntity.size();
 	for (unsigned int i = 0; i < NumEntities; ++i)
 		delete vEntity[i];
@@ -179,8 +267,27 @@ void Game::Update(float deltaTime)
 	{
 		case LoadState:
 			LoadLevel();
-			break;
+			return;
+		case LoadingState:
+			// Nothing can move until the level is in.
+			UpdateLoading();
+			return;
+		case ShutdownState:
+			// Waiting for the quit message to get through.
+			return;
+	}
+
+	// Page Down moves on to the next level, or back to the first after the last one.
+	// Whatever the two levels share stays resident.
+	const bool NextLevelKey = KEYDOWN(VK_NEXT) != 0;
+	if (NextLevelKey && !nextLevelKeyDown)
+	{
+		nextLevelKeyDown = true;
+		if (!ChangeLevel(curLevel + 1))
+			ChangeLevel(0);
+		return;
 	}
+	nextLevelKeyDown = NextLevelKey;
 
 	// The player must be updated before the camera, as it tracks the player.
 	POINT mouse;
@@ -189,17 +296,15 @@ void Game::Update(float deltaTime)
 	player.SetMousePos(mouseVec);
 	player.Update(deltaTime);
 
-	// Update the camera.
+	// Update the camera. The renderer draws from a copy, so there's nothing to lock.
 	PI_Vec3 vec = player.GetWorldTranslation();
-	EnterCriticalSection(&g_cs);
 	camera.LookAt(vec);
 	vec.y += 33;
 	vec.z += 33;
 	camera.MoveTo(vec);
-	LeaveCriticalSection(&g_cs);
 	
-	// The camera must be applied before any frustum culling can be performed.
-	renderer.SetUpdateCameraState();
+	// The frustum must be rebuilt before any frustum culling can be performed.
+	camera.UpdateFrustum();
 
 	UpdateOnscreenEntities(deltaTime);
 	
@@ -211,14 +316,14 @@ void Game::Update(float deltaTime)
 	reticleGUI.SetPosition(mouseVec);
 	gui.DrawGUIObject(&reticleGUI);
 
-	// Make sure the renderer isn't currently trying to draw a frame.
-	while (renderer.GetState() != PI_Render::ReadyState);
-
-	// Add everything onscreen to the render list, and tell the rendering thread to draw.
-	EnterCriticalSection(&g_cs);
-	player.AddToRenderList(vRenderList);
+	// Record everything onscreen into this frame's packet, and publish it.
+	// The renderer draws the newest packet it has, so there's no waiting for it to finish the last one.
+	PI_FramePacket &frame = renderer.GetFramePacket();
+	player.AddToRenderList(frame.vRenderList);
+	frame.camera = camera;
+	frame.lightDir = light.GetDirection();
+	frame.hasScene = true;
 	renderer.CommitFrame();
-	LeaveCriticalSection(&g_cs);
 }
 
 // Release all resources and subsystems.
@@ -253,19 +358,22 @@ void Game::UpdateOnscreenEntities(float deltaTime)
 {
 	unsigned int i = 0;
 
-	// Cull the world entities into a separate vector containing only those onscreen.
+	// Cull ranges of the world entities across the job pool, each into its own list.
 	const unsigned int NumEntities = (unsigned int)vEntity.size();
-	for ( ; i < NumEntities; ++i)
-		if (camera.SphereInFrustum(vEntity[i]->GetWorldTranslation(), vEntity[i]->GetBoundingRadius()))
-		{
-			// Look for an "unused" spot in the onscreen vector.
-			if (++numOnscreenEntities < vOnscreen.size())
-				vOnscreen[numOnscreenEntities - 1] = vEntity[i];
-			else
-				// Make room!
-				vOnscreen.push_back(vEntity[i]);
-			
-		}
+	const unsigned int NumRanges = (NumEntities + EntityCullRangeSize - 1) / EntityCullRangeSize;
+	if (vOnscreenRanges.size() < NumRanges)
+		vOnscreenRanges.resize(NumRanges);
+	if (NumRanges > 1)
+		PI_JobPool::GetInstance().ParallelFor(CullEntitiesJob, this, NumRanges);
+	else if (NumRanges)
+		CullEntitiesJob(this, 0);
+
+	// Merge the lists in range order into a separate vector containing only those onscreen,
+	// so it comes out the same however the ranges were run. Clearing keeps its memory.
+	vOnscreen.clear();
+	for (i = 0; i < NumRanges; ++i)
+		vOnscreen.insert(vOnscreen.end(), vOnscreenRanges[i].begin(), vOnscreenRanges[i].end());
+	numOnscreenEntities = (unsigned int)vOnscreen.size();
 
 	// Sort the onscreen entities by their distance to the player.
 	sort(vOnscreen.begin(), vOnscreen.begin() + numOnscreenEntities, Compare);
@@ -277,6 +385,27 @@ void Game::UpdateOnscreenEntities(float deltaTime)
 
 }
 
+// Cull a range of the world entities. Run on the job pool.
+//
+// In:			pContext		The Game.
+//				range			Which EntityCullRangeSize entities to cull.
+void Game::CullEntitiesJob(void *pContext, unsigned int range)
+{
+	Game &game = *(Game *)pContext;
+	vector<Entity *> &vVisible = game.vOnscreenRanges[range];
+	vVisible.clear();
+
+	const unsigned int NumEntities = (unsigned int)game.vEntity.size(),
+					   First = range * EntityCullRangeSize,
+					   Last = First + EntityCullRangeSize < NumEntities ? First + EntityCullRangeSize : NumEntities;
+	for (unsigned int i = First; i < Last; ++i)
+	{
+		Entity *pEntity = game.vEntity[i];
+		if (game.camera.SphereInFrustum(pEntity->GetWorldTranslation(), pEntity->GetBoundingRadius()))
+			vVisible.push_back(pEntity);
+	}
+}
+
 // Compare two entities based on their distance from the player.
 //
 // In:			e1
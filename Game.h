@@ -7,6 +7,7 @@
 #include "PI_Render.h"
 #include "PI_Logger.h"
 #include "PI_GUI.h"
+#include "PI_LevelManifest.h"
 
 #include "Player.h"
 
@@ -18,6 +19,7 @@ public:
 	{
 		StartupState,
 		LoadState,
+		LoadingState,			// Waiting for the level's assets to stream in.
 		PlayState,
 		ShutdownState
 	};
@@ -30,7 +32,8 @@ private:
 	Game &operator=(const Game &rhs);
 	
 	Game(void) : renderer(PI_Render::GetInstance()), logger(PI_Logger::GetInstance()), gui(PI_GUI::GetInstance()),
-				 numOnscreenEntities(0), state(StartupState), curLevel(0)
+				 numOnscreenEntities(0), state(StartupState), curLevel(0),
+				 numFailedAssets(0), nextLevelKeyDown(false)
 	{ }
 
 	// GUI elements.
@@ -50,8 +53,9 @@ private:
 	vector<Entity *> vOnscreen;
 	unsigned int numOnscreenEntities;
 
-	// Everything to be rendered during the current frame.
-	reusable_vector<PI_RenderElement> vRenderList;
+	// What each range of world entities culled to, kept from frame to frame for their memory.
+	vector< vector<Entity *> > vOnscreenRanges;
+	static const unsigned int EntityCullRangeSize;
 
 	// The main subsystems.
 	PI_Render &renderer;
@@ -62,6 +66,15 @@ private:
 	GameState state;
 	unsigned int curLevel;
 
+	// Every level's script and assets.
+	PI_LevelManifest levels;
+
+	// How many of the current level's assets couldn't be loaded. Counted on the render thread.
+	volatile LONG numFailedAssets;
+
+	// Was the next level key down last frame? Holding it only changes level once.
+	bool nextLevelKeyDown;
+
 public:
 	// Singleton accessor.
 	static Game &GetInstance(void) { return m_instance; }
@@ -69,7 +82,8 @@ public:
 	// Initialize the game.
 	bool Init(void);
 
-	// Load the current level assets and entities.
+	// Request the current level assets and load its entities.
+	// The level is finished by UpdateLoading once the assets are resident.
 	//
 	// Returns:		True if successful.
 	bool LoadLevel(void);
@@ -77,6 +91,14 @@ public:
 	// Release the current level assets and entities.
 	void UnloadLevel(void);
 
+	// Switch to another level. Assets the two levels share stay resident,
+	// and the rest of the current level's assets are released once the new level is in.
+	//
+	// In:			level			The level to switch to.
+	//
+	// Returns:		False if there's no such level.
+	bool ChangeLevel(unsigned int level);
+
 	// Update the game.
 	//
 	// In:			deltaTime		How much time has elapsed since the last update. (milliseconds)
@@ -93,12 +115,29 @@ public:
 	// Returns						True if e1 is closer to the player than e2.
 	friend bool Compare(const Entity *e1, const Entity *e2);
 
-	// Accessor for the rendering list.
-	reusable_vector<PI_RenderElement> *GetRenderList(void) { return &vRenderList; }
-
 private:
+	// Release the current level's entities.
+	void DeleteEntities(void);
+
+	// Show the level's loading progress, and finish loading once every asset is resident.
+	void UpdateLoading(void);
+
+	// Set up everything that needs the level's assets.
+	//
+	// Returns:		True if successful.
+	bool FinishLoadLevel(void);
+
+	// Count each level asset that fails to load.
+	static void OnLevelAssetLoaded(const char *filename, bool loaded, void *pUserData);
+
 	// Cull world entities and update what's onscreen.
 	//
 	// In:			deltaTime		How much time has elapsed since the last update. (milliseconds)
 	void UpdateOnscreenEntities(float deltaTime);
+
+	// Cull a range of the world entities. Run on the job pool.
+	//
+	// In:			pContext		The Game.
+	//				range			Which EntityCullRangeSize entities to cull.
+	static void CullEntitiesJob(void *pContext, unsigned int range);
 };
@@ -20,7 +20,8 @@ bool Player::Init(void)
 {
 	// Set up the particle systems.
 	unsigned int particleTex;
-	if (!renderer.GetTextureHandle("DATA\\particle.tga", particleTex))
+	PI_AtlasRegion particleRegion;
+	if (!renderer.GetTextureRegion("DATA\\particle.tga", particleTex, particleRegion))
 		return false;
 	/*cannonFlash.SetLife(0.5f, 20);
 	cannonFlash.SetSize(0.5f, 50);
@@ -32,7 +33,7 @@ bool Player::Init(void)
 	cannonFlash.AddColorKeyframe(0.25f, 0.25f, 0.25f, 0, 0);
 	cannonFlash.SavePreset("DATA\\cannonFlash.txt");*/
 
-//	cannonFlash.SetDiffuseTexture(particleTex);
+//	cannonFlash.SetDiffuseTexture(particleTex, particleRegion);
 //	cannonFlash.LoadPreset("DATA\\cannonFlash.txt");
 	//cannonFlash.SetEmitterType(Fountain);
 
@@ -238,8 +239,8 @@ void Player::Fire(float deltaTime)
 // In:		vpList		The list to add to.
 void Player::AddToRenderList(reusable_vector<PI_RenderElement> &vpList)
 {
-	// Add all nodes to the render list.
-	vpList.push_back(PI_RenderElement(worldMat, *pHullNode));
-	vpList.push_back(PI_RenderElement(cannonMat, *pCannonNode));
-	vpList.push_back(PI_RenderElement(turretMat, *pTurretNode));
+	// Add all nodes to the render list. Their shadows are cached as long as the player's around.
+	vpList.push_back(PI_RenderElement(worldMat, *pHullNode, this));
+	vpList.push_back(PI_RenderElement(cannonMat, *pCannonNode, this));
+	vpList.push_back(PI_RenderElement(turretMat, *pTurretNode, this));
 }
\ No newline at end of file
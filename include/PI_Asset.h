@@ -0,0 +1,196 @@
+// PigIron asset decoding interface.
+//
+// Everything in here works on system memory only and never touches OpenGL,
+// so it is safe to call from any thread.
+
+#pragma once
+
+#include <vector>
+using std::vector;
+#include <string>
+using std::string;
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <gl\gl.h>
+
+#include "glext.h"
+#include "PI_Geom.h"
+#include "PI_Profile.h"
+
+// A 24- or 32-bit image decoded from a TARGA file, ready to be uploaded.
+struct PI_Image
+{
+	unsigned short width, height;
+	unsigned char components;		// Bytes per pixel.
+	GLenum format;					// GL_BGR_EXT or GL_BGRA_EXT.
+	vector<unsigned char> pixels;
+
+	PI_Image(void) : width(0), height(0), components(0), format(0) { }
+};
+
+// A single mesh node decoded from a PIM file.
+struct PI_MeshNodeData
+{
+	string name;					// The internal object name.
+	string diffTexFilename,			// Diffuse texture, including the PIM file's path. Empty if untextured.
+		   normTexFilename;			// Normal map the diffuse texture implies. May not exist on disk.
+	unsigned char flags;			// Rendering flags, as stored in the file.
+	PI_Mat44 ltm;					// LTM - local transform matrix.
+	vector<PI_Triangle> vTris;		// Geometry, if the node is renderable.
+	vector<PI_Edge> vEdges;			// Silhouette edges, if the node casts shadows.
+	PI_Vec3 aabb_min, aabb_max;		// Axis-aligned bounding box dimensions.
+	float boundingRadius;			// Bounding sphere radius.
+
+	PI_MeshNodeData(void) : flags(0), boundingRadius(0) { }
+};
+
+// A complete PIM file decoded into memory.
+struct PI_MeshData
+{
+	string filename;
+	vector<PI_MeshNodeData> vNodes;
+};
+
+// Sequential reader over a file image in memory.
+class PI_MemReader
+{
+	const unsigned char *pCur, *pEnd;
+
+public:
+	PI_MemReader(const unsigned char *pData, unsigned int size) : pCur(pData), pEnd(pData + size) { }
+
+	// Copy the next bytes out of the buffer.
+	//
+	// Returns					False if there weren't enough bytes left.
+	bool Read(void *pOut, unsigned int bytes)
+	{
+		if ((unsigned int)(pEnd - pCur) < bytes)
+			return false;
+		memcpy(pOut, pCur, bytes);
+		pCur += bytes;
+		return true;
+	}
+
+	// Skip over the next bytes in the buffer.
+	bool Skip(unsigned int bytes)
+	{
+		if ((unsigned int)(pEnd - pCur) < bytes)
+			return false;
+		pCur += bytes;
+		return true;
+	}
+
+	// Read up to the next newline, which is consumed but not stored.
+	bool ReadLine(string &out)
+	{
+		if (pCur >= pEnd)
+			return false;
+		const unsigned char *pStart = pCur;
+		while (pCur < pEnd && *pCur != '\n')
+			++pCur;
+		out.assign((const char *)pStart, pCur - pStart);
+		if (pCur < pEnd)
+			++pCur;
+		return true;
+	}
+
+	unsigned int BytesLeft(void) const { return (unsigned int)(pEnd - pCur); }
+};
+
+// Read an entire file into memory.
+//
+// In:		filename		Name of desired file, can be relative or absolute.
+//			pProfile		Where to record open and read timings. May be 0.
+//
+// Out:		out				The file contents.
+//
+// Returns					True if the whole file was read.
+bool PI_ReadFile(const char *filename, vector<unsigned char> &out, PI_AssetProfile *pProfile = 0);
+
+// Decode a 24- or 32-bit uncompressed TARGA image.
+//
+// In:		pData, size		The file image in memory.
+//			pProfile		Where to record decode timings. May be 0.
+//
+// Out:		out				The decoded image.
+//
+// Returns					True if the image is in a supported format.
+bool PI_DecodeTarga(const unsigned char *pData, unsigned int size, PI_Image &out, PI_AssetProfile *pProfile = 0);
+
+// Decode a PigIron Mesh (PIM) file.
+//
+// In:		filename		Name the data was read from - texture paths are relative to it.
+//			pData, size		The file image in memory.
+//			pProfile		Where to record decode and edge timings. May be 0.
+//
+// Out:		out				The decoded mesh.
+//
+// Returns					True if the whole file was decoded.
+bool PI_DecodePIM(const char *filename, const unsigned char *pData, unsigned int size, PI_MeshData &out,
+				  PI_AssetProfile *pProfile = 0);
+
+// Cooked copies of asset files sit next to them, with this appended to the name.
+#define PI_COOKED_EXT ".piz"
+
+// Is there a cooked copy of a file that's at least as new as the file itself?
+//
+// In:		filename		Name of the source file.
+//			cookedFilename	Name of the cooked copy.
+//
+// Returns					True if the cooked copy can be used. It can if the source is missing.
+bool PI_IsCookedCurrent(const char *filename, const char *cookedFilename);
+
+// Read an asset file into memory. If there's an up to date cooked copy, that's read
+// instead and its chunks are decompressed straight into out - in parallel, unless
+// the caller is a background thread.
+//
+// In:		filename		Name of the source file, can be relative or absolute.
+//			pProfile		Where to record open, read and inflate timings. May be 0.
+//
+// Out:		out				The source file's contents.
+//
+// Returns					True if the whole file was read.
+bool PI_ReadAssetFile(const char *filename, vector<unsigned char> &out, PI_AssetProfile *pProfile = 0);
+
+// Write the cooked copy of an asset file. The file is split into chunks that are
+// compressed independently, and any chunk that doesn't shrink is stored as is.
+//
+// In:		filename		Name of the source file, can be relative or absolute.
+//
+// Returns					True if the cooked copy was written.
+bool PI_CookAsset(const char *filename);
+
+// Cook every TGA, PIM and PWM file in a directory.
+//
+// Returns					True if every file was cooked.
+bool PI_CookDirectory(const char *directory);
+
+// Read and decode a TARGA file.
+bool PI_LoadTargaData(const char *filename, PI_Image &out, PI_AssetProfile *pProfile = 0);
+
+// Read and decode a PIM file.
+bool PI_LoadPIMData(const char *filename, PI_MeshData &out, PI_AssetProfile *pProfile = 0);
+
+
+// Starting value for PI_HashBytes.
+const ULONGLONG PI_HashSeed = 14695981039346656037ULL;
+
+// Hash a block of memory (64-bit FNV-1a).
+//
+// In:		pData, size		The memory to hash.
+//			hash			A previous result, to hash several blocks together.
+//
+// Returns					The hash.
+ULONGLONG PI_HashBytes(const void *pData, unsigned int size, ULONGLONG hash = PI_HashSeed);
+
+// Hash a decoded image's dimensions, format and pixels.
+ULONGLONG PI_HashImage(const PI_Image &image);
+
+// Hash everything about a mesh node that ends up in its display list and edge data.
+//
+// In:		node			The decoded node.
+//			flags			The node's rendering flags that affect how it's compiled.
+//
+// Returns					The hash.
+ULONGLONG PI_HashMeshNode(const PI_MeshNodeData &node, unsigned char flags);
\ No newline at end of file
@@ -0,0 +1,81 @@
+// PigIron asset hot-reload interface.
+//
+// Watches a directory tree for changed TGA and PIM files, and re-decodes
+// each changed file on a worker thread. The renderer collects the results
+// and swaps them into the existing texture and display list names.
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <vector>
+using std::vector;
+#include <string>
+using std::string;
+
+#include "PI_Asset.h"
+
+class PI_AssetWatcher
+{
+public:
+
+	// An asset that changed on disk, already decoded.
+	struct PI_ReloadedAsset
+	{
+		enum AssetType { Texture, Mesh };
+
+		string filename;
+		AssetType type;
+		PI_Image image;			// Valid if type == Texture.
+		PI_MeshData mesh;		// Valid if type == Mesh.
+	};
+
+	PI_AssetWatcher(void);
+	~PI_AssetWatcher(void);
+
+	// Start watching a directory and everything below it.
+	//
+	// In:		directory		The directory asset filenames are relative to, e.g. "DATA".
+	//
+	// Returns					True if the worker thread is running.
+	bool Start(const char *directory);
+
+	// Stop watching and wait for the worker thread to exit.
+	void Stop(void);
+
+	// Take the next decoded asset, if there is one.
+	//
+	// Returns					The asset, which the caller must delete, or 0 if nothing is waiting.
+	PI_ReloadedAsset *PopReload(void);
+
+private:
+
+	PI_AssetWatcher(const PI_AssetWatcher &rhs);
+	PI_AssetWatcher &operator=(const PI_AssetWatcher &rhs);
+
+	// Worker thread entry point.
+	static unsigned int __stdcall WatchThread(void *pWatcher);
+
+	// Wait for change notifications until told to stop.
+	void Watch(void);
+
+	// Record the asset files named in a change notification buffer.
+	void QueueChangedFiles(const unsigned char *pBuffer);
+
+	// Decode every queued file and hand the results to the renderer.
+	void DecodeChangedFiles(void);
+
+	// How long a file has to go without being touched before it's decoded (milliseconds).
+	// Editors tend to write files in several chunks.
+	static const DWORD SettleTime;
+
+	string directory;
+	HANDLE hThread, hStopEvent;
+
+	// Files that have changed but haven't settled yet. Only touched by the worker thread.
+	vector<string> vChanged;
+
+	// Decoded assets waiting for the renderer.
+	CRITICAL_SECTION cs;
+	vector<PI_ReloadedAsset *> vpReloads;
+};
@@ -0,0 +1,90 @@
+// PigIron texture atlas interface.
+//
+// Small images - GUI sprites, particles, font pages - are packed into shared pages,
+// so things drawn with different images can be drawn together without switching
+// textures. Packing works on system memory only and never touches OpenGL.
+//
+// Atlas descriptors (.pat) list the images to pack, one per line after the count,
+// like a level script.
+
+#pragma once
+
+#include <vector>
+using std::vector;
+#include <string>
+using std::string;
+
+#include "PI_Asset.h"
+
+// Where an image is in its texture, in texture coordinates. The default is the whole texture.
+struct PI_AtlasRegion
+{
+	float uOrigin, vOrigin, uWidth, vHeight;
+
+	PI_AtlasRegion(void) : uOrigin(0), vOrigin(0), uWidth(1), vHeight(1) { }
+
+	// Map a coordinate on the original image onto its texture.
+	float U(float u) const { return uOrigin + u * uWidth; }
+	float V(float v) const { return vOrigin + v * vHeight; }
+};
+
+class PI_AtlasBuilder
+{
+public:
+
+	// An image placed on a page.
+	struct PI_Placement
+	{
+		string name;
+		unsigned int page;
+		unsigned short x, y, width, height;		// Texels, not counting the padding around it.
+		PI_AtlasRegion region;
+	};
+
+	// Texels of padding around each image, copied from its edges so filtering doesn't bleed.
+	static const unsigned short Padding = 1;
+
+	// Pages start as small as the largest image allows, and grow to this before a new page is started.
+	static const unsigned short MaxPageSize = 1024;
+
+	PI_AtlasBuilder(void) : pageSize(0), numPages(0) { }
+
+	// Queue an image for packing.
+	//
+	// In:		name			What the image will be found by.
+	//			image			The image. It's copied.
+	//
+	// Returns					False if the image is too large to share a page.
+	bool Add(const char *name, const PI_Image &image);
+
+	// Place every queued image. Tallest images go first, along shelves.
+	void Pack(void);
+
+	unsigned int GetNumPages(void) const { return numPages; }
+	unsigned short GetPageSize(void) const { return pageSize; }
+	const vector<PI_Placement> &GetPlacements(void) const { return vPlacements; }
+
+	// Draw every image on a page into one 32-bit image.
+	//
+	// In:		page			Which page.
+	//
+	// Out:		out				The page, in GL_BGRA_EXT.
+	void BuildPage(unsigned int page, PI_Image &out) const;
+
+	// Convert an image to 32 bits, with its edges copied out into the padding.
+	//
+	// Out:		out				The padded image, in GL_BGRA_EXT.
+	static void PadImage(const PI_Image &image, PI_Image &out);
+
+private:
+
+	// Shelf pack everything onto pages of one size.
+	//
+	// Returns					How many pages it took.
+	unsigned int PackPages(unsigned short size);
+
+	vector<PI_Placement> vPlacements;
+	vector<PI_Image> vImages;				// In the same order as the placements.
+	unsigned short pageSize;
+	unsigned int numPages;
+};
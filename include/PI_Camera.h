@@ -16,15 +16,18 @@ class PI_Camera
 			target,	// What specific point is it looking at?
 			up;		// Which way's up?
 
+	// The matrices the renderer loads. The view is rebuilt by UpdateFrustum.
+	PI_Mat44 viewMat, projectionMat;
+
 public:
 
 	// Default constructor.
 	PI_Camera(void) : up(0,1,0), target(0,0,-1)
-	{ }
+	{ SetPerspective(45, 4.0f / 3.0f, 1, 650); }
 
 	// Powerful constructor.
 	PI_Camera(const PI_Vec3 &_pos, const PI_Vec3 &_target, const PI_Vec3 &_up) : pos(_pos), target(_target), up(_up)
-	{ }
+	{ SetPerspective(45, 4.0f / 3.0f, 1, 650); }
 
 	// Accessor for the position.
 	const PI_Vec3 &GetPosition(void) const { return pos; }
@@ -52,5 +55,30 @@ public:
 	// In:		where			Where to look.
 	void LookAt(const PI_Vec3 &where);
 
-	bool SphereInFrustum(const PI_Vec3 & where, float radius);
+	// Set up the projection, as gluPerspective would.
+	//
+	// In:		fovY			The vertical field of view. (degrees)
+	//			aspect			The viewport's width over its height.
+	//			zNear, zFar		The distances to the clip planes.
+	void SetPerspective(float fovY, float aspect, float zNear, float zFar);
+
+	// Set up the projection, as glOrtho would with the view centered.
+	//
+	// In:		halfWidth, halfHeight	Half the size of the view volume.
+	//			zNear, zFar				The distances to the clip planes.
+	void SetOrthographic(float halfWidth, float halfHeight, float zNear, float zFar);
+
+	// Rebuild the view matrix and the frustum planes on the CPU.
+	// Must be called after the camera moves, and before SphereInFrustum.
+	void UpdateFrustum(void);
+
+	bool SphereInFrustum(const PI_Vec3 & where, float radius) const;
+
+	// Does a sphere touch the frustum anywhere along a straight sweep?
+	//
+	// In:		where, radius	The sphere at the start of the sweep.
+	//			sweep			How far it moves, and in what direction.
+	//
+	// Returns					False only if the swept sphere is entirely outside the frustum.
+	bool SweptSphereInFrustum(const PI_Vec3 &where, float radius, const PI_Vec3 &sweep) const;
 };
\ No newline at end of file
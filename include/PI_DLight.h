@@ -6,9 +6,19 @@
 
 #include <vector>
 using std::vector;
+#include <map>
+using std::map;
+using std::pair;
 
 #include "PI_Geom.h"
 
+// One caster's part of the shadow volume.
+struct PI_ShadowCaster
+{
+	unsigned int firstQuad, numQuads;
+	PI_Vec3 aabbMin, aabbMax;		// World space bounds of the caster's quads.
+};
+
 class PI_DLight
 {
 	friend class PI_Render;
@@ -16,13 +26,52 @@ class PI_DLight
 	PI_Vec3 dir;
 	unsigned int shadowQuadCount;
 
+	// Where each caster's quads are in the shadow volume.
+	vector<PI_ShadowCaster> vShadowCasters;
+
 	// How far are shadow quads extruded?
 	static const float ShadowLength;
 
+	// A caster's silhouette, and the shadow quads extruded from it.
+	struct PI_ShadowCache
+	{
+		PI_Vec3 lightDirModel;		// The model space light the silhouette was found for.
+		vector<PI_Vec3> vSilhouette;	// Model space edge endpoints, in pairs, wound to face out of the volume.
+
+		PI_Mat44 worldXform;		// The transform and light the quads were extruded with.
+		PI_Vec3 lightDir;
+		vector<PI_Quad> vQuads;
+		PI_Vec3 aabbMin, aabbMax;
+
+		unsigned int lastUsed;		// The frame the caster was last drawn.
+	};
+
+	// Cached shadows, keyed by the caster and its edges.
+	typedef pair<const void *, const vector<PI_Edge> *> ShadowKey;
+	map<ShadowKey, PI_ShadowCache> shadowCache;
+	unsigned int frameCount;
+
+	// How far can the model space light turn before a silhouette is found again? (cosine)
+	static const float SilhouetteTolerance;
+
+	// How many frames can a caster go undrawn before its shadow is dropped?
+	static const unsigned int ShadowCacheFrames;
+
+	// Find the edges between faces towards the light and faces away from it.
+	//
+	// In:		vEdges			The caster's edges.
+	//			lightDirModel	The light direction in model space.
+	//
+	// Out:		vSilhouette		Edge endpoints, in pairs, wound to face out of the volume.
+	static void FindSilhouette(const vector<PI_Edge> &vEdges, const PI_Vec3 &lightDirModel, vector<PI_Vec3> &vSilhouette);
+
+	// Add a quad to the shadow volume.
+	void AddShadowQuad(const PI_Quad &quad);
+
 public:
 
-	PI_DLight(const PI_Vec3 &direction) : dir(direction), shadowQuadCount(0) { }
-	PI_DLight(float x = 0, float y = 0, float z = 0) : dir(x, y, z), shadowQuadCount(0) { }
+	PI_DLight(const PI_Vec3 &direction) : dir(direction), shadowQuadCount(0), frameCount(0) { }
+	PI_DLight(float x = 0, float y = 0, float z = 0) : dir(x, y, z), shadowQuadCount(0), frameCount(0) { }
 
 	const PI_Vec3 &GetDirection(void) const
 	{
@@ -33,7 +82,18 @@ public:
 
 	void SetDirection(float x, float y, float z);
 
-	void BuildShadowVolume(const vector<PI_Edge> &vEdges, const PI_Mat44 &worldXform);
+	// Add a caster's shadow to the shadow volume.
+	//
+	// In:		vEdges			The caster's edges.
+	//			worldXform		Where the caster is.
+	//			pCaster			Whatever owns the caster, if it's the same from frame to frame.
+	//							Its silhouette is then only found again once the light has turned
+	//							relative to it, and its quads only rebuilt once it or the light moves.
+	void BuildShadowVolume(const vector<PI_Edge> &vEdges, const PI_Mat44 &worldXform, const void *pCaster = 0);
+
+	// Start a new frame's shadow volume, and drop the shadows of casters that have gone undrawn.
+	void ClearShadowVolume(void);
 
-	void ClearShadowVolume(void) { shadowQuadCount = 0; }
+	// Drop every cached shadow. Must be called when edges are released or replaced.
+	void ClearShadowCache(void) { shadowCache.clear(); }
 };
\ No newline at end of file
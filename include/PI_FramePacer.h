@@ -0,0 +1,73 @@
+// PigIron frame pacing interface.
+//
+// Holds the main loop to a target frame rate by sleeping on a waitable timer until each
+// frame is due, rather than spinning. The timer wakes the loop a little early, and the
+// last fraction of a millisecond is waited out on the high resolution clock.
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#pragma comment(lib, "Winmm")
+
+class PI_FramePacer
+{
+public:
+
+	PI_FramePacer(void) : hTimer(0), highResolution(false), periodRaised(false), frameSeconds(0), lastFrame(0), nextFrame(0),
+						  numFrames(0), numLateFrames(0), meanSeconds(0), sumSquares(0), maxSeconds(0)
+	{ }
+
+	~PI_FramePacer() { Shutdown(); }
+
+	// Start pacing.
+	//
+	// In:		targetRate		Frames per second to hold to. 0 runs flat out.
+	//
+	// Returns					True if frames can be waited for without spinning.
+	bool Init(double targetRate);
+
+	// Log what was achieved, and release the timer.
+	void Shutdown(void);
+
+	// Wait until the next frame is due, and start it.
+	//
+	// Returns					Seconds since the last frame started.
+	double WaitForNextFrame(void);
+
+	// Frames per second being held to, or 0 if frames aren't paced.
+	double GetTargetRate(void) const { return frameSeconds ? 1.0 / frameSeconds : 0; }
+
+	// What's actually been achieved, since Init.
+	unsigned int GetNumFrames(void) const { return numFrames; }
+	double GetMeanFrameSeconds(void) const { return meanSeconds; }
+	double GetFrameSecondsVariance(void) const { return numFrames > 1 ? sumSquares / (numFrames - 1) : 0; }
+	double GetMaxFrameSeconds(void) const { return maxSeconds; }
+
+	// Frames that took over half a frame longer than they should have.
+	unsigned int GetNumLateFrames(void) const { return numLateFrames; }
+
+private:
+
+	// Sleep until a time on the high resolution clock.
+	void WaitUntil(double seconds) const;
+
+	// Fold a frame's length into the statistics.
+	void AddFrame(double seconds);
+
+	// The timer slept on, whether it's a high resolution one,
+	// and whether the system timer period had to be raised for it instead.
+	HANDLE hTimer;
+	bool highResolution, periodRaised;
+
+	// The target frame length, and when the last frame started and the next one is due.
+	double frameSeconds, lastFrame, nextFrame;
+
+	// Running frame time statistics (Welford's method).
+	unsigned int numFrames, numLateFrames;
+	double meanSeconds, sumSquares, maxSeconds;
+
+	// How early the timer wakes the loop, to be sure it isn't late.
+	static const double HighResolutionSlack, LowResolutionSlack;
+};
@@ -0,0 +1,117 @@
+// PigIron frame packet interface.
+//
+// The game records everything a frame needs into a packet of its own, then publishes
+// it with a single atomic exchange. The render thread draws the newest published
+// packet, so neither thread ever waits on the other. Three packets are enough for
+// that: one being recorded, one being drawn, and the newest finished one between them.
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <vector>
+using std::vector;
+
+#include "PI_Geom.h"
+#include "PI_Camera.h"
+#include "PI_Particle.h"
+#include "PI_GUI.h"
+#include "PI_Utils.h"
+
+struct PI_NodeGeometry;
+
+// Descriptor for renderable static geometry.
+class PI_RenderElement
+{
+	friend class PI_Render;
+	PI_Mat44 worldXform;
+
+	unsigned int geometry,			// The handle of the geometry to render.
+				    diffTexName,	// The diffuse texture to apply.
+					normTexName; // The normal map texture to apply.
+	const PI_NodeGeometry *pGeometry;	// The geometry and edges to render.
+	float boundingRadius;			// The node's bounding sphere, centered on its origin.
+	const void *pCaster;			// Whatever drew the element, so its shadow can be cached. May be 0.
+
+	// Filled in by the renderer each frame. From the most significant bits down:
+	// pass (4), normal texture (12), diffuse texture (12), geometry (12), depth (24).
+	ULONGLONG sortKey;
+
+public:
+	// Render passes, in the order they're drawn.
+	enum Pass { OpaquePass };
+
+	// In:		mat				Where to draw the node.
+	//			node			The node to draw.
+	//			pCaster			Anything that stays the same from frame to frame while the node is drawn,
+	//							such as the entity drawing it. Lets the node's shadow be reused.
+	PI_RenderElement(const PI_Mat44 &mat, const PI_MeshNode &node, const void *pCaster = 0)
+		: worldXform(mat), geometry(node.geometry), diffTexName(node.diffTexName), normTexName(node.normalTexName),
+		  pGeometry(node.pGeometry), boundingRadius(node.GetBoundingRadius()), pCaster(pCaster), sortKey(0)
+	{ }
+};
+
+// Everything the renderer needs to draw one frame.
+struct PI_FramePacket
+{
+	reusable_vector<PI_RenderElement> vRenderList;
+	vector<PI_ParticleEmitter> vEmitters;
+	PI_GUI::PI_GUIFrame gui;
+
+	// The scene is only drawn once there's something to look at and light it with.
+	// The camera's frustum must already be up to date.
+	bool hasScene;
+	PI_Camera camera;
+	PI_Vec3 lightDir;
+
+	PI_FramePacket(void) : hasScene(false) { }
+
+	// Empty the packet for the next frame, keeping its storage.
+	void Clear(void)
+	{
+		vRenderList.mark_all_unused();
+		vEmitters.clear();
+		hasScene = false;
+	}
+};
+
+// Hands frame packets from the game thread to the render thread without locking.
+class PI_FrameQueue
+{
+public:
+
+	PI_FrameQueue(void);
+	~PI_FrameQueue(void);
+
+	// The packet being recorded. Only the game thread may touch it.
+	PI_FramePacket &GetWritePacket(void) { return packets[writeSlot]; }
+
+	// Publish the packet being recorded as the newest frame, and start recording into an empty one.
+	// Game thread only. A newer packet replaces one the render thread hasn't taken yet.
+	void Publish(void);
+
+	// Take the newest published packet, if it hasn't been taken already. Render thread only.
+	//
+	// Returns					The packet, which stays put until the next call, or 0 if nothing new was published.
+	PI_FramePacket *AcquireLatest(void);
+
+	// Wait until the game publishes a packet, or the time runs out.
+	//
+	// In:		milliseconds	The longest to wait.
+	void WaitForPublish(DWORD milliseconds) const;
+
+private:
+
+	PI_FrameQueue(const PI_FrameQueue &rhs);
+	PI_FrameQueue &operator=(const PI_FrameQueue &rhs);
+
+	// The newest finished slot is flagged until the render thread takes it.
+	enum { SlotMask = 3, FreshBit = 4 };
+
+	PI_FramePacket packets[3];
+	unsigned int writeSlot, readSlot;
+	volatile LONG latest;
+
+	// Signalled on every publish.
+	HANDLE hPublished;
+};
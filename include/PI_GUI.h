@@ -13,6 +13,11 @@ using std::string;
 using std::ostringstream;
 
 #include "PI_Math.h"
+#include "PI_RenderBackend.h"
+#include "PI_Atlas.h"
+
+// Cooked fonts sit next to their descriptors, with this in place of ".fnt".
+#define PI_FONT_EXT ".pif"
 
 class PI_GUIObject
 {
@@ -20,6 +25,7 @@ class PI_GUIObject
 	float rgba[4] = { 0, };
 	PI_Vec2 pos;
 	unsigned int texName;
+	PI_AtlasRegion texRegion;
 	float halfWidth, halfHeight;
 
 public:
@@ -41,9 +47,11 @@ public:
 		halfWidth = width / 2.0f, halfHeight = height / 2.0f;
 	}
 
-	void SetTextureName(unsigned int textureName)
+	// In:		textureName		The texture to draw with.
+	//			region			Where the image is in the texture, if it's been packed into an atlas.
+	void SetTextureName(unsigned int textureName, const PI_AtlasRegion &region = PI_AtlasRegion())
 	{
-		texName = textureName;
+		texName = textureName, texRegion = region;
 	}
 
 	void SetColor(float r, float g, float b, float a)
@@ -53,7 +61,10 @@ public:
 
 	virtual ~PI_GUIObject() { }
 
-	void Draw(void) const;
+	// Lay out the object's quad.
+	//
+	// Out:		vCorners		Gets its four corners appended.
+	void AddCorners(vector<PI_QuadVertex> &vCorners) const;
 };
 
 class PI_GUI
@@ -67,6 +78,33 @@ class PI_GUI
 			  offsetY;								// How far to vertically offset this character.
 	};
 
+	// A run of consecutive code points that all have glyphs.
+	struct PI_GlyphRange
+	{
+		unsigned int firstCode, numCodes,			// The code points in the run.
+					 firstGlyph;					// Index of the first code point's glyph.
+	};
+
+	// How much closer or further apart a pair of characters should be drawn.
+	struct PI_Kerning
+	{
+		unsigned int first, second;					// The code points, in the order they're drawn.
+		float amount;								// Normalized like PI_Glyph::offsetX.
+
+		bool operator<(const PI_Kerning &rhs) const
+		{
+			return first < rhs.first || (first == rhs.first && second < rhs.second);
+		}
+	};
+
+	// Every glyph in a font, with its metrics already normalized.
+	struct PI_Font
+	{
+		vector<PI_GlyphRange> vRanges;				// Sorted by code point.
+		vector<PI_Glyph> vGlyphs;
+		vector<PI_Kerning> vKerning;				// Sorted.
+	};
+
 	struct PI_String
 	{
 		string str;
@@ -86,18 +124,57 @@ class PI_GUI
 	PI_GUI(const PI_GUI &g);
 	PI_GUI &operator=(const PI_GUI &g);
 
-	vector<PI_String> vStrings;
-	mutable unsigned int numStrings;
+public:
 
-	vector<const PI_GUIObject *> vpGUIObjects;
-	mutable unsigned int numGUIObjects;
+	// Everything drawn on the GUI in one frame. Slots past the counts are unused, and kept for reuse.
+	struct PI_GUIFrame
+	{
+		vector<PI_String> vStrings;
+		unsigned int numStrings;
 
-	PI_Glyph fontGlyphs[256];
+		vector<PI_GUIObject> vObjects;
+		unsigned int numObjects;
+
+		PI_GUIFrame(void) : numStrings(0), numObjects(0) { }
+
+		void AddString(const char *string, float x, float y, float size, float r = 1, float g = 1, float b = 1, float a = 1);
+		void AddObject(const PI_GUIObject &obj);
+	};
+
+private:
+
+	// What the game has drawn since the last TakeFrame.
+	PI_GUIFrame recording;
+
+	PI_Font font;
 	unsigned int fontTexName;
 
+	// Find the glyph for a code point.
+	//
+	// Returns					The glyph, or 0 if the font doesn't have one.
+	const PI_Glyph *FindGlyph(unsigned int code) const;
+
+	// How much closer or further apart should two characters be drawn?
+	float GetKerning(unsigned int first, unsigned int second) const;
+
+	// Read and normalize an AngelCode BMFont text descriptor.
+	static bool ParseFont(const char *filename, PI_Font &out);
+
+	// Read a cooked font in one go.
+	static bool ReadCookedFont(const char *filename, PI_Font &out);
+
+	// Write a cooked font.
+	static bool WriteCookedFont(const char *filename, const PI_Font &font);
+
+	// The corners of the quads waiting to be drawn with one texture.
+	mutable vector<PI_QuadVertex> vQuadCorners;
+
+	// Draw the waiting quads in one call, and empty the list.
+	void FlushQuads(unsigned int texName, PI_RenderBackend &backend) const;
+
 	friend class PI_Render;
 	PI_Render &renderer;
-	void RenderGUI(void) const;
+	void RenderGUI(const PI_GUIFrame &frame, PI_RenderBackend &backend) const;
 
 public:
 
@@ -109,6 +186,12 @@ public:
 	void DrawString(const char *string, float x, float y, float size, float r = 1, float g = 1, float b = 1, float a = 1);
 	void DrawString(const ostringstream &ostr, float x, float y, float size, float r = 1, float g = 1, float b = 1, float a = 1);
 	void DrawGUIObject(const PI_GUIObject *pObj);
+
+	// Hand over everything drawn since the last call, and start recording the next frame.
+	// The frame passed in is recycled for that.
+	//
+	// Out:		out				What was drawn.
+	void TakeFrame(PI_GUIFrame &out);
 };
 
 
@@ -6,6 +6,8 @@
 
 #include <string>
 using std::string;
+#include <vector>
+using std::vector;
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -79,8 +81,24 @@ public:
 	void GetFaceNormal(PI_Vec3 &normalOut) const;
 };
 
+// Build the silhouette edge list for a triangle soup in linear time.
+// Vertices closer than weldTolerance are welded, and edges are matched up by their welded
+// vertex IDs. Degenerate triangles are skipped, and edges that can never be silhouettes
+// (duplicates, and edges between coplanar faces) are dropped.
+//
+// Edge verts follow face 0's winding. An edge on an open border gets the reverse of face 0's
+// normal as face 1's, so it always casts.
+//
+// In:		pTris, numTris	The triangles.
+//			weldTolerance	How close two verts have to be to count as the same vertex.
+//
+// Out:		out				The edge list, replacing whatever was there.
+void PI_BuildEdgeList(const PI_Triangle *pTris, unsigned int numTris, vector<PI_Edge> &out, float weldTolerance = 0.001f);
+
 enum GEOM_FLAGS { RENDERABLE = 0x01, TEXTURED = 0x02, CASTSHADOWS = 0x04, NORMALMAPPED = 0x08, WORLD = 0x10 };
 
+struct PI_NodeGeometry;
+
 // A single static geometric mesh object.
 class PI_MeshNode
 {
@@ -94,15 +112,16 @@ class PI_MeshNode
 	PI_Mat44 ltm;					// LTM - local transform matrix.
 	string name;					// The internal object name.
 	PI_Vec3 aabb_min, aabb_max;		// Axis-aligned bounding box dimensions.
-	unsigned int displayList,		// OpenGL display list.
+	unsigned int geometry,			// The renderer's handle for the node's geometry.
 					diffTexName,	// OpenGL texture name for diffuse.
 					normalTexName;	// OpenGL texture name for normal mapping.
+	PI_NodeGeometry *pGeometry;		// The geometry itself, so rendering needs no lookups.
 	float boundingRadius;			// Bounding sphere radius.
 	unsigned char flags;			// Rendering flags.
 	
 public:
 
-	PI_MeshNode(void) : displayList(0), diffTexName(0), normalTexName(0), flags(0), boundingRadius(0) { }
+	PI_MeshNode(void) : geometry(0), diffTexName(0), normalTexName(0), pGeometry(0), flags(0), boundingRadius(0) { }
 
 	const PI_Mat44 &GetLTM(void) const { return ltm; }
 	const string &GetName(void) const { return name; }
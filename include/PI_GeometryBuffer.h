@@ -0,0 +1,131 @@
+// PigIron static geometry buffer interface.
+//
+// Triangles are welded into indexed vertices once, then kept in vertex and index
+// buffer objects when the driver has them, or in system memory vertex arrays when
+// it doesn't. Either way they're drawn with glDrawElements, never immediate mode.
+
+#pragma once
+
+#include <vector>
+using std::vector;
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <gl\gl.h>
+
+#include "glext.h"
+#include "PI_Geom.h"
+
+// Load the buffer object, multi-draw and client texture entry points.
+// Must be called with a current rendering context, before any buffer is uploaded.
+//
+// Returns					True if buffer objects are available. Geometry stays in
+//							system memory vertex arrays if they aren't.
+bool PI_InitGeometryBuffers(void);
+
+// Find a core entry point, or its extension equivalent for older drivers.
+//
+// Returns					The entry point, or 0 if the driver has neither.
+PROC PI_GetGLProc(const char *coreName, const char *extName);
+
+// Can buffers draw many instances in one call?
+bool PI_CanDrawInstanced(void);
+
+// A welded vertex.
+struct PI_Vertex
+{
+	float pos[3], normal[3], uv[2];
+	unsigned char rgba[4];
+};
+
+// Any number of triangle batches sharing one vertex buffer and one index buffer.
+class PI_GeometryBuffer
+{
+public:
+
+	PI_GeometryBuffer(void) : vertexBuffer(0), indexBuffer(0), indexType(GL_UNSIGNED_SHORT), numVerts(0), numIndices(0),
+							  numTexCoordSets(1), hasColors(false)
+	{ }
+
+	// Weld a batch of triangles and append it. Nothing reaches the GL until Upload.
+	//
+	// In:		pTris, numTris	The triangles.
+	//
+	// Returns					The index the batch starts at. It's numTris * 3 indices long.
+	unsigned int AddTriangles(const PI_Triangle *pTris, unsigned int numTris);
+
+	// Make everything added so far drawable. Buffer objects get their own copy,
+	// so the system memory copy is dropped if they're available.
+	//
+	// In:		texCoordSets	How many texture units get the texture coordinates (1 or 2).
+	//			colors			Use the vertex alpha as the color? Otherwise the current color is used.
+	void Upload(unsigned int texCoordSets, bool colors);
+
+	// Release the buffers and everything added.
+	void Release(void);
+
+	// Point the vertex arrays at this buffer. Draw only between Bind and Unbind.
+	void Bind(void) const;
+
+	// Disable the vertex arrays Bind enabled.
+	void Unbind(void) const;
+
+	// Draw part of the buffer.
+	//
+	// In:		firstIndex		Where the batch starts, as returned by AddTriangles.
+	//			count			How many indices to draw.
+	void Draw(unsigned int firstIndex, unsigned int count) const;
+
+	// Draw the whole buffer.
+	void Draw(void) const { Draw(0, numIndices); }
+
+	// Draw several parts of the buffer in one call.
+	//
+	// In:		pFirstIndices	Where each part starts.
+	//			pCounts			How many indices are in each part.
+	//			numDraws		How many parts there are.
+	void MultiDraw(const unsigned int *pFirstIndices, const GLsizei *pCounts, unsigned int numDraws) const;
+
+	// Draw the whole buffer several times in one call. Only if PI_CanDrawInstanced.
+	//
+	// In:		numInstances	How many times to draw it.
+	void DrawInstanced(unsigned int numInstances) const;
+
+	unsigned int GetNumIndices(void) const { return numIndices; }
+	unsigned int GetNumTexCoordSets(void) const { return numTexCoordSets; }
+
+	// Does the buffer hold exactly what a batch of triangles would weld into?
+	// Buffer objects are read back, so this is for confirming a match, not searching for one.
+	//
+	// In:		pTris, numTris	The triangles.
+	//
+	// Returns					True if they'd draw the same as everything uploaded.
+	bool Holds(const PI_Triangle *pTris, unsigned int numTris) const;
+
+private:
+
+	// Convert the indices to the type they're drawn with.
+	void PackIndices(void);
+
+	// Where an index starts, as the GL wants it for the bound index buffer or array.
+	const GLvoid *IndexOffset(unsigned int index) const;
+
+	// Filled by AddTriangles. Empty after Upload if buffer objects are in use.
+	vector<PI_Vertex> vVerts;
+	vector<unsigned int> vIndices;
+
+	// The indices as drawn - 16-bit if every vertex fits.
+	vector<unsigned char> vIndexData;
+
+	GLuint vertexBuffer, indexBuffer;
+	GLenum indexType;
+	unsigned int numVerts, numIndices, numTexCoordSets;
+	bool hasColors;
+};
+
+// A mesh node's geometry buffer and silhouette edges. Identical nodes share one.
+struct PI_NodeGeometry
+{
+	PI_GeometryBuffer buffer;
+	vector<PI_Edge> vEdges;			// Empty unless the node casts shadows.
+};
\ No newline at end of file
@@ -0,0 +1,61 @@
+// PigIron hardware instancing interface.
+//
+// Draws many copies of one geometry buffer in a single call, with each copy's world
+// transform and light direction read from a per-instance vertex stream. A small vertex
+// program applies the transform; the texture combiners are left to fixed-function,
+// so normal mapping works as it does for single draws.
+
+#pragma once
+
+#include <vector>
+using std::vector;
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <gl\gl.h>
+
+#include "glext.h"
+#include "PI_GeometryBuffer.h"
+
+// What changes from one copy of a mesh to the next.
+struct PI_Instance
+{
+	float worldXform[16];			// Column major, as glMultMatrixf takes it.
+	unsigned char lightColor[4];	// The model space light direction, packed as a color for DOT3.
+};
+
+class PI_Instancer
+{
+public:
+
+	PI_Instancer(void) : program(0), instanceBuffer(0) { }
+
+	// Load the entry points and build the vertex program.
+	// Must be called with a current rendering context.
+	//
+	// Returns					True if instanced drawing is available. Draw must not be used otherwise.
+	bool Init(void);
+
+	// Release the vertex program and instance buffer.
+	void Shutdown(void);
+
+	bool IsAvailable(void) const { return program != 0; }
+
+	// Switch to and from the instancing vertex program. Draw only between Begin and End.
+	void Begin(void) const;
+	void End(void) const;
+
+	// Draw a bound geometry buffer once per instance.
+	//
+	// In:		geometry		The geometry, already bound.
+	//			pInstances		The copies to draw.
+	//			numInstances	How many copies there are.
+	void Draw(const PI_GeometryBuffer &geometry, const PI_Instance *pInstances, unsigned int numInstances);
+
+private:
+
+	GLuint program, instanceBuffer;
+
+	// The instance data, when buffer objects aren't available.
+	vector<PI_Instance> vInstances;
+};
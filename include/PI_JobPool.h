@@ -0,0 +1,72 @@
+// PigIron worker thread pool interface.
+//
+// Runs the iterations of a loop across a fixed set of worker threads.
+// The calling thread works on the loop too, and ParallelFor returns once
+// every iteration is finished. With no workers, everything runs on the caller.
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <vector>
+using std::vector;
+
+class PI_JobPool
+{
+public:
+
+	// A single loop iteration.
+	//
+	// In:		pContext		Whatever was passed to ParallelFor.
+	//			index			Which iteration to run.
+	typedef void (*JobFunc)(void *pContext, unsigned int index);
+
+	// Singleton accessor.
+	static PI_JobPool &GetInstance(void) { return m_instance; }
+
+	// Start the worker threads.
+	//
+	// In:		numWorkers		How many threads to start. 0 starts one less than the number of processors.
+	//
+	// Returns					True if every worker started.
+	bool Init(unsigned int numWorkers = 0);
+
+	// Stop and wait for the worker threads.
+	void Shutdown(void);
+
+	// Run func(pContext, i) for every i in [0, count), and wait for them all to finish.
+	// Only one loop at a time has the workers - a loop started while another thread's loop
+	// has them runs on its caller instead. Don't call this from inside a job.
+	// Threads below normal priority always run their loops themselves.
+	void ParallelFor(JobFunc func, void *pContext, unsigned int count);
+
+	// How many threads besides the caller run jobs?
+	unsigned int GetNumWorkers(void) const { return (unsigned int)vThreads.size(); }
+
+private:
+
+	// This class is a Singleton.
+	static PI_JobPool m_instance;
+	PI_JobPool(const PI_JobPool &rhs);
+	PI_JobPool &operator=(const PI_JobPool &rhs);
+	PI_JobPool(void);
+	~PI_JobPool(void);
+
+	// Worker thread entry point.
+	static unsigned int __stdcall WorkerThread(void *pPool);
+
+	// Run iterations of the current loop until there are none left.
+	void RunJobs(void);
+
+	vector<HANDLE> vThreads;
+	HANDLE hWakeSemaphore,				// Released once per worker for each loop.
+		   hDoneEvent;					// Set by the last worker to finish a loop.
+	CRITICAL_SECTION cs;				// Held by the thread running a loop.
+
+	// The current loop.
+	JobFunc func;
+	void *pContext;
+	unsigned int count;
+	volatile LONG nextIndex, numAwake;
+	volatile bool quit;
+};
@@ -0,0 +1,29 @@
+// PigIron block compression interface.
+//
+// A small LZ77 codec that writes the LZ4 block format: fast to decode, with
+// no entropy coding. Blocks are independent, so they can be decoded in parallel.
+
+#pragma once
+
+// The most a block of srcSize bytes can grow by when it doesn't compress.
+#define PI_LZ_BOUND(srcSize) ((srcSize) + (srcSize) / 255 + 16)
+
+// Compress a block.
+//
+// In:		pSrc, srcSize	The data to compress.
+//			dstCapacity		Room available at pDst.
+//
+// Out:		pDst			The compressed block.
+//
+// Returns					The size of the compressed block, or 0 if it didn't fit.
+unsigned int PI_LZCompress(const unsigned char *pSrc, unsigned int srcSize, unsigned char *pDst, unsigned int dstCapacity);
+
+// Decompress a block.
+//
+// In:		pSrc, srcSize	The compressed block.
+//			dstSize			Exact size of the decompressed data.
+//
+// Out:		pDst			The decompressed data.
+//
+// Returns					True if the block was valid and decompressed to exactly dstSize bytes.
+bool PI_LZDecompress(const unsigned char *pSrc, unsigned int srcSize, unsigned char *pDst, unsigned int dstSize);
@@ -0,0 +1,46 @@
+// PigIron level manifest interface.
+//
+// Every level's script and asset list, read once at startup, so the game
+// knows what the next level needs before it gets there.
+
+#pragma once
+
+#include <vector>
+using std::vector;
+#include <string>
+using std::string;
+
+class PI_LevelManifest
+{
+public:
+
+	// What a level needs.
+	struct PI_Level
+	{
+		string scriptName;			// The level script, e.g. "DATA\level0.PLS".
+		vector<string> vAssets;		// Every asset the script lists.
+	};
+
+	// Read the asset list of every level script in a directory,
+	// from level0.PLS up to the first one that's missing.
+	//
+	// In:		directory		Where the level scripts are, e.g. "DATA".
+	//
+	// Returns					How many levels were found.
+	unsigned int Load(const char *directory);
+
+	// Accessor for a level.
+	//
+	// Returns					The level, or 0 if there's no such level.
+	const PI_Level *GetLevel(unsigned int level) const
+	{
+		return level < vLevels.size() ? &vLevels[level] : 0;
+	}
+
+	// How many levels are there?
+	unsigned int GetNumLevels(void) const { return (unsigned int)vLevels.size(); }
+
+private:
+
+	vector<PI_Level> vLevels;
+};
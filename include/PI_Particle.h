@@ -4,16 +4,28 @@
 
 #pragma once
 
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 #include <vector>
 using std::vector;
+#include <string>
+using std::string;
+#include <map>
+using std::map;
 
 #include "PI_Math.h"
+#include "PI_Atlas.h"
 
 // Identifiers for controlling how particles are emitted.
 // Fountain - continuous, particles are reborn as they die.
 // Explosion - once, system stops when all particles are dead.
 enum EmitterType { Fountain, Explosion };
 
+// Compiled presets sit next to their text versions, with this appended to the name.
+#define PI_PRESET_EXT ".ppb"
+
+struct PI_ParticlePreset;
+
 class PI_ParticleEmitter
 {
 	friend class PI_Render;
@@ -32,7 +44,9 @@ class PI_ParticleEmitter
 		PI_Particle(void) : life(0), size(0), speed(0), flags(0)
 		{ }
 	};
-	
+
+public:
+
 	class PI_ColorKeyframe
 	{
 	public:
@@ -56,6 +70,8 @@ class PI_ParticleEmitter
 		}
 	};
 
+private:
+
 	vector<PI_Particle> vParticles;
 	vector<PI_ColorKeyframe> vColors;
 
@@ -64,6 +80,7 @@ class PI_ParticleEmitter
 	float maxLife, size, speed;
 
 	unsigned int diffTex, liveParticles;
+	PI_AtlasRegion diffRegion;
 
 	EmitterType genMode;
 
@@ -80,14 +97,35 @@ public:
 
 	void Update(float deltaTime);
 
+	// Configure the emitter from a preset. Each preset is only read from disk once.
+	//
+	// In:		filename		The preset's text file, e.g. "DATA\\cannonFlash.txt".
+	//
+	// Returns					True if the preset was found.
 	bool LoadPreset(const char *filename);
 
+	// Configure the emitter from a preset that's already been read.
+	void ApplyPreset(const PI_ParticlePreset &preset);
+
+	// Write the emitter's settings out as a text preset.
 	void SavePreset(const char *filename) const;
 
 	void AddColorKeyframe(float r, float g, float b, float a, unsigned char percentOfLife);
 
 	PI_ColorKeyframe GetInterpolatedColor(float lifeTime) const;
 
+	// Fill a table of colors evenly spaced over the keyframes, so particles can look theirs up.
+	// A particle's entry is (life - lifeBase) * lifeScale, rounded and clamped to the table.
+	//
+	// In:		numSteps		How many entries the table has. At least 2.
+	//
+	// Out:		pRGBA			numSteps colors, 4 bytes each.
+	//			lifeBase		The life of the first entry.
+	//			lifeScale		Entries per unit of life.
+	//
+	// Returns					False if there aren't two keyframes to fade between.
+	bool BuildColorTable(unsigned char *pRGBA, unsigned int numSteps, float &lifeBase, float &lifeScale) const;
+
 	unsigned int IsActive(void) const { return liveParticles; }
 
 	void SetPosition(const PI_Vec3 &where, unsigned char variance) { pos = where; posVar = variance; }
@@ -102,8 +140,62 @@ public:
 
 	void SetSpeed(float s, unsigned char variance) { speed = s; speedVar = variance; }
 
-	void SetDiffuseTexture(unsigned int texName) { diffTex = texName; }
+	// In:		texName			The texture to draw with.
+	//			region			Where the image is in the texture, if it's been packed into an atlas.
+	void SetDiffuseTexture(unsigned int texName, const PI_AtlasRegion &region = PI_AtlasRegion()) { diffTex = texName; diffRegion = region; }
 
 	void SetEmitterType(EmitterType mode) { genMode = mode; }
 
+};
+
+// Everything a preset sets on an emitter.
+struct PI_ParticlePreset
+{
+	PI_Vec3 pos, dir, force;
+	float maxLife, size, speed;
+	unsigned char posVar, dirVar, lifeVar, sizeVar, speedVar;
+	vector<PI_ParticleEmitter::PI_ColorKeyframe> vColors;
+
+	PI_ParticlePreset(void) : maxLife(0), size(0), speed(0), posVar(0), dirVar(0), lifeVar(0), sizeVar(0), speedVar(0)
+	{ }
+};
+
+// Every preset that's been loaded, by name. Text presets are the authoring format:
+// the first time one is loaded it's compiled to a binary file next to it, which
+// later runs read instead until the text is changed.
+class PI_ParticlePresetCache
+{
+	// This class is a Singleton.
+	static PI_ParticlePresetCache m_instance;
+	PI_ParticlePresetCache(const PI_ParticlePresetCache &rhs);
+	PI_ParticlePresetCache &operator=(const PI_ParticlePresetCache &rhs);
+	PI_ParticlePresetCache(void) { InitializeCriticalSection(&cs); }
+	~PI_ParticlePresetCache(void) { DeleteCriticalSection(&cs); }
+
+	CRITICAL_SECTION cs;
+	map<string, PI_ParticlePreset> presets;
+
+	// Parse a text preset.
+	static bool ParsePreset(const char *filename, PI_ParticlePreset &out);
+
+	// Read a compiled preset.
+	static bool ReadCompiledPreset(const char *filename, PI_ParticlePreset &out);
+
+	// Write a compiled preset.
+	static bool WriteCompiledPreset(const char *filename, const PI_ParticlePreset &preset);
+
+public:
+
+	// Singleton accessor.
+	static PI_ParticlePresetCache &GetInstance(void) { return m_instance; }
+
+	// Find a preset, loading it if this is the first time it's been asked for.
+	//
+	// In:		filename		The preset's text file.
+	//
+	// Returns					The preset, or 0 if it couldn't be loaded. Valid until Clear.
+	const PI_ParticlePreset *Get(const char *filename);
+
+	// Forget every preset, so they're read again next time.
+	void Clear(void);
 };
\ No newline at end of file
@@ -0,0 +1,95 @@
+// PigIron background asset prefetch interface.
+//
+// Reads and decodes assets that will be needed soon on a low priority thread,
+// and holds them in system memory until the renderer takes them. Meshes pull
+// in the textures they use, unless those are already resident, as they're decoded.
+// The cache stays within a fixed memory budget.
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <vector>
+using std::vector;
+#include <string>
+using std::string;
+
+#include "PI_Asset.h"
+
+class PI_Prefetcher
+{
+public:
+
+	PI_Prefetcher(void);
+	~PI_Prefetcher(void);
+
+	// Start the worker thread.
+	//
+	// In:		budget			The most decoded data to hold at once (bytes).
+	//
+	// Returns					True if the worker thread is running.
+	bool Start(unsigned int budget);
+
+	// Stop the worker thread and drop everything cached.
+	void Stop(void);
+
+	// Replace whatever was being prefetched with a new set of assets.
+	// Anything cached that the new set doesn't need is dropped.
+	//
+	// In:		vAssets			The assets to prefetch, most important first.
+	//			vResident		Textures the renderer already has, which meshes needn't bring along.
+	void Prefetch(const vector<string> &vAssets, const vector<string> &vResident);
+
+	// Take a prefetched texture out of the cache.
+	//
+	// Out:		out				The decoded image.
+	//
+	// Returns					True if the texture was cached.
+	bool TakeImage(const char *filename, PI_Image &out);
+
+	// Take a prefetched mesh out of the cache.
+	//
+	// Out:		out				The decoded mesh.
+	//
+	// Returns					True if the mesh was cached.
+	bool TakeMesh(const char *filename, PI_MeshData &out);
+
+private:
+
+	PI_Prefetcher(const PI_Prefetcher &rhs);
+	PI_Prefetcher &operator=(const PI_Prefetcher &rhs);
+
+	// A decoded asset waiting to be taken.
+	struct PI_CachedAsset
+	{
+		string filename;
+		bool isMesh;
+		PI_Image image;				// Valid if !isMesh.
+		PI_MeshData mesh;			// Valid if isMesh.
+		unsigned int bytes;			// Memory held by the decoded data.
+	};
+
+	// Worker thread entry point.
+	static unsigned int __stdcall PrefetchThread(void *pPrefetcher);
+
+	// Decode queued assets until told to stop.
+	void Run(void);
+
+	// Find a cached asset. The lock must be held.
+	//
+	// Returns					Its index, or -1 if it isn't cached.
+	int FindCached(const char *filename) const;
+
+	// Is an asset queued, cached, being decoded or already resident? The lock must be held.
+	bool IsKnown(const string &filename) const;
+
+	HANDLE hThread, hWakeEvent;
+	volatile bool quit;
+	unsigned int budget, cachedBytes;
+
+	CRITICAL_SECTION cs;
+	vector<string> vQueue;				// Waiting to be decoded.
+	string decoding;					// Being decoded right now.
+	vector<PI_CachedAsset *> vpCache;
+	vector<string> vResident;			// Textures the renderer had at the last Prefetch.
+};
@@ -0,0 +1,132 @@
+// PigIron load and frame profiling interface.
+
+#pragma once
+
+#include <vector>
+using std::vector;
+#include <string>
+using std::string;
+
+// Read a high resolution clock.
+//
+// Returns					Seconds since some arbitrary point. Only differences are meaningful.
+double PI_GetSeconds(void);
+
+// Timings and byte counts for each stage of loading a single asset.
+struct PI_AssetProfile
+{
+	enum Stage { Open, Read, Inflate, Decode, MipGen, Edges, Upload, NumStages };
+
+	string filename;
+	double seconds[NumStages];
+	unsigned int bytes[NumStages];
+
+	PI_AssetProfile(const char *name = "") : filename(name)
+	{
+		for (int i = 0; i < NumStages; ++i)
+			seconds[i] = 0, bytes[i] = 0;
+	}
+
+	// Charge some work to a stage.
+	void Add(Stage stage, double elapsed, unsigned int numBytes = 0)
+	{
+		seconds[stage] += elapsed;
+		bytes[stage] += numBytes;
+	}
+
+	// How long did the asset take altogether?
+	double TotalSeconds(void) const;
+
+	// Was the asset read from a compressed file?
+	bool IsCompressed(void) const { return bytes[Inflate] != 0; }
+
+	// Did reading the compressed file and inflating it beat reading the raw bytes?
+	// The raw read time is estimated from the throughput of the compressed read.
+	bool CompressionPaidOff(void) const;
+};
+
+// Times a single stage, and charges it to a profile when stopped or destroyed.
+// The profile may be 0, in which case nothing is recorded.
+class PI_StageTimer
+{
+	PI_AssetProfile *pProfile;
+	PI_AssetProfile::Stage stage;
+	double start;
+
+	PI_StageTimer(const PI_StageTimer &rhs);
+	PI_StageTimer &operator=(const PI_StageTimer &rhs);
+
+public:
+	PI_StageTimer(PI_AssetProfile *profile, PI_AssetProfile::Stage s) : pProfile(profile), stage(s), start(PI_GetSeconds()) { }
+
+	~PI_StageTimer(void) { Stop(); }
+
+	// Stop timing. Only the first call has any effect.
+	//
+	// In:		numBytes		How many bytes the stage processed.
+	void Stop(unsigned int numBytes = 0)
+	{
+		if (pProfile)
+			pProfile->Add(stage, PI_GetSeconds() - start, numBytes);
+		pProfile = 0;
+	}
+};
+
+// Collects the profiles of every asset loaded in a batch, and reports on them.
+class PI_LoadProfiler
+{
+	vector<PI_AssetProfile> vProfiles;
+
+public:
+
+	// Record a finished asset.
+	void Add(const PI_AssetProfile &profile) { vProfiles.push_back(profile); }
+
+	// Find the profile of an asset recorded during this batch.
+	//
+	// Returns					The profile, or 0 if the asset hasn't been recorded. Only valid until the next Add.
+	PI_AssetProfile *Find(const char *filename);
+
+	// Write a CSV report with one row per asset, and log a summary.
+	//
+	// In:		filename		Where to write the report.
+	//
+	// Returns					True if the report was written.
+	bool WriteReport(const char *filename) const;
+
+	// Forget every recorded asset, ready for the next batch.
+	void Clear(void) { vProfiles.clear(); }
+};
+
+// Collects the time taken by a fixed number of frames, and reports on them.
+class PI_FrameProfiler
+{
+	vector<double> vFrameSeconds;
+	unsigned int numFrames;
+
+public:
+
+	PI_FrameProfiler(void) : numFrames(0) { }
+
+	// Start collecting, forgetting any earlier frames.
+	//
+	// In:		frames			How many frames to collect.
+	void Start(unsigned int frames) { numFrames = frames; vFrameSeconds.clear(); vFrameSeconds.reserve(frames); }
+
+	// Record a frame. Ignored once enough have been collected.
+	void Add(double seconds)
+	{
+		if (vFrameSeconds.size() < numFrames)
+			vFrameSeconds.push_back(seconds);
+	}
+
+	// Have all the frames been collected?
+	bool IsFinished(void) const { return numFrames && vFrameSeconds.size() == numFrames; }
+
+	// Write a CSV report with one row per frame, and log a summary with percentiles.
+	//
+	// In:		filename		Where to write the report.
+	//
+	// Returns					True if the report was written.
+	bool WriteReport(const char *filename) const;
+};
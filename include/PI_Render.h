@@ -17,6 +17,12 @@ using std::map;
 using std::pair;
 
 #include "glext.h"
+#include "PI_Asset.h"
+#include "PI_Atlas.h"
+#include "PI_AssetWatcher.h"
+#include "PI_Prefetcher.h"
+#include "PI_RenderBackend.h"
+#include "PI_FramePacket.h"
 #include "PI_WorldTree.h"
 #include "PI_Particle.h"
 #include "PI_Camera.h"
@@ -27,25 +33,6 @@ using std::pair;
 #pragma comment(lib, "Opengl32")
 #pragma comment(lib, "Glu32")
 
-// Descriptor for renderable static geometry.
-class PI_RenderElement
-{
-	friend class PI_Render;
-	PI_Mat44 worldXform;
-
-	unsigned int displayList,		// The display list to render.
-				    diffTexName,	// The diffuse texture to apply.
-					normTexName; // The normal map texture to apply.
-public:
-	PI_RenderElement(const PI_Mat44 &mat, GLuint list, GLuint diffuseTexName, GLuint normalTexName)
-		: worldXform(mat), displayList(list), diffTexName(diffuseTexName), normTexName(normalTexName)
-	{ }
-
-	PI_RenderElement(const PI_Mat44 &mat, const PI_MeshNode &node)
-		: worldXform(mat), displayList(node.displayList), diffTexName(node.diffTexName), normTexName(node.normalTexName)
-	{ }
-};
-
 // The main state-based rendering class.
 class PI_Render
 {
@@ -63,19 +50,17 @@ public:
 	enum RenderState
 	{
 		StartupState,
-		LoadAssetState,			// Need to load assets.
-		UpdateCameraState,		// Need to update the camera.
-		ReadyState,				// Waiting for draw list additions.
-		CommitFrameState,		// Draw list is locked, okay to render frame.
+		ReadyState,				// Drawing whatever frames the game publishes.
 		UnloadAssetState,		// Need to unload assets.
 		ShutdownState
 	};
 
-	// Commit all changes to the render list and render the current frame to the screen.
-	void CommitFrame(void);
+	// The packet to record the next frame into. Game thread only.
+	PI_FramePacket &GetFramePacket(void) { return frameQueue.GetWritePacket(); }
 
-	// Tell the renderer to calculate and apply the camera during the next update.
-	void SetUpdateCameraState(void);
+	// Publish the recorded frame, along with the GUI drawn since the last one.
+	// The render thread draws the newest frame it's been given, so this never waits on it.
+	void CommitFrame(void);
 	
 	// Tell the renderer to unload all assets during the next update.
 	void SetUnloadState(void);
@@ -88,8 +73,79 @@ public:
 	// Returns				False if the renderer has entered the shutdown state.
 	bool PI_Render::Update(void);
 	
-	// Set the asset list to load.
-	void SetAssetList(const vector<string> *assetList);
+	// Asset requests are loaded most important first, then in the order they were made.
+	enum AssetPriority
+	{
+		PriorityLow,
+		PriorityNormal,
+		PriorityHigh
+	};
+
+	enum RequestStatus
+	{
+		RequestUnknown,			// Not a request in the current batch.
+		RequestPending,			// Still waiting to be loaded.
+		RequestLoaded,			// The asset is resident.
+		RequestFailed			// The asset couldn't be loaded.
+	};
+
+	// Called on the render thread once a requested asset has been dealt with.
+	//
+	// In:		filename		The requested asset.
+	//			loaded			True if the asset is resident.
+	//			pUserData		Whatever was passed along with the request.
+	typedef void (*AssetCallback)(const char *filename, bool loaded, void *pUserData);
+
+	// Queue an asset to be loaded - can be a mesh, texture or world geometry.
+	// Requests are loaded a few at a time between frames, so this returns immediately.
+	//
+	// In:		filename		Name of desired file, can be relative or absolute.
+	//			priority		How soon it's needed.
+	//			callback		Called when the request is finished. May be 0.
+	//			pUserData		Passed to the callback.
+	//
+	// Returns					A handle for GetRequestStatus. Never 0.
+	unsigned int RequestAsset(const char *filename, AssetPriority priority = PriorityNormal, AssetCallback callback = 0,
+							  void *pUserData = 0);
+
+	// Accessor for the state of an asset request.
+	//
+	// In:		request			A handle returned by RequestAsset.
+	//
+	// Returns					The request's status, or RequestUnknown once a newer batch has started.
+	RequestStatus GetRequestStatus(unsigned int request) const;
+
+	// Make a level's assets resident, and release whatever the previous level used that this one doesn't.
+	// Each asset is requested as with RequestAsset, so anything both levels share is already resident
+	// and finishes straight away. The release happens once the batch of requests has finished.
+	//
+	// In:		vAssets			Every asset the level lists.
+	//			callback		Called as each request is finished. May be 0.
+	//			pUserData		Passed to the callback.
+	void RequestLevelAssets(const vector<string> &vAssets, AssetCallback callback = 0, void *pUserData = 0);
+
+	// Read and decode assets that will be needed soon in the background, so that loading
+	// them later only has to upload them. Assets that are already resident are skipped.
+	//
+	// In:		vAssets			The assets to prefetch, most important first.
+	void PrefetchAssets(const vector<string> &vAssets);
+
+	// Keep an asset resident across level changes, whether or not the levels list it.
+	void PinAsset(const char *filename);
+
+	// How far along is the current batch of asset requests?
+	// A batch runs from the first request made while nothing is pending until every request is finished.
+	//
+	// Out:		numFinished		How many requests have been loaded or have failed.
+	//			numRequested	How many requests are in the batch.
+	void GetAssetProgress(unsigned int &numFinished, unsigned int &numRequested) const;
+
+	// Watch a directory for changed assets, and swap them in as they change.
+	//
+	// In:		directory		The directory asset filenames start with, e.g. "DATA".
+	//
+	// Returns					True if the directory is being watched.
+	bool WatchAssetDirectory(const char *directory);
 
 	// Accessor for loaded mesh hierarchies.
 	//
@@ -109,6 +165,25 @@ public:
 	// Returns				True if the texture was found.
 	bool GetTextureHandle(const char *filename, unsigned int &texName) const;
 
+	// Accessor for where a loaded texture is drawn from. Textures packed into an atlas share a page.
+	//
+	// In:		filename	What's it called?
+	//
+	// Out:		texName		The texture to bind.
+	//			region		Where the image is in that texture. The whole texture unless it's in an atlas.
+	//
+	// Returns				True if the texture was found.
+	bool GetTextureRegion(const char *filename, unsigned int &texName, PI_AtlasRegion &region) const;
+
+	// Load an atlas descriptor, and pack the images it lists into shared pages.
+	// Call on the render thread, before anything it lists is loaded on its own.
+	// Levels can also list atlases with their other assets.
+	//
+	// In:		filename		Name of desired file, can be relative or absolute.
+	//
+	// Returns					True if the atlas was loaded successfully (or is already loaded)
+	bool LoadAtlas(const char *filename);
+
 	// Find the first point of intersection between a ray and the world.
 	//
 	// In:		ray				The ray to test.
@@ -132,40 +207,35 @@ public:
 	// Returns:					The current render state.
 	RenderState GetState(void) const;
 
-	// Give the renderer a list of things to render.
-	void SetRenderList(reusable_vector<PI_RenderElement> *vpList)
-	{
-		vpRenderList = vpList;
-	}
-	
-	// Set the active camera.
-	//
-	// In:		cam				Pointer to the desired camera.
+	// Accessors for the viewport dimensions.
+	int GetViewportWidth(void) const { return m_width; }
+	int GetViewportHeight(void) const { return m_height; }
+
+	// Render into an offscreen buffer instead of the window, and time a number of frames
+	// once there's a scene to draw. The timings are written to benchmark.csv.
+	// Must be called before Init.
 	//
-	// Returns					The old camera.
-	PI_Camera *SetActiveCam(PI_Camera *cam)
-	{
-		if (!cam)
-			return cam;
-		PI_Camera *old = pActiveCam;
-		pActiveCam = cam;
-		return old;
-	}
-
-	// Set the active directional light.
-	PI_DLight *SetActiveDLight(PI_DLight *light)
+	// In:		width, height	The size of the offscreen buffer.
+	//			numFrames		How many frames to time.
+	//			nullRender		Build every frame without drawing it, to time the CPU alone?
+	void SetBenchmark(int width, int height, unsigned int numFrames, bool nullRender = false);
+
+	// How shadows are drawn.
+	enum ShadowTechnique
 	{
-		if (!light)
-			return light;
+		ShadowVolumes,			// Silhouettes extruded on the CPU and counted in the stencil buffer.
+		ShadowMaps				// Casters drawn into a depth texture from the light, and tested by receivers.
+	};
 
-		PI_DLight *old = pActiveDLight;
-		pActiveDLight = light;
-		return old;
-	}
+	// Pick how shadows are drawn. Must be called before Init.
+	// Shadow maps fall back to volumes if the driver can't do them.
+	void SetShadowTechnique(ShadowTechnique technique) { shadowTechnique = technique; }
 
-	// Accessors for the viewport dimensions.
-	int GetViewportWidth(void) const { return m_width; }
-	int GetViewportHeight(void) const { return m_height; }
+	// Lock presents to the display's refresh? Off by default. Must be called before Init.
+	void SetVSync(bool enable) { vsync = enable; }
+
+	// Have all the benchmark frames been rendered and reported?
+	bool IsBenchmarkFinished(void) const { return benchmarkFinished; }
 
 // Internal Routines
 private:
@@ -184,13 +254,29 @@ private:
 	// Update the renderer's viewport.
 	void UpdateViewport(void);
 
-	// Apply the camera and build its frustum planes.
+	// Create the offscreen buffer benchmarks render into, and make it the draw target.
+	//
+	// Returns					True if successful. Frames are drawn to the hidden window otherwise.
+	bool CreateOffscreenTarget(void);
+
+	// Release the offscreen buffer.
+	void ReleaseOffscreenTarget(void);
+
+	// Load the active camera's view and projection.
 	void ApplyCamera(void);
 
-	// Load a list of assets - can be meshes, textures and world geometry.
+	// Load the most important asset requests until the time slice runs out.
+	void ProcessAssetRequests(void);
+
+	// Release every asset that isn't listed by the current level or pinned, and isn't used by one that is.
+	void ReleaseUnusedAssets(void);
+
+	// Load an asset - can be a mesh, texture or world geometry.
+	//
+	// In:		filename		Name of desired file, can be relative or absolute.
 	//
-	// Returns				True if ALL assets are loaded.
-	bool LoadAssetList(void);
+	// Returns					True if the asset is resident.
+	bool LoadAsset(const char *filename);
 
 	// Load a PigIron Mesh (PIM) file.
 	//
@@ -201,6 +287,41 @@ private:
 	// Returns					True if the file was loaded successfully (or is already loaded)
 	bool LoadPIM(const char *filename, PI_Mesh &out);
 
+	// Create GL resources for a decoded PIM file and make it resident.
+	//
+	// In:		data			The decoded PIM file.
+	//			pProfile		Where to record upload timings. May be 0.
+	//
+	// Out:		out				The new mesh.
+	void CreateMesh(const PI_MeshData &data, PI_Mesh &out, PI_AssetProfile *pProfile = 0);
+
+	// Weld a mesh node's geometry into the node's geometry buffer, replacing whatever was there.
+	//
+	// In:		vTris			The node's triangles.
+	//			node			The node, whose geometry handle must already be assigned.
+	void CompileMeshNode(const vector<PI_Triangle> &vTris, const PI_MeshNode &node);
+
+	// Is a node's geometry drawn by any other resident node?
+	bool IsGeometryShared(const PI_MeshNode &node) const;
+
+	// Release a mesh node's geometry and edges.
+	void DeleteGeometry(unsigned int geometry);
+
+	// Does a geometry handle hold exactly what a node would be compiled into?
+	//
+	// In:		geometry		The handle.
+	//			src				The decoded node.
+	//			flags			The node's rendering flags.
+	//
+	// Returns					True if the node can share the handle.
+	bool GeometryHolds(unsigned int geometry, const PI_MeshNodeData &src, unsigned char flags) const;
+
+	// Add a world node's geometry to the world.
+	//
+	// In:		vTris			The node's triangles.
+	//			node			The node, with its textures already loaded.
+	void AddNodeToWorld(const vector<PI_Triangle> &vTris, const PI_MeshNode &node);
+
 	// Load a PigIron Mesh (PIM) file as the world, and build the world tree.
 	//
 	// In:		filename		Name of desired file, can be relative or absolute.
@@ -219,26 +340,120 @@ private:
 	friend bool PI_GUI::LoadFont(const char *name);
 	bool LoadTarga(const char *filename, unsigned int &texName, bool genMipMaps);
 
+	// Upload a decoded image into a texture name.
+	//
+	// In:		texName			The texture to fill. Any previous contents are replaced.
+	//			image			The decoded image.
+	//			genMipMaps		Generate MIP maps?
+	//			pProfile		Where to record MIP generation and upload timings. May be 0.
+	void UploadTexture(unsigned int texName, const PI_Image &image, bool genMipMaps, PI_AssetProfile *pProfile = 0);
+
+	// Does a texture hold exactly this image? The texture is read back, so this is
+	// for confirming a match, not searching for one.
+	//
+	// Returns					True if the image can share the texture.
+	bool TextureHolds(unsigned int texName, const PI_Image &image);
+
+	// Swap every asset that changed on disk into its existing texture names and geometry buffers.
+	void ApplyAssetReloads(void);
+
+	// Replace a resident texture's image.
+	//
+	// Returns					True if the texture was resident.
+	bool ReloadTexture(const char *filename, const PI_Image &image);
+
+	// Replace a resident mesh's geometry and edge data.
+	//
+	// Returns					True if the mesh was resident and its node layout hasn't changed.
+	bool ReloadMesh(const PI_MeshData &data);
+
 	// Bind a specific texture to the rendering context.
 	//
 	// In:		texName			The texture to bind.
-	friend void PI_GUI::RenderGUI(void) const;
+	friend void PI_GUI::FlushQuads(unsigned int texName, PI_RenderBackend &backend) const;
 	void BindTexture2D(unsigned int texName);
 
 	// Render the scene and display it.
 	void RenderScene(void);
 
+	// Render the render list, world, shadows and particles from the active camera.
+	void RenderSceneGeometry(void);
+
+	// Give every element in the render list a sort key, and sort them into the render queue.
+	void BuildRenderQueue(void);
+
+	// Could an element's shadow land anywhere on screen?
+	//
+	// Returns					False if its bounding sphere, swept along the light as far as
+	//							shadows are extruded, misses the camera's frustum.
+	bool IsShadowVisible(const PI_RenderElement &element) const;
+
+	// Find the part of the screen a caster's shadow can touch.
+	//
+	// In:		caster			The caster.
+	//			viewProjection	The active camera's projection times its view.
+	//
+	// Out:		region			The caster's window rectangle and depth range.
+	//
+	// Returns					False if the shadow is entirely off screen.
+	bool ProjectShadowRegion(const PI_ShadowCaster &caster, const PI_Mat44 &viewProjection, PI_ShadowRegion &region) const;
+
 	// Render all active shadow volumes.
 	void RenderShadows(void);
 
-	// Render a particle emitter.
+	// Draw every caster whose shadow could be seen into the shadow map, from the light.
+	// Leaves the light's view loaded, and shadowMatrix ready for receivers.
+	void RenderShadowMap(void);
+
+	// Render a particle emitter, in one draw call.
 	//
 	// In:		emit			The emitter to render.
 	void RenderParticleEmitter(const PI_ParticleEmitter *emit) const;
 
-	// Render the entire world tree.
+	// Expand a chunk of an emitter's particles into billboard quads. Run on the job pool.
+	//
+	// In:		pContext		The PI_ParticleJob.
+	//			chunk			Which ParticleChunkSize particles to expand.
+	static void ExpandParticlesJob(void *pContext, unsigned int chunk);
+
+	// Render the visible parts of the world tree, one draw call per diffuse texture.
+	void RenderWorld(void) const;
+
+	// A subtree of the world culled on its own, and what survived.
+	struct PI_WorldCullTask
+	{
+		const PI_WorldTree::PI_WorldTreeNode *pRoot;
+		vector<const PI_WorldTree::PI_WorldTreeNode::RenderData *> vpBatches;
+		unsigned int numTris, numNodes;
+	};
+
+	// Is a world tree node in the active camera's frustum? The root always is.
+	bool IsWorldNodeVisible(const PI_WorldTree::PI_WorldTreeNode *n) const;
+
+	// Split the visible top of the world tree into subtrees to be culled as separate tasks.
 	// This function is recursive - pass the root node for the initial call.
-	void RenderWorldTreeR(const PI_WorldTree::PI_WorldTreeNode *n) const;
+	//
+	// In:		n				A node that's already known to be visible.
+	//			depth			How far below the root it is.
+	void SplitWorldCullR(const PI_WorldTree::PI_WorldTreeNode *n, unsigned int depth) const;
+
+	// Gather the texture batches of every visible leaf under a node.
+	// This function is recursive - pass a task's root for the initial call.
+	//
+	// In:		n				A node that's already known to be visible.
+	//
+	// Out:		task			Gets the batches, and counts the leaves and triangles.
+	void CullWorldTreeR(const PI_WorldTree::PI_WorldTreeNode *n, PI_WorldCullTask &task) const;
+
+	// Cull a subtree of the world. Run on the job pool.
+	//
+	// In:		pContext		The PI_Render.
+	//			task			Which of vWorldCullTasks to cull.
+	static void CullWorldTreeJob(void *pContext, unsigned int task);
+
+	// Sort world batches by diffuse texture.
+	static bool WorldBatchLess(const PI_WorldTree::PI_WorldTreeNode::RenderData *pLeft,
+							   const PI_WorldTree::PI_WorldTreeNode::RenderData *pRight);
 	
 	// Render some simple test geometry.
 	void RenderTestGeometry(void) const;
@@ -267,7 +482,8 @@ private:
 	PI_Render &operator=(const PI_Render &rhs);
 	PI_Render(void) : m_HDC(0), m_HWND(0), m_HGLRC(0), m_width(0), m_height(0), pActiveCam(0), pActiveDLight(0), gui(PI_GUI::GetInstance()),
 						activeTexStage0(0), activeTexStage1(0), pWorld(new PI_WorldTree),
-						numTrisRendered(0), numNodesRendered(0), state(StartupState), vpAssetList(0), vpRenderList(0)
+						numTrisRendered(0), numNodesRendered(0), numWorldCullTasks(0), state(StartupState), nextGeometry(1), numPrefetchHits(0), releasePending(false), numSharedTextures(0), numSharedNodes(0), sharedBytes(0), firstRequest(1), numPendingRequests(0), numBatchRequests(0), pFrame(0), vpRenderList(0),
+						offscreenFramebuffer(0), offscreenColor(0), offscreenDepthStencil(0), offscreenWidth(0), offscreenHeight(0), benchmarkFinished(false), pBackend(&glBackend), shadowTechnique(ShadowVolumes), vsync(false)
 	{ }
 
 	// Descriptor for memory-resident textures.
@@ -275,6 +491,14 @@ private:
 	{
 		string filename;
 		GLuint texName;
+		bool mipMapped;
+		ULONGLONG hash;		// Hash of the decoded image. Identical images share texName.
+
+		// Part of an atlas, which has a page texture of its own and one texture per image.
+		// Images keep their texels and region on the page. Nothing else shares an atlas's texName.
+		bool inAtlas;
+		unsigned short atlasX, atlasY, atlasWidth, atlasHeight;
+		PI_AtlasRegion region;
 	};
 
 	PI_Mat44 projectionMat;
@@ -283,13 +507,47 @@ private:
 	vector <PI_TexID> vTextures;
 	vector <PI_Mesh> vMeshes;
 
-	// Everything to be rendered in the current frame.
+	// Frames published by the game, the one being drawn, and its render list.
+	PI_FrameQueue frameQueue;
+	PI_FramePacket *pFrame;
 	reusable_vector <PI_RenderElement> *vpRenderList;
-	vector <const PI_ParticleEmitter *> vpEmitterList;
 
-	// A map of edge data for all loaded meshes.
-	// The key is the display list name that OpenGL generates for each unique mesh node.
-	map<unsigned int, vector<PI_Edge> > edgeDataMap;
+	// How long to sleep waiting for a frame when there's nothing to load (milliseconds).
+	static const DWORD FrameWaitTime;
+
+	// The render list in the order it's drawn, and room to sort it.
+	vector<PI_SortItem> vRenderQueue, vRenderQueueScratch;
+
+	// The instances of the run of elements being drawn.
+	vector<PI_Instance> vInstances;
+
+	// The screen regions of this frame's shadow casters.
+	vector<PI_ShadowRegion> vShadowRegions;
+
+	// Shadow maps: the light's view of the scene, and how receivers find themselves in the map.
+	ShadowTechnique shadowTechnique;
+	bool vsync;
+	PI_Camera lightCam;
+	PI_Mat44 shadowMatrix;
+	static const unsigned int ShadowMapSize;
+	static const float ShadowMapRadius;
+
+	// What frames are submitted to - the GL, or nothing at all when only the CPU is being timed.
+	PI_GLBackend glBackend;
+	PI_NullBackend nullBackend;
+	PI_RenderBackend *pBackend;
+
+	// The geometry and edges of every unique mesh node, keyed by the handle stored in the nodes.
+	// Nodes also point straight at their entry, which stays put until it's deleted.
+	map<unsigned int, PI_NodeGeometry> nodeGeometry;
+	unsigned int nextGeometry;
+
+	// The geometry handle of every compiled mesh node, keyed by the node's content hash.
+	// Identical nodes in different meshes share one geometry buffer and one edge list.
+	map<ULONGLONG, unsigned int> meshNodeHashes;
+
+	// What content hashing has saved during the current batch of requests.
+	unsigned int numSharedTextures, numSharedNodes, sharedBytes;
 
 	// Required data members for binding OpenGL.
 	HDC m_HDC;
@@ -297,20 +555,95 @@ private:
 	HGLRC m_HGLRC;
 	int m_width, m_height;
 
+	// Benchmark mode: the offscreen buffer frames are drawn to, its size, and the frames timed so far.
+	GLuint offscreenFramebuffer, offscreenColor, offscreenDepthStencil;
+	int offscreenWidth, offscreenHeight;
+	PI_FrameProfiler frameProfiler;
+	volatile bool benchmarkFinished;
+
 	// Keep track of the currently bound textures.
 	mutable unsigned int activeTexStage0, activeTexStage1;
 
-	// Scene lights and camera.
+	// Scene lights and camera, as of the frame being drawn.
+	// The light is the renderer's own, as it holds the shadow volume built each frame.
 	PI_Camera *pActiveCam;
 	PI_DLight *pActiveDLight;
+	PI_DLight frameLight;
+
+	// Descriptor for a queued asset load.
+	struct PI_AssetRequest
+	{
+		string filename;
+		AssetPriority priority;
+		AssetCallback callback;
+		void *pUserData;
+		RequestStatus status;
+	};
+
+	// Every request in the current batch. Handles are indices offset by firstRequest.
+	// The counts can be read without the lock; only the requesting thread changes the batch size.
+	vector<PI_AssetRequest> vRequests;
+	unsigned int firstRequest;
+	volatile LONG numPendingRequests, numBatchRequests;
+
+	// How long to spend loading requested assets between frames (seconds).
+	static const double AssetTimeSlice;
+
+	// The current level's asset list, and assets that outlive every level.
+	vector<string> vLevelAssets, vPinnedAssets;
 
-	const vector<string> *vpAssetList;
+	// Release whatever the last level used once the current batch of requests is finished?
+	// Checked by the render thread without the lock, and set by the game thread with it.
+	volatile bool releasePending;
+
+	// The PWM file the world tree was built from.
+	string worldFilename;
+
+	// Re-decodes assets that change on disk.
+	PI_AssetWatcher assetWatcher;
+
+	// Decodes assets before they're requested.
+	PI_Prefetcher prefetcher;
+	static const unsigned int PrefetchBudget;
+	unsigned int numPrefetchHits;
+
+	// Per-stage timings for everything loaded by the current batch of requests.
+	PI_LoadProfiler loadProfiler;
 
 	PI_GUI &gui;
 
 	// Statistics for rendering.
 	mutable unsigned int numTrisRendered, numNodesRendered;
 
+	// An emitter's live particles, and where their billboards go.
+	struct PI_ParticleJob
+	{
+		const PI_ParticleEmitter *pEmitter;
+		const unsigned int *pIndices;		// Which particles are alive.
+		unsigned int numParticles;
+		PI_Vec3 upLeft;						// Billboard corner offset for a particle of size 1.
+		const unsigned char *pColors;		// The emitter's color table, or 0 if particles stay white.
+		float lifeBase, lifeScale;			// Map a particle's life to its entry in the table.
+		PI_QuadVertex *pVerts;
+	};
+
+	// Particle billboards, built on the CPU so each emitter is drawn at once.
+	mutable vector<unsigned int> vParticleIndices;
+	mutable vector<PI_QuadVertex> vParticleVerts;
+	enum { ParticleColorSteps = 64 };
+	mutable unsigned char particleColors[ParticleColorSteps * 4];
+	static const unsigned int ParticleChunkSize;
+
+	// This frame's world culling tasks, in tree order. Slots past the count are kept for reuse.
+	mutable vector<PI_WorldCullTask> vWorldCullTasks;
+	mutable unsigned int numWorldCullTasks;
+	static const unsigned int WorldCullSplitDepth;
+
+	// The world batches that survived culling this frame, and their draw ranges.
+	mutable vector<const PI_WorldTree::PI_WorldTreeNode::RenderData *> vpWorldBatches;
+	mutable vector<unsigned int> vWorldFirstIndices;
+	mutable vector<GLsizei> vWorldCounts;
+
 	// The world.
 	auto_ptr<PI_WorldTree> pWorld;
 
@@ -0,0 +1,234 @@
+// PigIron render backend interface.
+//
+// Everything the renderer submits for a frame goes through a backend. The renderer
+// and GUI do all the CPU work - culling, sorting, shadow volumes, particle and glyph
+// quads - and hand the backend what's left to draw. The OpenGL backend draws it;
+// the null backend throws it away, so a frame's CPU cost can be measured on its own.
+//
+// Assets are uploaded to OpenGL whichever backend draws the frames.
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "PI_Math.h"
+#include "PI_Geom.h"
+#include "PI_GeometryBuffer.h"
+#include "PI_Instancer.h"
+
+// A corner of a screen or world space quad. Laid out as GL_T2F_C4UB_V3F.
+struct PI_QuadVertex
+{
+	float uv[2];
+	unsigned char rgba[4];
+	float pos[3];
+
+	void Set(float x, float y, float z, float u, float v)
+	{
+		pos[0] = x, pos[1] = y, pos[2] = z, uv[0] = u, uv[1] = v;
+	}
+
+	void SetColor(const float *pRGBA)
+	{
+		for (int i = 0; i < 4; ++i)
+			rgba[i] = (unsigned char)(pRGBA[i] * 255.0f + 0.5f);
+	}
+};
+
+// The part of the screen one caster's shadow can touch.
+struct PI_ShadowRegion
+{
+	unsigned int firstQuad, numQuads;	// The caster's quads in the shadow volume.
+	int x, y, width, height;			// Window coordinates, from the lower left.
+	float zMin, zMax;					// Window depths.
+};
+
+class PI_RenderBackend
+{
+public:
+
+	virtual ~PI_RenderBackend() { }
+
+	// Get ready to draw. Called on the render thread with a current rendering context.
+	//
+	// In:		hDC				The device context frames are presented to.
+	virtual void Init(HDC hDC) = 0;
+	virtual void Shutdown(void) = 0;
+
+	// Start a frame by clearing depth and stencil.
+	//
+	// In:		clearColor		Clear the color buffer too?
+	virtual void BeginFrame(bool clearColor) = 0;
+
+	// Finish a frame.
+	//
+	// In:		present			Swap it onto the window? Otherwise wait until it's been drawn.
+	virtual void EndFrame(bool present) = 0;
+
+	// Load the camera's matrices.
+	virtual void SetCamera(const PI_Mat44 &projection, const PI_Mat44 &view) = 0;
+
+	// Bind a texture to a texture stage (0 or 1). The renderer skips redundant binds.
+	virtual void BindTexture(unsigned int stage, unsigned int texName) = 0;
+
+	// Switch to and from DOT3 normal mapping, with the diffuse texture modulated in on stage 1.
+	// Meshes are only drawn between BeginMeshes and EndMeshes.
+	virtual void BeginMeshes(void) = 0;
+	virtual void EndMeshes(void) = 0;
+
+	// Pick the geometry DrawMesh and DrawMeshInstances draw. 0 unbinds it.
+	virtual void SetGeometry(const PI_GeometryBuffer *pGeometry) = 0;
+
+	// Draw the current geometry once.
+	//
+	// In:		worldXform		Where to draw it.
+	//			lightDirModel	The light direction in model space.
+	virtual void DrawMesh(const PI_Mat44 &worldXform, const PI_Vec3 &lightDirModel) = 0;
+
+	// Can DrawMeshInstances be used?
+	virtual bool CanDrawInstanced(void) const = 0;
+
+	// Draw the current geometry once per instance.
+	virtual void DrawMeshInstances(const PI_Instance *pInstances, unsigned int numInstances) = 0;
+
+	// Switch to and from lit world geometry.
+	//
+	// In:		lightDir		The directional light, in world space.
+	//			geometry		The world's geometry.
+	virtual void BeginWorld(const PI_Vec3 &lightDir, const PI_GeometryBuffer &geometry) = 0;
+	virtual void EndWorld(void) = 0;
+
+	// Draw several batches of the world geometry with the texture on stage 0.
+	virtual void DrawWorldBatches(const unsigned int *pFirstIndices, const GLsizei *pCounts, unsigned int numBatches) = 0;
+
+	// Count the shadow volume into the stencil buffer, and darken whatever's inside it.
+	// Each caster's quads and darkening are limited to its region.
+	//
+	// In:		pQuads			The shadow volume.
+	//			pRegions		Where each caster's quads are, and where they can be seen.
+	//			numRegions		How many casters there are.
+	virtual void DrawShadows(const PI_Quad *pQuads, const PI_ShadowRegion *pRegions, unsigned int numRegions) = 0;
+
+	// Create the depth texture shadow maps are drawn into. Released by Shutdown.
+	//
+	// In:		size			Its width and height, in texels.
+	//
+	// Returns					True if shadow maps can be used.
+	virtual bool CreateShadowMap(unsigned int size) = 0;
+
+	// Switch to and from drawing casters into the shadow map, from the light.
+	virtual void BeginShadowMap(const PI_Mat44 &lightProjection, const PI_Mat44 &lightView) = 0;
+	virtual void EndShadowMap(void) = 0;
+
+	// Draw the current geometry into the shadow map.
+	virtual void DrawShadowCaster(const PI_Mat44 &worldXform) = 0;
+
+	// Switch to and from testing everything drawn against the shadow map, on texture stage 2.
+	// Must be called with the camera set.
+	//
+	// In:		shadowMatrix	Takes world space to shadow map coordinates, with depth in the third.
+	virtual void BeginShadowReceivers(const PI_Mat44 &shadowMatrix) = 0;
+	virtual void EndShadowReceivers(void) = 0;
+
+	virtual void SetDepthTest(bool enable) = 0;
+
+	// Switch to and from a screen space view with the origin at the lower left.
+	virtual void BeginOverlay(int width, int height) = 0;
+	virtual void EndOverlay(void) = 0;
+
+	// Draw textured quads from an array in one call, with the texture on stage 0.
+	//
+	// In:		pCorners		Four corners per quad, counter-clockwise from the upper left.
+	//			numQuads		How many quads there are.
+	virtual void DrawQuads(const PI_QuadVertex *pCorners, unsigned int numQuads) = 0;
+};
+
+// Draws with OpenGL.
+class PI_GLBackend : public PI_RenderBackend
+{
+public:
+
+	PI_GLBackend(void) : hDC(0), pGeometry(0), pWorldGeometry(0), instancing(false), shadowFramebuffer(0), shadowTexture(0),
+						 shadowMapSize(0), previousFramebuffer(0)
+	{ }
+
+	void Init(HDC hDC);
+	void Shutdown(void);
+	void BeginFrame(bool clearColor);
+	void EndFrame(bool present);
+	void SetCamera(const PI_Mat44 &projection, const PI_Mat44 &view);
+	void BindTexture(unsigned int stage, unsigned int texName);
+	void BeginMeshes(void);
+	void EndMeshes(void);
+	void SetGeometry(const PI_GeometryBuffer *pGeometry);
+	void DrawMesh(const PI_Mat44 &worldXform, const PI_Vec3 &lightDirModel);
+	bool CanDrawInstanced(void) const { return instancer.IsAvailable(); }
+	void DrawMeshInstances(const PI_Instance *pInstances, unsigned int numInstances);
+	void BeginWorld(const PI_Vec3 &lightDir, const PI_GeometryBuffer &geometry);
+	void EndWorld(void);
+	void DrawWorldBatches(const unsigned int *pFirstIndices, const GLsizei *pCounts, unsigned int numBatches);
+	void DrawShadows(const PI_Quad *pQuads, const PI_ShadowRegion *pRegions, unsigned int numRegions);
+	bool CreateShadowMap(unsigned int size);
+	void BeginShadowMap(const PI_Mat44 &lightProjection, const PI_Mat44 &lightView);
+	void EndShadowMap(void);
+	void DrawShadowCaster(const PI_Mat44 &worldXform);
+	void BeginShadowReceivers(const PI_Mat44 &shadowMatrix);
+	void EndShadowReceivers(void);
+	void SetDepthTest(bool enable);
+	void BeginOverlay(int width, int height);
+	void EndOverlay(void);
+	void DrawQuads(const PI_QuadVertex *pCorners, unsigned int numQuads);
+
+private:
+
+	// Limit drawing to a shadow region.
+	void ApplyShadowRegion(const PI_ShadowRegion &region) const;
+
+	HDC hDC;
+	const PI_GeometryBuffer *pGeometry, *pWorldGeometry;
+
+	// Draws runs of meshes in one call, and whether its vertex program is in use.
+	PI_Instancer instancer;
+	bool instancing;
+
+	// The shadow map, and the framebuffer and viewport to go back to once it's drawn.
+	GLuint shadowFramebuffer, shadowTexture;
+	unsigned int shadowMapSize;
+	GLint previousFramebuffer, previousViewport[4];
+};
+
+// Draws nothing.
+class PI_NullBackend : public PI_RenderBackend
+{
+public:
+
+	void Init(HDC) { }
+	void Shutdown(void) { }
+	void BeginFrame(bool) { }
+	void EndFrame(bool) { }
+	void SetCamera(const PI_Mat44 &, const PI_Mat44 &) { }
+	void BindTexture(unsigned int, unsigned int) { }
+	void BeginMeshes(void) { }
+	void EndMeshes(void) { }
+	void SetGeometry(const PI_GeometryBuffer *) { }
+	void DrawMesh(const PI_Mat44 &, const PI_Vec3 &) { }
+
+	// Instance data is still built, as it would be for the GL.
+	bool CanDrawInstanced(void) const { return true; }
+	void DrawMeshInstances(const PI_Instance *, unsigned int) { }
+	void BeginWorld(const PI_Vec3 &, const PI_GeometryBuffer &) { }
+	void EndWorld(void) { }
+	void DrawWorldBatches(const unsigned int *, const GLsizei *, unsigned int) { }
+	void DrawShadows(const PI_Quad *, const PI_ShadowRegion *, unsigned int) { }
+	bool CreateShadowMap(unsigned int) { return true; }
+	void BeginShadowMap(const PI_Mat44 &, const PI_Mat44 &) { }
+	void EndShadowMap(void) { }
+	void DrawShadowCaster(const PI_Mat44 &) { }
+	void BeginShadowReceivers(const PI_Mat44 &) { }
+	void EndShadowReceivers(void) { }
+	void SetDepthTest(bool) { }
+	void BeginOverlay(int, int) { }
+	void EndOverlay(void) { }
+	void DrawQuads(const PI_QuadVertex *, unsigned int) { }
+};
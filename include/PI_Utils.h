@@ -12,6 +12,22 @@ using std::vector;
 
 int RandomNum(int high, int low);
 
+// Something to be sorted by a 64-bit key.
+struct PI_SortItem
+{
+	unsigned long long key;
+	unsigned int index;			// Whatever the key belongs to.
+};
+
+// Sort items by key with a least significant byte first radix sort.
+// Bytes that are the same in every key are skipped.
+//
+// In:		pItems, count	The items to sort.
+//			pScratch		Room for count more items.
+//
+// Out:		pItems			The items in ascending key order. Items with equal keys keep their order.
+void PI_RadixSort(PI_SortItem *pItems, PI_SortItem *pScratch, unsigned int count);
+
 // A vector that keeps track of how many of its elements are "in use" in a linear fashion.
 // This allows you to "empty" the vector without actually deleting memory.
 template <typename T>
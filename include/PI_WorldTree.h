@@ -8,6 +8,7 @@
 using std::vector;
 
 #include "PI_Geom.h"
+#include "PI_GeometryBuffer.h"
 
 // Leaf nodes are created when the tree depth reaches MAX_WORLDTREE_DEPTH,
 // or the number of polygons in a node is less than or equal to LEAF_POLY_THRESHOLD,
@@ -22,11 +23,12 @@ class PI_WorldTree
 			
 			struct RenderData
 			{
-				unsigned int displayList,	// OpenGL display list.
+				unsigned int firstIndex,	// Where the batch starts in the world's geometry buffer.
+							 numIndices,	// How many indices the batch draws.
 							 diffTexName,	// OpenGL texture name for diffuse.
 							 normTexName;	// OpenGL texture name for normal mapping.
-				RenderData(unsigned int _displayList = 0, unsigned int _diffTexName = 0, unsigned int _normTexName = 0)
-					: displayList(_displayList), diffTexName(_diffTexName), normTexName(_normTexName) { }
+				RenderData(unsigned int _diffTexName = 0, unsigned int _normTexName = 0)
+					: firstIndex(0), numIndices(0), diffTexName(_diffTexName), normTexName(_normTexName) { }
 			};
 
 			PI_Plane3 aabb_planes[6];
@@ -46,8 +48,9 @@ class PI_WorldTree
 			PI_WorldTreeNode(void) : leftChild(0), rightChild(0), depth(0) {}
 			~PI_WorldTreeNode(void);
 
-			// Recursively process all nodes up to a depth of MAX_WORLDTREE_DEPTH
-			void Process(unsigned short newDepth, unsigned int &nodeCount, unsigned int &leafNodeCount);
+			// Recursively process all nodes up to a depth of MAX_WORLDTREE_DEPTH.
+			// Leaf geometry is added to the world's geometry buffer.
+			void Process(unsigned short newDepth, unsigned int &nodeCount, unsigned int &leafNodeCount, PI_GeometryBuffer &geometry);
 		};
 
 		// Functions for sorting a Node's triangles along the cardinal axes.
@@ -68,6 +71,9 @@ class PI_WorldTree
 		
 		unsigned int numWorldTris, nodeCount, leafNodeCount;
 
+		// Every leaf's triangles, batched by texture.
+		PI_GeometryBuffer geometry;
+
 	public:
 
 		~PI_WorldTree(void);
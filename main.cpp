@@ -11,8 +11,10 @@
 #endif
 
 #include "Game.h"
-#include "Timer.h"
 #include "PI_Utils.h"
+#include "PI_Asset.h"
+#include "PI_JobPool.h"
+#include "PI_FramePacer.h"
 
 // Globals
 const char *szTitle			= "Evan Beeton's CV",
@@ -34,6 +36,54 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCmdL
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+	// Worker threads for loading and cooking.
+	PI_JobPool &jobPool = PI_JobPool::GetInstance();
+	jobPool.Init();
+
+	// "-cook" writes compressed copies of all the assets, then quits.
+	if (strstr(lpCmdLine, "-cook"))
+	{
+		const bool CookedAll = PI_CookDirectory("DATA");
+		jobPool.Shutdown();
+		PI_Logger::GetInstance().Shutdown();
+		return CookedAll ? 0 : -1;
+	}
+
+	// "-benchmark[=frames]" times the first level's frames offscreen, writes benchmark.csv, then quits.
+	// The window is never shown, so it runs the same on a locked or headless machine.
+	// Add "-nullrender" to build every frame without drawing it, which times the CPU alone.
+	// Without a usable frame count, 600 frames are timed.
+	const int BenchmarkWidth = 1280, BenchmarkHeight = 720, DefaultBenchmarkFrames = 600;
+	unsigned int benchmarkFrames = 0;
+	const char *pBenchmarkArg = strstr(lpCmdLine, "-benchmark");
+	if (pBenchmarkArg && (sscanf_s(pBenchmarkArg, "-benchmark=%u", &benchmarkFrames) != 1 || !benchmarkFrames))
+	{
+		if (pBenchmarkArg[strlen("-benchmark")] == '=')
+			PI_Logger::GetInstance() << "-benchmark needs at least one frame - timing " << DefaultBenchmarkFrames << " instead.\n";
+		benchmarkFrames = DefaultBenchmarkFrames;
+	}
+	const bool NullRender = strstr(lpCmdLine, "-nullrender") != 0;
+
+	// "-shadowmaps" draws shadows from a depth map instead of stencil volumes. Benchmark both to compare.
+	if (strstr(lpCmdLine, "-shadowmaps"))
+		PI_Render::GetInstance().SetShadowTechnique(PI_Render::ShadowMaps);
+
+	// "-fps=N" holds the main loop to N frames per second, or runs it flat out with 0.
+	// It defaults to the display's refresh rate. "-vsync" also locks presents to the refresh.
+	// Benchmarks always run flat out.
+	double targetRate = 60;
+	DEVMODE displayMode = { 0 };
+	displayMode.dmSize = sizeof displayMode;
+	if (EnumDisplaySettings(0, ENUM_CURRENT_SETTINGS, &displayMode) && displayMode.dmDisplayFrequency > 1)
+		targetRate = displayMode.dmDisplayFrequency;
+	const char *pFPSArg = strstr(lpCmdLine, "-fps=");
+	if (pFPSArg)
+		targetRate = atof(pFPSArg + strlen("-fps="));
+	if (benchmarkFrames)
+		targetRate = 0;
+	else if (strstr(lpCmdLine, "-vsync"))
+		PI_Render::GetInstance().SetVSync(true);
+
 	// Register the window class.
 	WNDCLASSEX wcex;
 	wcex.cbSize = sizeof(WNDCLASSEX); 
@@ -56,21 +106,24 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCmdL
 	}
 
 #ifdef _DEBUG
-	if (!(hWnd = CreateWindow(szWindowClass, szTitle, WS_OVERLAPPED,
-							  0, 0, 800, 600, NULL, NULL, GetModuleHandle(0), NULL)))
-	{
-		ERRORBOX("CreateWindow failed");
-		return FALSE;
-	}
+	DWORD style = WS_OVERLAPPED;
+	WORD width = 800, height = 600;
 #else
+	DWORD style = WS_POPUP;
 	WORD width = GetSystemMetrics(SM_CXSCREEN), height = GetSystemMetrics(SM_CYSCREEN);
-	if (!(hWnd = CreateWindow(szWindowClass, szTitle, WS_POPUP,
+#endif
+	if (benchmarkFrames)
+	{
+		style = WS_POPUP;
+		width = BenchmarkWidth, height = BenchmarkHeight;
+		PI_Render::GetInstance().SetBenchmark(width, height, benchmarkFrames, NullRender);
+	}
+	if (!(hWnd = CreateWindow(szWindowClass, szTitle, style,
 							  0, 0, width, height, NULL, NULL, GetModuleHandle(0), NULL)))
 	{
 		ERRORBOX("CreateWindow failed");
 		return FALSE;
 	}
-#endif
 
 	InitializeCriticalSection(&g_cs);
 	//InitializeCriticalSectionAndSpinCount(&g_cs, 0xFFFFFFFF);
@@ -83,42 +136,56 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCmdL
 		PostQuitMessage(-1);
 	}
 
-	ShowWindow(hWnd, SW_SHOWNORMAL);
+	if (!benchmarkFrames)
+	{
+		ShowWindow(hWnd, SW_SHOWNORMAL);
 #ifndef _DEBUG
-	// The WS_POPUP window style seems to not post a WM_SIZE when the window is shown.
-	// Force one so that the renderer's viewport is properly sized.
-	SendMessage(hWnd, WM_SIZE, SIZE_RESTORED, MAKELPARAM(width, height));
+		// The WS_POPUP window style seems to not post a WM_SIZE when the window is shown.
+		// Force one so that the renderer's viewport is properly sized.
+		SendMessage(hWnd, WM_SIZE, SIZE_RESTORED, MAKELPARAM(width, height));
 #endif
-	UpdateWindow(hWnd);
+		UpdateWindow(hWnd);
+	}
 	
 
-	Timer timer;
-	timer.Start();
+	// Sleep between frames rather than spinning, and keep track of how smooth they are.
+	PI_FramePacer pacer;
+	pacer.Init(targetRate);
 
+	bool quit = false;
 	while (true)
 	{
-		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) 
+		// Wait for the next frame, then handle every message that came in meanwhile.
+		const double FrameSeconds = pacer.WaitForNextFrame();
+		while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) 
 		{
 			if (KEYDOWN(VK_ESCAPE))
 				PostQuitMessage(0);
 
 			if (msg.message == WM_QUIT)
+			{
+				quit = true;
 				break;
+			}
 
 			TranslateMessage(&msg); // Is this really necessary?
 			DispatchMessage(&msg);
 		}
+		if (quit)
+			break;
 
 		// Process the main game loop.
-		cv.Update(timer.ElapsedSecondsReset());
+		cv.Update((float)FrameSeconds);
 
-		// TODO : Why does this change CPU usage and frame rate so drastically?
-		//		  Processor usage drops from 50 to 0 and frame rate drops from 400-500 to 64 (800x600 debug)!
-		//Sleep(1);
+		// The benchmark is over once its report is written.
+		if (benchmarkFrames && PI_Render::GetInstance().IsBenchmarkFinished())
+			PostQuitMessage(0);
 	}
+	pacer.Shutdown();
 
 	// Shut down the game.
 	cv.Shutdown();
+	jobPool.Shutdown();
 
 	DeleteCriticalSection(&g_cs);
 
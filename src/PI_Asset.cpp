@@ -0,0 +1,516 @@
+// PigIron asset decoding implementation.
+
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+using std::ios;
+using std::ios_base;
+#include <cstddef>
+
+#include "PI_Asset.h"
+#include "PI_LZ.h"
+#include "PI_JobPool.h"
+#include "PI_Logger.h"
+
+// Cooked files are split into chunks this big, which are compressed independently.
+#define COOKED_CHUNK_SIZE (64 * 1024)
+
+// Cooked file layout: this header, the stored size of each chunk, then the chunks back to back.
+// A chunk whose stored size is its raw size wasn't worth compressing, and is stored as is.
+struct PI_CookedHeader
+{
+	char magic[4];					// "PIZ1"
+	unsigned int rawSize,			// Size of the source file.
+				 chunkSize,			// Raw size of every chunk but the last.
+				 numChunks;
+};
+
+// Read an entire file into memory.
+//
+// In:		filename		Name of desired file, can be relative or absolute.
+//			pProfile		Where to record open and read timings. May be 0.
+//
+// Out:		out				The file contents.
+//
+// Returns					True if the whole file was read.
+bool PI_ReadFile(const char *filename, vector<unsigned char> &out, PI_AssetProfile *pProfile)
+{
+	PI_StageTimer openTimer(pProfile, PI_AssetProfile::Open);
+	ifstream fin(filename, ios_base::binary | ios_base::in);
+	if (!fin.is_open())
+		return false;
+	openTimer.Stop();
+
+	// How big is it?
+	fin.seekg(0, ios_base::end);
+	const unsigned int Size = (unsigned int)fin.tellg();
+	fin.seekg(0, ios_base::beg);
+
+	// Pull the whole thing in with a single read.
+	PI_StageTimer readTimer(pProfile, PI_AssetProfile::Read);
+	out.resize(Size);
+	if (Size)
+		fin.read((char *)&out[0], Size);
+	const bool ReadAll = (unsigned int)fin.gcount() == Size;
+	fin.close();
+	readTimer.Stop(Size);
+	return ReadAll;
+}
+
+// Decode a 24- or 32-bit uncompressed TARGA image.
+//
+// In:		pData, size		The file image in memory.
+//			pProfile		Where to record decode timings. May be 0.
+//
+// Out:		out				The decoded image.
+//
+// Returns					True if the image is in a supported format.
+bool PI_DecodeTarga(const unsigned char *pData, unsigned int size, PI_Image &out, PI_AssetProfile *pProfile)
+{
+	PI_StageTimer decodeTimer(pProfile, PI_AssetProfile::Decode);
+	PI_MemReader in(pData, size);
+	unsigned char ID_Length, ColorMapType, ImageType, depth;
+
+	// Image ID length - should be 0.
+	// Color Map Type - should be 0.
+	// Image Type - should be 2 (Uncompressed true color image).
+	if (!in.Read(&ID_Length, sizeof ID_Length) || !in.Read(&ColorMapType, sizeof ColorMapType) ||
+		!in.Read(&ImageType, sizeof ImageType))
+		return false;
+
+	// Make sure it's a type we can handle.
+	if (ID_Length || ColorMapType || ImageType != 2)
+		// This format is unsupported.
+		return false;
+
+	// Skip the color map specification field and X/Y origins.
+	// Then read the dimensions & color depth.
+	if (!in.Skip(9) || !in.Read(&out.width, sizeof out.width) || !in.Read(&out.height, sizeof out.height) ||
+		!in.Read(&depth, sizeof depth))
+		return false;
+
+	// Only 24-bit and 32-bit supported.
+	if (depth != 24 && depth != 32)
+		// This format is unsupported.
+		return false;
+	else if (depth == 24)
+		out.format = GL_BGR_EXT;
+	else
+		out.format = GL_BGRA_EXT;
+
+	// Ignore the descriptor.
+	if (!in.Skip(1))
+		return false;
+
+	// Image ID and Color Map fields should be zero bytes if we got this far,
+	// so read in the actual image data.
+	out.components = depth >> 3;
+	const unsigned int ImageBytes = out.width * out.height * out.components;
+	out.pixels.resize(ImageBytes);
+	if (ImageBytes && !in.Read(&out.pixels[0], ImageBytes))
+		return false;
+	decodeTimer.Stop(ImageBytes);
+	return true;
+}
+
+// Decode a PigIron Mesh (PIM) file.
+//
+// In:		filename		Name the data was read from - texture paths are relative to it.
+//			pData, size		The file image in memory.
+//			pProfile		Where to record decode and edge timings. May be 0.
+//
+// Out:		out				The decoded mesh.
+//
+// Returns					True if the whole file was decoded.
+bool PI_DecodePIM(const char *filename, const unsigned char *pData, unsigned int size, PI_MeshData &out,
+				  PI_AssetProfile *pProfile)
+{
+	// Edge data is timed separately from the rest of the file.
+	const double DecodeStart = PI_GetSeconds();
+	double edgeSeconds = 0;
+	unsigned int edgeBytes = 0;
+
+	PI_MemReader in(pData, size);
+	string tempStr, filepath;
+	unsigned int numNodes = 0, numTexs = 0, numTris = 0, numEdges = 0;
+
+	// The file path will be need when textures are loaded because the exporter doesn't
+	// include paths in the texture filenames used by this mesh.
+	filepath = filename;
+	unsigned int index;
+	if ((index = (unsigned int)filepath.find_last_of('\\')) != string::npos)
+		filepath.erase(index + 1);
+	else
+		// No path.
+		filepath.clear();
+
+	out.filename = filename;
+
+	// Get the number of nodes, then allocate them.
+	if (!in.Read(&numNodes, sizeof(unsigned int)))
+		return false;
+	out.vNodes.clear();
+	out.vNodes.resize(numNodes);
+
+	// Read 'em all in.
+	for (unsigned int n = 0; n < numNodes; n++)
+	{
+		PI_MeshNodeData &node = out.vNodes[n];
+
+		// Read the node's name.
+		if (!in.ReadLine(node.name))
+			return false;
+
+		// How many textures does this node use?
+		if (!in.Read(&numTexs, sizeof(unsigned int)))
+			return false;
+
+// TODO:: Load up more than just one texture. This code keeps the last listed texture.
+		if (numTexs > 0)
+		{
+			// Read in each filename.
+			for (unsigned int t = 0; t < numTexs; t++)
+				if (!in.ReadLine(tempStr))
+					return false;
+
+			// Add the path.
+			node.diffTexFilename = filepath + tempStr;
+
+// HACK:: The normal map filename is the diffuse filename with the last letter changed to an 'N'.
+// TODO:: Update the exporter to embed the normal map filename in the PIM file.
+			node.normTexFilename = node.diffTexFilename;
+			const unsigned int Dot = (unsigned int)node.normTexFilename.find_last_of('.');
+			if (Dot != string::npos && Dot > 0)
+				node.normTexFilename[Dot - 1] = 'N';
+			else
+				node.normTexFilename.clear();
+		}
+
+		// Read in the flags and the local transformation matrix.
+		if (!in.Read(&node.flags, sizeof(unsigned char)) || !in.Read(node.ltm.mat, sizeof(float) * 16))
+			return false;
+
+		// If the node isn't renderable, there won't be any geometry data in the file.
+		if (!(node.flags & RENDERABLE))
+			continue;
+
+		// Read all geometric data.
+		if (!in.Read(&numTris, sizeof(unsigned int)) || in.BytesLeft() / sizeof(PI_Triangle) < numTris)
+			return false;
+		node.vTris.resize(numTris);
+		if (numTris && !in.Read(&node.vTris[0], sizeof(PI_Triangle) * numTris))
+			return false;
+
+		// If this mesh casts shadows, we need to read in the edge data.
+		if (node.flags & CASTSHADOWS)
+		{
+			const double EdgeStart = PI_GetSeconds();
+			if (!in.Read(&numEdges, sizeof(unsigned int)) || in.BytesLeft() / sizeof(PI_Edge) < numEdges)
+				return false;
+			node.vEdges.resize(numEdges);
+			if (numEdges && !in.Read(&node.vEdges[0], sizeof(PI_Edge) * numEdges))
+				return false;
+
+			// Older exports don't include edges, so build them from the triangles.
+			if (!numEdges && numTris)
+				PI_BuildEdgeList(&node.vTris[0], numTris, node.vEdges);
+
+			edgeSeconds += PI_GetSeconds() - EdgeStart;
+			edgeBytes += numEdges * sizeof(PI_Edge);
+		}
+
+		// Read the bounding data.
+		if (!in.Read(&node.aabb_min, sizeof(PI_Vec3)) || !in.Read(&node.aabb_max, sizeof(PI_Vec3)) ||
+			!in.Read(&node.boundingRadius, sizeof(float)))
+			return false;
+	}
+
+	if (pProfile)
+	{
+		pProfile->Add(PI_AssetProfile::Decode, PI_GetSeconds() - DecodeStart - edgeSeconds, size - edgeBytes);
+		pProfile->Add(PI_AssetProfile::Edges, edgeSeconds, edgeBytes);
+	}
+	return true;
+}
+
+// Is there a cooked copy of a file that's at least as new as the file itself?
+//
+// In:		filename		Name of the source file.
+//			cookedFilename	Name of the cooked copy.
+//
+// Returns					True if the cooked copy can be used. It can if the source is missing.
+bool PI_IsCookedCurrent(const char *filename, const char *cookedFilename)
+{
+	WIN32_FILE_ATTRIBUTE_DATA source, cooked;
+	if (!GetFileAttributesEx(cookedFilename, GetFileExInfoStandard, &cooked))
+		return false;
+
+	// Shipping builds might only have the cooked copy.
+	if (!GetFileAttributesEx(filename, GetFileExInfoStandard, &source))
+		return true;
+	return CompareFileTime(&cooked.ftLastWriteTime, &source.ftLastWriteTime) >= 0;
+}
+
+// Everything the chunk jobs need to inflate a cooked file.
+struct PI_InflateJob
+{
+	const unsigned char *pFile;
+	const unsigned int *pStoredSizes;
+	vector<unsigned int> vOffsets;		// Where each chunk starts in the file.
+	unsigned char *pDst;
+	unsigned int rawSize, chunkSize;
+	volatile LONG numFailed;
+};
+
+// Inflate one chunk of a cooked file into its place in the destination buffer.
+static void InflateChunk(void *pContext, unsigned int index)
+{
+	PI_InflateJob &job = *(PI_InflateJob *)pContext;
+	const unsigned int Start = index * job.chunkSize;
+	const unsigned int RawSize = job.rawSize - Start < job.chunkSize ? job.rawSize - Start : job.chunkSize;
+	const unsigned char *pSrc = job.pFile + job.vOffsets[index];
+	unsigned char *pDst = job.pDst + Start;
+
+	if (job.pStoredSizes[index] == RawSize)
+		memcpy(pDst, pSrc, RawSize);
+	else if (!PI_LZDecompress(pSrc, job.pStoredSizes[index], pDst, RawSize))
+		InterlockedIncrement(&job.numFailed);
+}
+
+// Inflate a cooked file image.
+//
+// Returns					True if the file was valid.
+static bool InflateCooked(const vector<unsigned char> &file, vector<unsigned char> &out, PI_AssetProfile *pProfile)
+{
+	PI_StageTimer inflateTimer(pProfile, PI_AssetProfile::Inflate);
+
+	PI_CookedHeader header;
+	const unsigned int FileSize = (unsigned int)file.size();
+	if (FileSize < sizeof header)
+		return false;
+	memcpy(&header, &file[0], sizeof header);
+	if (memcmp(header.magic, "PIZ1", 4) || !header.chunkSize ||
+		header.numChunks != (header.rawSize + header.chunkSize - 1) / header.chunkSize ||
+		(FileSize - sizeof header) / sizeof(unsigned int) < header.numChunks)
+		return false;
+
+	PI_InflateJob job;
+	job.pFile = &file[0];
+	job.pStoredSizes = (const unsigned int *)&file[sizeof header];
+	job.rawSize = header.rawSize;
+	job.chunkSize = header.chunkSize;
+	job.numFailed = 0;
+
+	// Find each chunk, and make sure they're all in the file.
+	unsigned int offset = sizeof header + header.numChunks * sizeof(unsigned int);
+	job.vOffsets.resize(header.numChunks);
+	for (unsigned int i = 0; i < header.numChunks; ++i)
+	{
+		job.vOffsets[i] = offset;
+		if (FileSize - offset < job.pStoredSizes[i])
+			return false;
+		offset += job.pStoredSizes[i];
+	}
+
+	out.resize(header.rawSize);
+	if (!header.rawSize)
+		return true;
+	job.pDst = &out[0];
+	PI_JobPool::GetInstance().ParallelFor(InflateChunk, &job, header.numChunks);
+	inflateTimer.Stop(header.rawSize);
+	return !job.numFailed;
+}
+
+// Read an asset file into memory. If there's an up to date cooked copy, that's read
+// instead and its chunks are decompressed straight into out - in parallel, unless
+// the caller is a background thread.
+//
+// In:		filename		Name of the source file, can be relative or absolute.
+//			pProfile		Where to record open, read and inflate timings. May be 0.
+//
+// Out:		out				The source file's contents.
+//
+// Returns					True if the whole file was read.
+bool PI_ReadAssetFile(const char *filename, vector<unsigned char> &out, PI_AssetProfile *pProfile)
+{
+	const string Cooked = string(filename) + PI_COOKED_EXT;
+	if (PI_IsCookedCurrent(filename, Cooked.c_str()))
+	{
+		vector<unsigned char> file;
+		if (PI_ReadFile(Cooked.c_str(), file, pProfile) && InflateCooked(file, out, pProfile))
+			return true;
+		PI_Logger::GetInstance() << "Cooked file " << Cooked << " is damaged, reading the source instead.\n";
+	}
+	return PI_ReadFile(filename, out, pProfile);
+}
+
+// Everything the chunk jobs need to compress a file.
+struct PI_DeflateJob
+{
+	const unsigned char *pSrc;
+	unsigned int rawSize, chunkSize;
+	vector<vector<unsigned char> > vChunks;
+};
+
+// Compress one chunk of a file, or copy it if it doesn't shrink.
+static void DeflateChunk(void *pContext, unsigned int index)
+{
+	PI_DeflateJob &job = *(PI_DeflateJob *)pContext;
+	const unsigned int Start = index * job.chunkSize;
+	const unsigned int RawSize = job.rawSize - Start < job.chunkSize ? job.rawSize - Start : job.chunkSize;
+	vector<unsigned char> &chunk = job.vChunks[index];
+
+	chunk.resize(PI_LZ_BOUND(RawSize));
+	const unsigned int Packed = PI_LZCompress(job.pSrc + Start, RawSize, &chunk[0], RawSize - 1);
+	if (Packed)
+		chunk.resize(Packed);
+	else
+		chunk.assign(job.pSrc + Start, job.pSrc + Start + RawSize);
+}
+
+// Write the cooked copy of an asset file. The file is split into chunks that are
+// compressed independently, and any chunk that doesn't shrink is stored as is.
+//
+// In:		filename		Name of the source file, can be relative or absolute.
+//
+// Returns					True if the cooked copy was written.
+bool PI_CookAsset(const char *filename)
+{
+	PI_Logger &logger = PI_Logger::GetInstance();
+
+	vector<unsigned char> file;
+	if (!PI_ReadFile(filename, file) || file.empty())
+	{
+		logger << "Failed to read " << filename << " for cooking.\n";
+		return false;
+	}
+
+	PI_DeflateJob job;
+	job.pSrc = &file[0];
+	job.rawSize = (unsigned int)file.size();
+	job.chunkSize = COOKED_CHUNK_SIZE;
+	PI_CookedHeader header = { { 'P', 'I', 'Z', '1' }, job.rawSize, job.chunkSize, (job.rawSize + job.chunkSize - 1) / job.chunkSize };
+	job.vChunks.resize(header.numChunks);
+	PI_JobPool::GetInstance().ParallelFor(DeflateChunk, &job, header.numChunks);
+
+	const string Cooked = string(filename) + PI_COOKED_EXT;
+	ofstream fout(Cooked.c_str(), ios_base::binary | ios_base::out | ios_base::trunc);
+	if (!fout.is_open())
+	{
+		logger << "Failed to write " << Cooked << ".\n";
+		return false;
+	}
+
+	unsigned int storedSize = sizeof header + header.numChunks * sizeof(unsigned int);
+	fout.write((const char *)&header, sizeof header);
+	for (unsigned int i = 0; i < header.numChunks; ++i)
+	{
+		const unsigned int ChunkSize = (unsigned int)job.vChunks[i].size();
+		fout.write((const char *)&ChunkSize, sizeof ChunkSize);
+		storedSize += ChunkSize;
+	}
+	for (unsigned int i = 0; i < header.numChunks; ++i)
+		fout.write((const char *)&job.vChunks[i][0], job.vChunks[i].size());
+	const bool Written = fout.good();
+	fout.close();
+
+	logger << "Cooked " << filename << ": " << job.rawSize << " -> " << storedSize << " bytes.\n";
+	return Written;
+}
+
+// Cook every TGA, PIM and PWM file in a directory.
+//
+// Returns					True if every file was cooked.
+bool PI_CookDirectory(const char *directory)
+{
+	WIN32_FIND_DATA findData;
+	const string Dir = string(directory) + '\\';
+	HANDLE hFind = FindFirstFile((Dir + '*').c_str(), &findData);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool cookedAll = true;
+	do
+	{
+		const unsigned int Length = (unsigned int)strlen(findData.cFileName);
+		if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || Length < 4)
+			continue;
+
+		const char *ext = findData.cFileName + Length - 3;
+		if (_stricmp(ext, "tga") && _stricmp(ext, "pim") && _stricmp(ext, "pwm"))
+			continue;
+
+		if (!PI_CookAsset((Dir + findData.cFileName).c_str()))
+			cookedAll = false;
+	}
+	while (FindNextFile(hFind, &findData));
+	FindClose(hFind);
+	return cookedAll;
+}
+
+// Read and decode a TARGA file.
+bool PI_LoadTargaData(const char *filename, PI_Image &out, PI_AssetProfile *pProfile)
+{
+	vector<unsigned char> file;
+	if (!PI_ReadAssetFile(filename, file, pProfile) || file.empty())
+		return false;
+	return PI_DecodeTarga(&file[0], (unsigned int)file.size(), out, pProfile);
+}
+
+// Read and decode a PIM file.
+bool PI_LoadPIMData(const char *filename, PI_MeshData &out, PI_AssetProfile *pProfile)
+{
+	vector<unsigned char> file;
+	if (!PI_ReadAssetFile(filename, file, pProfile) || file.empty())
+		return false;
+	return PI_DecodePIM(filename, &file[0], (unsigned int)file.size(), out, pProfile);
+}
+
+
+// Hash a block of memory (64-bit FNV-1a).
+//
+// In:		pData, size		The memory to hash.
+//			hash			A previous result, to hash several blocks together.
+//
+// Returns					The hash.
+ULONGLONG PI_HashBytes(const void *pData, unsigned int size, ULONGLONG hash)
+{
+	const unsigned char *pBytes = (const unsigned char *)pData;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		hash ^= pBytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Hash a decoded image's dimensions, format and pixels.
+ULONGLONG PI_HashImage(const PI_Image &image)
+{
+	ULONGLONG hash = PI_HashBytes(&image.width, sizeof image.width);
+	hash = PI_HashBytes(&image.height, sizeof image.height, hash);
+	hash = PI_HashBytes(&image.format, sizeof image.format, hash);
+	if (image.pixels.size())
+		hash = PI_HashBytes(&image.pixels[0], (unsigned int)image.pixels.size(), hash);
+	return hash;
+}
+
+// Hash everything about a mesh node that ends up in its display list and edge data.
+//
+// In:		node			The decoded node.
+//			flags			The node's rendering flags that affect how it's compiled.
+//
+// Returns					The hash.
+ULONGLONG PI_HashMeshNode(const PI_MeshNodeData &node, unsigned char flags)
+{
+	ULONGLONG hash = PI_HashBytes(&flags, sizeof flags);
+
+	// The texture names stored in each triangle are meaningless until the node is loaded.
+	const unsigned int NumTris = (unsigned int)node.vTris.size();
+	for (unsigned int i = 0; i < NumTris; ++i)
+		hash = PI_HashBytes(&node.vTris[i], offsetof(PI_Triangle, diffTex), hash);
+
+	if (node.vEdges.size())
+		hash = PI_HashBytes(&node.vEdges[0], (unsigned int)(node.vEdges.size() * sizeof(PI_Edge)), hash);
+	return hash;
+}
\ No newline at end of file
@@ -0,0 +1,217 @@
+// PigIron asset hot-reload implementation.
+
+#include <process.h>
+
+#include "PI_AssetWatcher.h"
+#include "PI_Logger.h"
+
+const DWORD PI_AssetWatcher::SettleTime = 250;
+
+PI_AssetWatcher::PI_AssetWatcher(void) : hThread(0), hStopEvent(0)
+{
+	InitializeCriticalSection(&cs);
+}
+
+PI_AssetWatcher::~PI_AssetWatcher(void)
+{
+	Stop();
+	DeleteCriticalSection(&cs);
+}
+
+// Start watching a directory and everything below it.
+//
+// In:		directory		The directory asset filenames are relative to, e.g. "DATA".
+//
+// Returns					True if the worker thread is running.
+bool PI_AssetWatcher::Start(const char *dir)
+{
+	if (hThread)
+		return true;
+
+	directory = dir;
+	if (!(hStopEvent = CreateEvent(0, TRUE, FALSE, 0)))
+		return false;
+
+	if (!(hThread = (HANDLE)_beginthreadex(0, 0, WatchThread, this, 0, 0)))
+	{
+		CloseHandle(hStopEvent);
+		hStopEvent = 0;
+		return false;
+	}
+	return true;
+}
+
+// Stop watching and wait for the worker thread to exit.
+void PI_AssetWatcher::Stop(void)
+{
+	if (hThread)
+	{
+		SetEvent(hStopEvent);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+		CloseHandle(hStopEvent);
+		hThread = hStopEvent = 0;
+	}
+
+	// Anything the renderer never collected is stale now.
+	EnterCriticalSection(&cs);
+	const unsigned int NumReloads = (unsigned int)vpReloads.size();
+	for (unsigned int i = 0; i < NumReloads; ++i)
+		delete vpReloads[i];
+	vpReloads.clear();
+	LeaveCriticalSection(&cs);
+}
+
+// Take the next decoded asset, if there is one.
+//
+// Returns					The asset, which the caller must delete, or 0 if nothing is waiting.
+PI_AssetWatcher::PI_ReloadedAsset *PI_AssetWatcher::PopReload(void)
+{
+	PI_ReloadedAsset *pReload = 0;
+	EnterCriticalSection(&cs);
+	if (vpReloads.size())
+	{
+		pReload = vpReloads.front();
+		vpReloads.erase(vpReloads.begin());
+	}
+	LeaveCriticalSection(&cs);
+	return pReload;
+}
+
+// Worker thread entry point.
+unsigned int __stdcall PI_AssetWatcher::WatchThread(void *pWatcher)
+{
+	((PI_AssetWatcher *)pWatcher)->Watch();
+	_endthreadex(0);
+	return 0;
+}
+
+// Wait for change notifications until told to stop.
+void PI_AssetWatcher::Watch(void)
+{
+	PI_Logger &logger = PI_Logger::GetInstance();
+
+	HANDLE hDirectory = CreateFile(directory.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+								   0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, 0);
+	if (hDirectory == INVALID_HANDLE_VALUE)
+	{
+		logger << "PI_AssetWatcher failed to open " << directory << " for watching.\n";
+		return;
+	}
+
+	// Notifications are written as DWORD-aligned FILE_NOTIFY_INFORMATION records.
+	DWORD buffer[2048];
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof overlapped);
+	overlapped.hEvent = CreateEvent(0, TRUE, FALSE, 0);
+
+	const DWORD Filter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME;
+	bool pending = ReadDirectoryChangesW(hDirectory, buffer, sizeof buffer, TRUE, Filter, 0, &overlapped, 0) != 0;
+	if (pending)
+		logger << "PI_AssetWatcher watching " << directory << " for changed assets.\n";
+
+	HANDLE handles[2] = { hStopEvent, overlapped.hEvent };
+	while (pending)
+	{
+		// Once something has changed, wake up when it has settled.
+		DWORD result = WaitForMultipleObjects(2, handles, FALSE, vChanged.empty() ? INFINITE : SettleTime);
+
+		if (result == WAIT_OBJECT_0)
+			// Time to go.
+			break;
+		else if (result == WAIT_OBJECT_0 + 1)
+		{
+			DWORD bytes = 0;
+			if (GetOverlappedResult(hDirectory, &overlapped, &bytes, FALSE) && bytes)
+				QueueChangedFiles((const unsigned char *)buffer);
+
+			// Listen for the next batch.
+			ResetEvent(overlapped.hEvent);
+			pending = ReadDirectoryChangesW(hDirectory, buffer, sizeof buffer, TRUE, Filter, 0, &overlapped, 0) != 0;
+		}
+		else if (result == WAIT_TIMEOUT)
+			// Nothing has been touched for a while, so the files should be complete.
+			DecodeChangedFiles();
+		else
+			break;
+	}
+
+	CancelIo(hDirectory);
+	CloseHandle(overlapped.hEvent);
+	CloseHandle(hDirectory);
+}
+
+// Record the asset files named in a change notification buffer.
+void PI_AssetWatcher::QueueChangedFiles(const unsigned char *pBuffer)
+{
+	const FILE_NOTIFY_INFORMATION *pInfo;
+	char name[MAX_PATH];
+	do
+	{
+		pInfo = (const FILE_NOTIFY_INFORMATION *)pBuffer;
+		pBuffer += pInfo->NextEntryOffset;
+
+		// Deletions and the old half of a rename don't give us anything to load.
+		if (pInfo->Action != FILE_ACTION_MODIFIED && pInfo->Action != FILE_ACTION_ADDED &&
+			pInfo->Action != FILE_ACTION_RENAMED_NEW_NAME)
+			continue;
+
+		int len = WideCharToMultiByte(CP_ACP, 0, pInfo->FileName, pInfo->FileNameLength / sizeof(WCHAR), name, MAX_PATH - 1, 0, 0);
+		if (len < 4)
+			continue;
+		name[len] = 0;
+
+		// Only textures and meshes can be reloaded.
+		const char *ext = name + len - 3;
+		if (_stricmp(ext, "tga") && _stricmp(ext, "pim") && _stricmp(ext, "pwm"))
+			continue;
+
+		// Asset filenames include the watched directory.
+		string filename = directory + '\\' + name;
+		bool queued = false;
+		const unsigned int NumChanged = (unsigned int)vChanged.size();
+		for (unsigned int i = 0; i < NumChanged && !queued; ++i)
+			queued = !_stricmp(vChanged[i].c_str(), filename.c_str());
+		if (!queued)
+			vChanged.push_back(filename);
+	}
+	while (pInfo->NextEntryOffset);
+}
+
+// Decode every queued file and hand the results to the renderer.
+void PI_AssetWatcher::DecodeChangedFiles(void)
+{
+	PI_Logger &logger = PI_Logger::GetInstance();
+
+	const unsigned int NumChanged = (unsigned int)vChanged.size();
+	for (unsigned int i = 0; i < NumChanged; ++i)
+	{
+		PI_ReloadedAsset *pReload = new PI_ReloadedAsset;
+		pReload->filename = vChanged[i];
+
+		bool decoded;
+		const char *ext = vChanged[i].c_str() + vChanged[i].length() - 3;
+		if (!_stricmp(ext, "tga"))
+		{
+			pReload->type = PI_ReloadedAsset::Texture;
+			decoded = PI_LoadTargaData(vChanged[i].c_str(), pReload->image);
+		}
+		else
+		{
+			pReload->type = PI_ReloadedAsset::Mesh;
+			decoded = PI_LoadPIMData(vChanged[i].c_str(), pReload->mesh);
+		}
+
+		if (!decoded)
+		{
+			logger << "PI_AssetWatcher failed to decode " << vChanged[i] << ", ignoring the change.\n";
+			delete pReload;
+			continue;
+		}
+
+		EnterCriticalSection(&cs);
+		vpReloads.push_back(pReload);
+		LeaveCriticalSection(&cs);
+	}
+	vChanged.clear();
+}
@@ -0,0 +1,165 @@
+// PigIron texture atlas implementation.
+
+#include <algorithm>
+using std::sort;
+
+#include "PI_Atlas.h"
+
+// Queue an image for packing.
+//
+// In:		name			What the image will be found by.
+//			image			The image. It's copied.
+//
+// Returns					False if the image is too large to share a page.
+bool PI_AtlasBuilder::Add(const char *name, const PI_Image &image)
+{
+	if (!image.width || !image.height || image.width + Padding * 2 > MaxPageSize || image.height + Padding * 2 > MaxPageSize)
+		return false;
+
+	PI_Placement placement;
+	placement.name = name;
+	placement.page = 0;
+	placement.x = placement.y = 0;
+	placement.width = image.width;
+	placement.height = image.height;
+	vPlacements.push_back(placement);
+	vImages.push_back(image);
+	numPages = 0;
+	return true;
+}
+
+// Order images for shelf packing: tallest first, then widest, then by name so packing is repeatable.
+struct PI_PackOrder
+{
+	const vector<PI_AtlasBuilder::PI_Placement> *pvPlacements;
+
+	bool operator()(unsigned int left, unsigned int right) const
+	{
+		const PI_AtlasBuilder::PI_Placement &l = (*pvPlacements)[left], &r = (*pvPlacements)[right];
+		if (l.height != r.height)
+			return l.height > r.height;
+		if (l.width != r.width)
+			return l.width > r.width;
+		return l.name < r.name;
+	}
+};
+
+// Shelf pack everything onto pages of one size.
+//
+// Returns					How many pages it took.
+unsigned int PI_AtlasBuilder::PackPages(unsigned short size)
+{
+	const unsigned int NumImages = (unsigned int)vPlacements.size();
+	vector<unsigned int> vOrder(NumImages);
+	for (unsigned int i = 0; i < NumImages; ++i)
+		vOrder[i] = i;
+	PI_PackOrder order = { &vPlacements };
+	sort(vOrder.begin(), vOrder.end(), order);
+
+	// Fill each shelf left to right, and start a new one above it when it's full.
+	unsigned int page = 0, penX = 0, shelfY = 0, shelfHeight = 0;
+	for (unsigned int i = 0; i < NumImages; ++i)
+	{
+		PI_Placement &p = vPlacements[vOrder[i]];
+		const unsigned int PaddedWidth = p.width + Padding * 2, PaddedHeight = p.height + Padding * 2;
+		if (penX + PaddedWidth > size)
+			penX = 0, shelfY += shelfHeight, shelfHeight = 0;
+		if (shelfY + PaddedHeight > size)
+			++page, penX = shelfY = shelfHeight = 0;
+
+		p.page = page;
+		p.x = (unsigned short)(penX + Padding);
+		p.y = (unsigned short)(shelfY + Padding);
+		penX += PaddedWidth;
+		if (PaddedHeight > shelfHeight)
+			shelfHeight = PaddedHeight;
+	}
+	return NumImages ? page + 1 : 0;
+}
+
+// Place every queued image. Pages start as small as the largest image allows,
+// and double until everything fits on one, or MaxPageSize is reached.
+void PI_AtlasBuilder::Pack(void)
+{
+	unsigned int largest = 1;
+	const unsigned int NumImages = (unsigned int)vPlacements.size();
+	for (unsigned int i = 0; i < NumImages; ++i)
+	{
+		if (vPlacements[i].width + Padding * 2u > largest)
+			largest = vPlacements[i].width + Padding * 2u;
+		if (vPlacements[i].height + Padding * 2u > largest)
+			largest = vPlacements[i].height + Padding * 2u;
+	}
+
+	pageSize = 1;
+	while (pageSize < largest)
+		pageSize <<= 1;
+	while ((numPages = PackPages(pageSize)) > 1 && pageSize < MaxPageSize)
+		pageSize <<= 1;
+
+	// Texture coordinates run from the image's outer edges.
+	const float InvSize = 1.0f / pageSize;
+	for (unsigned int i = 0; i < NumImages; ++i)
+	{
+		PI_Placement &p = vPlacements[i];
+		p.region.uOrigin = p.x * InvSize;
+		p.region.vOrigin = p.y * InvSize;
+		p.region.uWidth = p.width * InvSize;
+		p.region.vHeight = p.height * InvSize;
+	}
+}
+
+// Convert an image to 32 bits, with its edges copied out into the padding.
+//
+// Out:		out				The padded image, in GL_BGRA_EXT.
+void PI_AtlasBuilder::PadImage(const PI_Image &image, PI_Image &out)
+{
+	out.width = image.width + Padding * 2;
+	out.height = image.height + Padding * 2;
+	out.components = 4;
+	out.format = GL_BGRA_EXT;
+	out.pixels.resize(out.width * out.height * 4);
+
+	// Each padded texel takes the nearest texel of the image. 24-bit images are opaque.
+	const unsigned int Components = image.components;
+	for (unsigned int y = 0; y < out.height; ++y)
+	{
+		const int SrcY = (int)y - Padding < 0 ? 0 : (int)y - Padding >= image.height ? image.height - 1 : (int)y - Padding;
+		unsigned char *pDest = &out.pixels[y * out.width * 4];
+		for (unsigned int x = 0; x < out.width; ++x, pDest += 4)
+		{
+			const int SrcX = (int)x - Padding < 0 ? 0 : (int)x - Padding >= image.width ? image.width - 1 : (int)x - Padding;
+			const unsigned char *pSrc = &image.pixels[(SrcY * image.width + SrcX) * Components];
+			pDest[0] = pSrc[0], pDest[1] = pSrc[1], pDest[2] = pSrc[2];
+			pDest[3] = Components == 4 ? pSrc[3] : 255;
+		}
+	}
+}
+
+// Draw every image on a page into one 32-bit image. Rows are copied in the order
+// they're stored, so each image keeps its own orientation.
+//
+// In:		page			Which page.
+//
+// Out:		out				The page, in GL_BGRA_EXT.
+void PI_AtlasBuilder::BuildPage(unsigned int page, PI_Image &out) const
+{
+	out.width = out.height = pageSize;
+	out.components = 4;
+	out.format = GL_BGRA_EXT;
+	out.pixels.assign(pageSize * pageSize * 4, 0);
+
+	PI_Image padded;
+	const unsigned int NumImages = (unsigned int)vPlacements.size();
+	for (unsigned int i = 0; i < NumImages; ++i)
+	{
+		const PI_Placement &p = vPlacements[i];
+		if (p.page != page)
+			continue;
+
+		PadImage(vImages[i], padded);
+		const unsigned int RowBytes = padded.width * 4u;
+		for (unsigned int y = 0; y < padded.height; ++y)
+			memcpy(&out.pixels[((p.y - Padding + y) * pageSize + p.x - Padding) * 4], &padded.pixels[y * RowBytes], RowBytes);
+	}
+}
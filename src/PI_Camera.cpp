@@ -2,6 +2,8 @@
 //
 // Copyright Evan Beeton 6/4/2005
 
+#include <cmath>
+
 #include "PI_Camera.h"
 
 // "Zoom" the camera by translating along it's at-vector.
@@ -30,10 +32,89 @@ void PI_Camera::LookAt(const PI_Vec3 &where)
 	up = camX.Cross(at);
 }
 
-bool PI_Camera::SphereInFrustum(const PI_Vec3 & where, float radius)
+// Set up the projection, as gluPerspective would.
+//
+// In:		fovY			The vertical field of view. (degrees)
+//			aspect			The viewport's width over its height.
+//			zNear, zFar		The distances to the clip planes.
+void PI_Camera::SetPerspective(float fovY, float aspect, float zNear, float zFar)
+{
+	const float F = 1.0f / tanf(fovY * 3.14159265f / 360.0f);
+	projectionMat.SetIdentity();
+	projectionMat.mat[0] = F / aspect;
+	projectionMat.mat[5] = F;
+	projectionMat.mat[10] = (zFar + zNear) / (zNear - zFar);
+	projectionMat.mat[11] = -1;
+	projectionMat.mat[14] = 2 * zFar * zNear / (zNear - zFar);
+	projectionMat.mat[15] = 0;
+}
+
+// Set up the projection, as glOrtho would with the view centered.
+//
+// In:		halfWidth, halfHeight	Half the size of the view volume.
+//			zNear, zFar				The distances to the clip planes.
+void PI_Camera::SetOrthographic(float halfWidth, float halfHeight, float zNear, float zFar)
+{
+	projectionMat.SetIdentity();
+	projectionMat.mat[0] = 1.0f / halfWidth;
+	projectionMat.mat[5] = 1.0f / halfHeight;
+	projectionMat.mat[10] = 2.0f / (zNear - zFar);
+	projectionMat.mat[14] = (zFar + zNear) / (zNear - zFar);
+}
+
+// Rebuild the view matrix and the frustum planes on the CPU.
+// Must be called after the camera moves, and before SphereInFrustum.
+void PI_Camera::UpdateFrustum(void)
+{
+	// The same matrix gluLookAt builds.
+	PI_Vec3 at = target - pos;
+	at.Normalize();
+	PI_Vec3 side = at.Cross(up);
+	side.Normalize();
+	const PI_Vec3 camUp = side.Cross(at);
+
+	viewMat.SetIdentity();
+	viewMat.mat[0] = side.x, viewMat.mat[4] = side.y, viewMat.mat[8] = side.z;
+	viewMat.mat[1] = camUp.x, viewMat.mat[5] = camUp.y, viewMat.mat[9] = camUp.z;
+	viewMat.mat[2] = -at.x, viewMat.mat[6] = -at.y, viewMat.mat[10] = -at.z;
+	viewMat.mat[12] = -side.Dot(pos);
+	viewMat.mat[13] = -camUp.Dot(pos);
+	viewMat.mat[14] = at.Dot(pos);
+
+	// Combine the view and projection matricies, and use the result to extract the frustum planes.
+	const PI_Mat44 WorldSpaceMat = projectionMat * viewMat;
+	const float *m = WorldSpaceMat.mat;
+	frustumPlanes[PlaneLeft].Set(PI_Vec3(m[3] + m[0], m[7] + m[4], m[11] + m[8]), m[15] + m[12]);
+	frustumPlanes[PlaneRight].Set(PI_Vec3(m[3] - m[0], m[7] - m[4], m[11] - m[8]), m[15] - m[12]);
+	frustumPlanes[PlaneBottom].Set(PI_Vec3(m[3] + m[1], m[7] + m[5], m[11] + m[9]), m[15] + m[13]);
+	frustumPlanes[PlaneTop].Set(PI_Vec3(m[3] - m[1], m[7] - m[5], m[11] - m[9]), m[15] - m[13]);
+	frustumPlanes[PlaneNear].Set(PI_Vec3(m[3] + m[2], m[7] + m[6], m[11] + m[10]), m[15] + m[14]);
+	frustumPlanes[PlaneFar].Set(PI_Vec3(m[3] - m[2], m[7] - m[6], m[11] - m[10]), m[15] - m[14]);
+
+	for (int i = 0; i < 6; ++i)
+		frustumPlanes[i].Normalize();
+}
+
+bool PI_Camera::SphereInFrustum(const PI_Vec3 & where, float radius) const
 {
 	for (unsigned char i = 0; i < 6; ++i)
 		if (frustumPlanes[i].DotHomogenous(where) <= -radius)
 			return false;
 	return true;
+}
+
+// Does a sphere touch the frustum anywhere along a straight sweep?
+//
+// In:		where, radius	The sphere at the start of the sweep.
+//			sweep			How far it moves, and in what direction.
+//
+// Returns					False only if the swept sphere is entirely outside the frustum.
+bool PI_Camera::SweptSphereInFrustum(const PI_Vec3 &where, float radius, const PI_Vec3 &sweep) const
+{
+	// The sweep is convex, so it's outside if both ends are outside the same plane.
+	const PI_Vec3 End = where + sweep;
+	for (unsigned char i = 0; i < 6; ++i)
+		if (frustumPlanes[i].DotHomogenous(where) <= -radius && frustumPlanes[i].DotHomogenous(End) <= -radius)
+			return false;
+	return true;
 }
\ No newline at end of file
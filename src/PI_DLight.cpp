@@ -2,9 +2,13 @@
 //
 // Copyright Evan Beeton 9/24/2005
 
+#include <cstring>
+
 #include "PI_DLight.h"
 
 const float PI_DLight::ShadowLength = 20.0f;
+const float PI_DLight::SilhouetteTolerance = 0.99995f;
+const unsigned int PI_DLight::ShadowCacheFrames = 60;
 
 void PI_DLight::SetDirection(const PI_Vec3 &direction)
 {
@@ -18,49 +22,145 @@ void PI_DLight::SetDirection(float x, float y, float z)
 	dir.Normalize();
 }
 
-void PI_DLight::BuildShadowVolume(const vector<PI_Edge> &vEdges, const PI_Mat44 &worldXform)
+// Find the edges between faces towards the light and faces away from it.
+//
+// In:		vEdges			The caster's edges.
+//			lightDirModel	The light direction in model space.
+//
+// Out:		vSilhouette		Edge endpoints, in pairs, wound to face out of the volume.
+void PI_DLight::FindSilhouette(const vector<PI_Edge> &vEdges, const PI_Vec3 &lightDirModel, vector<PI_Vec3> &vSilhouette)
 {
-	// Look for all silhouette edges.
-	PI_Quad qTemp;
-
-	PI_Vec3 lightDirTR = dir;
-	lightDirTR.TransposedRotate(worldXform);
+	vSilhouette.clear();
 	const unsigned int NumEdges = (unsigned int)vEdges.size();
 	for (unsigned int i = 0; i < NumEdges; i++)
 	{
-		if (lightDirTR.Dot(vEdges[i].faceNormals[0]) > 0 && lightDirTR.Dot(vEdges[i].faceNormals[1]) < 0)
+		const float Facing0 = lightDirModel.Dot(vEdges[i].faceNormals[0]), Facing1 = lightDirModel.Dot(vEdges[i].faceNormals[1]);
+		if (Facing0 > 0 && Facing1 < 0)
 		{
 			// Face 0 is towards the light and Face 1 is away
-			qTemp.verts[0] = worldXform * vEdges[i].verts[1];
-			qTemp.verts[1] = worldXform * vEdges[i].verts[0];
-			qTemp.verts[2] = qTemp.verts[1] - dir * ShadowLength;
-			qTemp.verts[3] = qTemp.verts[0] - dir * ShadowLength;
-
-			// Add the quad to the light's shadow volume.
-			if (shadowQuadCount < vShadowVolume.size())
-				vShadowVolume[shadowQuadCount++] = qTemp;
-			else
-			{
-				vShadowVolume.push_back(qTemp);
-				++shadowQuadCount;
-			}
+			vSilhouette.push_back(vEdges[i].verts[1]);
+			vSilhouette.push_back(vEdges[i].verts[0]);
 		}
-		else if (lightDirTR.Dot(vEdges[i].faceNormals[0]) < 0 && lightDirTR.Dot(vEdges[i].faceNormals[1]) > 0)
+		else if (Facing0 < 0 && Facing1 > 0)
 		{
 			// Face 0 is away from the light and Face 1 is towards
-			qTemp.verts[0] = worldXform * vEdges[i].verts[0];
-			qTemp.verts[1] = worldXform * vEdges[i].verts[1];
-			qTemp.verts[2] = qTemp.verts[1] - dir * ShadowLength;
-			qTemp.verts[3] = qTemp.verts[0] - dir * ShadowLength;
-
-			// Add the quad to the light's shadow volume.
-			if (shadowQuadCount < vShadowVolume.size())
-				vShadowVolume[shadowQuadCount++] = qTemp;
+			vSilhouette.push_back(vEdges[i].verts[0]);
+			vSilhouette.push_back(vEdges[i].verts[1]);
+		}
+	}
+}
+
+// Grow a bounding box to hold a point.
+static void GrowBounds(const PI_Vec3 &p, PI_Vec3 &aabbMin, PI_Vec3 &aabbMax)
+{
+	if (p.x < aabbMin.x) aabbMin.x = p.x;
+	if (p.y < aabbMin.y) aabbMin.y = p.y;
+	if (p.z < aabbMin.z) aabbMin.z = p.z;
+	if (p.x > aabbMax.x) aabbMax.x = p.x;
+	if (p.y > aabbMax.y) aabbMax.y = p.y;
+	if (p.z > aabbMax.z) aabbMax.z = p.z;
+}
+
+// Add a quad to the shadow volume.
+void PI_DLight::AddShadowQuad(const PI_Quad &quad)
+{
+	if (shadowQuadCount < vShadowVolume.size())
+		vShadowVolume[shadowQuadCount++] = quad;
+	else
+	{
+		vShadowVolume.push_back(quad);
+		++shadowQuadCount;
+	}
+}
+
+// Add a caster's shadow to the shadow volume.
+//
+// In:		vEdges			The caster's edges.
+//			worldXform		Where the caster is.
+//			pCaster			Whatever owns the caster, if it's the same from frame to frame.
+void PI_DLight::BuildShadowVolume(const vector<PI_Edge> &vEdges, const PI_Mat44 &worldXform, const void *pCaster)
+{
+	PI_Vec3 lightDirTR = dir;
+	lightDirTR.TransposedRotate(worldXform);
+
+	// Casters nobody owns are built from scratch every time.
+	PI_ShadowCache scratch, *pCache = &scratch;
+	bool rebuildQuads = true;
+	if (pCaster)
+	{
+		const ShadowKey Key(pCaster, &vEdges);
+		map<ShadowKey, PI_ShadowCache>::iterator iter = shadowCache.find(Key);
+		if (iter != shadowCache.end())
+		{
+			pCache = &iter->second;
+
+			// The silhouette holds until the light turns far enough relative to the caster.
+			if (lightDirTR.Dot(pCache->lightDirModel) < SilhouetteTolerance)
+				FindSilhouette(vEdges, pCache->lightDirModel = lightDirTR, pCache->vSilhouette);
 			else
-			{
-				vShadowVolume.push_back(qTemp);
-				++shadowQuadCount;
-			}
+				rebuildQuads = memcmp((const float *)worldXform, (const float *)pCache->worldXform, sizeof(float) * 16) != 0 ||
+							   pCache->lightDir.x != dir.x || pCache->lightDir.y != dir.y || pCache->lightDir.z != dir.z;
 		}
+		else
+		{
+			pCache = &shadowCache[Key];
+			FindSilhouette(vEdges, pCache->lightDirModel = lightDirTR, pCache->vSilhouette);
+		}
+		pCache->lastUsed = frameCount;
 	}
-}
\ No newline at end of file
+	else
+		FindSilhouette(vEdges, lightDirTR, scratch.vSilhouette);
+
+	// Extrude the silhouette away from the light, in world space.
+	if (rebuildQuads)
+	{
+		pCache->worldXform = worldXform;
+		pCache->lightDir = dir;
+
+		const PI_Vec3 Extrusion = dir * ShadowLength;
+		const unsigned int NumQuads = (unsigned int)pCache->vSilhouette.size() / 2;
+		pCache->vQuads.resize(NumQuads);
+		for (unsigned int i = 0; i < NumQuads; i++)
+		{
+			PI_Quad &quad = pCache->vQuads[i];
+			quad.verts[0] = worldXform * pCache->vSilhouette[i * 2];
+			quad.verts[1] = worldXform * pCache->vSilhouette[i * 2 + 1];
+			quad.verts[2] = quad.verts[1] - Extrusion;
+			quad.verts[3] = quad.verts[0] - Extrusion;
+
+			// Grow the bounds the renderer limits drawing to.
+			if (!i)
+				pCache->aabbMin = pCache->aabbMax = quad.verts[0];
+			for (int v = 0; v < 4; v++)
+				GrowBounds(quad.verts[v], pCache->aabbMin, pCache->aabbMax);
+		}
+	}
+
+	// Add the quads to the light's shadow volume.
+	const unsigned int NumQuads = (unsigned int)pCache->vQuads.size();
+	if (!NumQuads)
+		return;
+
+	PI_ShadowCaster caster;
+	caster.firstQuad = shadowQuadCount;
+	caster.numQuads = NumQuads;
+	caster.aabbMin = pCache->aabbMin;
+	caster.aabbMax = pCache->aabbMax;
+	vShadowCasters.push_back(caster);
+
+	for (unsigned int i = 0; i < NumQuads; i++)
+		AddShadowQuad(pCache->vQuads[i]);
+}
+
+// Start a new frame's shadow volume, and drop the shadows of casters that have gone undrawn.
+void PI_DLight::ClearShadowVolume(void)
+{
+	shadowQuadCount = 0;
+	vShadowCasters.clear();
+	++frameCount;
+	for (map<ShadowKey, PI_ShadowCache>::iterator iter = shadowCache.begin(); iter != shadowCache.end(); )
+		if (frameCount - iter->second.lastUsed > ShadowCacheFrames)
+			shadowCache.erase(iter++);
+		else
+			++iter;
+}
@@ -0,0 +1,144 @@
+// PigIron frame pacing implementation.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <mmsystem.h>
+#include <cmath>
+
+#include "PI_FramePacer.h"
+#include "PI_Profile.h"
+#include "PI_Logger.h"
+
+// Older SDKs don't know about high resolution timers (Windows 10 1803 and later).
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+	#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+typedef HANDLE (WINAPI *PFNCREATEWAITABLETIMEREXWPROC)(LPSECURITY_ATTRIBUTES pAttributes, LPCWSTR pName, DWORD flags, DWORD access);
+
+// High resolution timers wake within a fraction of a millisecond. Ordinary ones
+// can be a whole system timer tick late, even with the period raised.
+const double PI_FramePacer::HighResolutionSlack = 0.0005;
+const double PI_FramePacer::LowResolutionSlack = 0.002;
+
+// Start pacing.
+//
+// In:		targetRate		Frames per second to hold to. 0 runs flat out.
+//
+// Returns					True if frames can be waited for without spinning.
+bool PI_FramePacer::Init(double targetRate)
+{
+	Shutdown();
+	frameSeconds = targetRate > 0 ? 1.0 / targetRate : 0;
+	if (!frameSeconds)
+		return true;
+
+	// Look the high resolution timer up, as it's missing from older versions of Windows.
+	PFNCREATEWAITABLETIMEREXWPROC pCreateTimerEx =
+		(PFNCREATEWAITABLETIMEREXWPROC)GetProcAddress(GetModuleHandleA("kernel32.dll"), "CreateWaitableTimerExW");
+	if (pCreateTimerEx)
+		hTimer = pCreateTimerEx(0, 0, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	highResolution = hTimer != 0;
+
+	// An ordinary timer is only as fine as the system timer period, so ask for a millisecond.
+	if (!hTimer)
+	{
+		periodRaised = timeBeginPeriod(1) == TIMERR_NOERROR;
+		hTimer = CreateWaitableTimer(0, FALSE, 0);
+	}
+
+	PI_Logger &logger = PI_Logger::GetInstance();
+	if (!hTimer)
+	{
+		logger << "PI_FramePacer couldn't create a timer - frames will be paced with Sleep.\n";
+		return false;
+	}
+	logger << "Pacing frames to " << targetRate << " FPS with " << (highResolution ? "a high" : "an ordinary") << " resolution timer.\n";
+	return true;
+}
+
+// Log what was achieved, and release the timer.
+void PI_FramePacer::Shutdown(void)
+{
+	if (numFrames > 1)
+		PI_Logger::GetInstance() << "Paced " << numFrames << " frames to " << GetTargetRate() << " FPS. Frame ms: mean "
+								 << meanSeconds * 1000.0 << ", std dev " << sqrt(GetFrameSecondsVariance()) * 1000.0
+								 << ", max " << maxSeconds * 1000.0 << ", " << numLateFrames << " late.\n";
+
+	if (hTimer)
+		CloseHandle(hTimer);
+	if (periodRaised)
+		timeEndPeriod(1);
+	hTimer = 0;
+	highResolution = periodRaised = false;
+
+	lastFrame = nextFrame = 0;
+	numFrames = numLateFrames = 0;
+	meanSeconds = sumSquares = maxSeconds = 0;
+}
+
+// Wait until the next frame is due, and start it.
+// Frames that are already late aren't caught up on - the schedule starts again from now.
+//
+// Returns					Seconds since the last frame started.
+double PI_FramePacer::WaitForNextFrame(void)
+{
+	double now = PI_GetSeconds();
+	if (!lastFrame)
+	{
+		lastFrame = nextFrame = now;
+		return 0;
+	}
+
+	if (frameSeconds)
+	{
+		nextFrame += frameSeconds;
+		if (nextFrame > now)
+		{
+			WaitUntil(nextFrame);
+			now = PI_GetSeconds();
+		}
+		else
+			nextFrame = now;
+	}
+
+	const double Elapsed = now - lastFrame;
+	lastFrame = now;
+	AddFrame(Elapsed);
+	return Elapsed;
+}
+
+// Sleep until a time on the high resolution clock.
+// The timer is set to go off a little early, and the rest is spun out.
+void PI_FramePacer::WaitUntil(double seconds) const
+{
+	const double Slack = highResolution ? HighResolutionSlack : LowResolutionSlack,
+				 SleepSeconds = seconds - PI_GetSeconds() - Slack;
+	if (SleepSeconds > 0)
+	{
+		// Relative due times are negative, in 100 nanosecond units.
+		LARGE_INTEGER due;
+		due.QuadPart = -(LONGLONG)(SleepSeconds * 10000000.0);
+		if (hTimer && SetWaitableTimer(hTimer, &due, 0, 0, 0, FALSE))
+			WaitForSingleObject(hTimer, INFINITE);
+		else
+			Sleep((DWORD)(SleepSeconds * 1000.0));
+	}
+
+	while (PI_GetSeconds() < seconds)
+		YieldProcessor();
+}
+
+// Fold a frame's length into the statistics.
+void PI_FramePacer::AddFrame(double seconds)
+{
+	++numFrames;
+	const double Delta = seconds - meanSeconds;
+	meanSeconds += Delta / numFrames;
+	sumSquares += Delta * (seconds - meanSeconds);
+
+	if (seconds > maxSeconds)
+		maxSeconds = seconds;
+	if (frameSeconds && seconds > frameSeconds * 1.5)
+		++numLateFrames;
+}
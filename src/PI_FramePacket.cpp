@@ -0,0 +1,53 @@
+// PigIron frame packet implementation.
+
+#include "PI_FramePacket.h"
+
+PI_FrameQueue::PI_FrameQueue(void) : writeSlot(0), readSlot(1), latest(2)
+{
+	hPublished = CreateEvent(0, FALSE, FALSE, 0);
+}
+
+PI_FrameQueue::~PI_FrameQueue(void)
+{
+	if (hPublished)
+		CloseHandle(hPublished);
+}
+
+// Publish the packet being recorded as the newest frame, and start recording into an empty one.
+// Game thread only. A newer packet replaces one the render thread hasn't taken yet.
+void PI_FrameQueue::Publish(void)
+{
+	// Whatever was in the middle comes back - either a packet that's been drawn,
+	// or one that's been superseded before it could be.
+	const LONG Previous = InterlockedExchange(&latest, writeSlot | FreshBit);
+	writeSlot = Previous & SlotMask;
+	packets[writeSlot].Clear();
+
+	if (hPublished)
+		SetEvent(hPublished);
+}
+
+// Take the newest published packet, if it hasn't been taken already. Render thread only.
+//
+// Returns					The packet, which stays put until the next call, or 0 if nothing new was published.
+PI_FramePacket *PI_FrameQueue::AcquireLatest(void)
+{
+	if (!(latest & FreshBit))
+		return 0;
+
+	// Hand back the packet that was drawn last in exchange.
+	const LONG Newest = InterlockedExchange(&latest, readSlot);
+	readSlot = Newest & SlotMask;
+	return &packets[readSlot];
+}
+
+// Wait until the game publishes a packet, or the time runs out.
+//
+// In:		milliseconds	The longest to wait.
+void PI_FrameQueue::WaitForPublish(DWORD milliseconds) const
+{
+	if (hPublished)
+		WaitForSingleObject(hPublished, milliseconds);
+	else
+		Sleep(milliseconds);
+}
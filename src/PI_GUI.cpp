@@ -4,38 +4,74 @@
 
 #include <fstream>
 using std::ifstream;
+using std::ofstream;
+using std::ios_base;
+#include <algorithm>
+using std::sort;
+using std::lower_bound;
 
 #include "PI_GUI.h"
 #include "PI_Render.h"
+#include "PI_Asset.h"
+#include "PI_Logger.h"
 
 PI_GUI PI_GUI::m_instance;
 
-void PI_GUIObject::Draw(void) const
+// The start of a cooked font. The ranges, glyphs and kerning pairs follow it, in that order.
+struct PI_CookedFontHeader
 {
-	glBegin(GL_QUADS);
+	char magic[4];					// "PIF1"
+	unsigned int numRanges, numGlyphs, numKerning;
+};
 
-	glColor4fv(rgba);
+// Decode the next character of a UTF-8 string.
+//
+// In:		pCur			The character's first byte. Advanced past the character.
+//			pEnd			The end of the string.
+//
+// Returns					The code point. Malformed characters come back as U+FFFD.
+static unsigned int DecodeUTF8(const unsigned char *&pCur, const unsigned char *pEnd)
+{
+	const unsigned char Lead = *pCur++;
+	if (Lead < 0x80)
+		return Lead;
+
+	unsigned int numTrail, code;
+	if ((Lead & 0xE0) == 0xC0)
+		numTrail = 1, code = Lead & 0x1F;
+	else if ((Lead & 0xF0) == 0xE0)
+		numTrail = 2, code = Lead & 0x0F;
+	else if ((Lead & 0xF8) == 0xF0)
+		numTrail = 3, code = Lead & 0x07;
+	else
+		return 0xFFFD;
 
-	// Upper Left.
-	glTexCoord2i(0,1);
-	glVertex2f(pos.x - halfWidth, pos.y + halfWidth);
-	
-	// Lower Left.
-	glTexCoord2i(0,0);
-	glVertex2f(pos.x - halfWidth, pos.y - halfWidth);
-	
-	// Lower Right.
-	glTexCoord2i(1,0);
-	glVertex2f(pos.x + halfWidth, pos.y - halfWidth);
-	
-	// Upper Right.
-	glTexCoord2i(1,1);
-	glVertex2f(pos.x + halfWidth, pos.y + halfWidth);
+	for (unsigned int i = 0; i < numTrail; ++i)
+	{
+		if (pCur == pEnd || (*pCur & 0xC0) != 0x80)
+			return 0xFFFD;
+		code = (code << 6) | (*pCur++ & 0x3F);
+	}
+	return code;
+}
 
-	glEnd();
+void PI_GUIObject::AddCorners(vector<PI_QuadVertex> &vCorners) const
+{
+	const unsigned int First = (unsigned int)vCorners.size();
+	vCorners.resize(First + 4);
+	PI_QuadVertex *pCorners = &vCorners[First];
+	for (int c = 0; c < 4; ++c)
+		pCorners[c].SetColor(rgba);
+
+	// Upper Left, Lower Left, Lower Right, Upper Right.
+	const float Left = texRegion.U(0), Right = texRegion.U(1), Bottom = texRegion.V(0), Top = texRegion.V(1);
+	pCorners[0].Set(pos.x - halfWidth, pos.y + halfWidth, 0, Left, Top);
+	pCorners[1].Set(pos.x - halfWidth, pos.y - halfWidth, 0, Left, Bottom);
+	pCorners[2].Set(pos.x + halfWidth, pos.y - halfWidth, 0, Right, Bottom);
+	pCorners[3].Set(pos.x + halfWidth, pos.y + halfWidth, 0, Right, Top);
 }
 
-PI_GUI::PI_GUI(void) : renderer(PI_Render::GetInstance()), fontTexName(0), numStrings(0), numGUIObjects(0)
+PI_GUI::PI_GUI(void) : renderer(PI_Render::GetInstance()), fontTexName(0)
 {
 
 }
@@ -50,80 +86,91 @@ void PI_GUI::Shutdown(void)
 
 }
 
-void PI_GUI::RenderGUI(void) const
+// Draw the waiting quads in one call, and empty the list.
+//
+// In:		texName			The texture they're all drawn with.
+//			backend			What draws them.
+void PI_GUI::FlushQuads(unsigned int texName, PI_RenderBackend &backend) const
 {
-	// Preserve the current matricies and switch to an ortho view that's the same dimensions as the actual window.
-	glMatrixMode(GL_PROJECTION);
-	glPushMatrix();
-	glLoadIdentity();
-	gluOrtho2D(0, renderer.GetViewportWidth(), 0, renderer.GetViewportHeight());
+	if (vQuadCorners.empty())
+		return;
 
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
-	glLoadIdentity();
+	renderer.BindTexture2D(texName);
+	backend.DrawQuads(&vQuadCorners[0], (unsigned int)vQuadCorners.size() / 4);
+	vQuadCorners.clear();
+}
 
-	// Draw all GUI objects.
-	unsigned int i = 0;
-	for ( ; i < numGUIObjects; i++)
+// Draw a frame's GUI objects and strings. Quads are gathered into one array per texture,
+// so runs of objects that share a texture cost one draw, and all the text costs one more.
+void PI_GUI::RenderGUI(const PI_GUIFrame &frame, PI_RenderBackend &backend) const
+{
+	// Switch to an ortho view that's the same dimensions as the actual window.
+	backend.BeginOverlay(renderer.GetViewportWidth(), renderer.GetViewportHeight());
+
+	// Draw all GUI objects, in order, drawing what's gathered whenever the texture changes.
+	unsigned int curTexName = 0;
+	for (unsigned int i = 0; i < frame.numObjects; i++)
 	{
-		renderer.BindTexture2D(vpGUIObjects[i]->texName);
-		vpGUIObjects[i]->Draw();
+		const PI_GUIObject &Obj = frame.vObjects[i];
+		if (Obj.texName != curTexName)
+		{
+			FlushQuads(curTexName, backend);
+			curTexName = Obj.texName;
+		}
+		Obj.AddCorners(vQuadCorners);
 	}
-	numGUIObjects = 0;
 
-	renderer.BindTexture2D(fontTexName);
+	// Objects packed onto the font's page go out with the text.
+	if (curTexName != fontTexName)
+		FlushQuads(curTexName, backend);
 
-	// Draw all the strings.
+	// Draw all the strings. Each glyph's corners are laid out here, so the backend only sees quads.
 	const PI_String *pCurString;
 	const PI_Glyph *pGlyph;
-	for (unsigned int curStr = 0; curStr < numStrings; ++curStr)
+	PI_QuadVertex corners[4];
+	for (unsigned int curStr = 0; curStr < frame.numStrings; ++curStr)
 	{
 		// Is this faster than dereferencing the vector each time?
-		pCurString = &vStrings[curStr];
-		
-		glPushMatrix();
-		glTranslatef(pCurString->pos.x, pCurString->pos.y, 0);
-		glColor4fv(pCurString->rgba);
-
-		const unsigned int StrLen = (unsigned int)pCurString->str.size();
-		for (i = 0; i < StrLen; i++)
+		pCurString = &frame.vStrings[curStr];
+		const float Size = pCurString->size;
+		for (int c = 0; c < 4; ++c)
+			corners[c].SetColor(pCurString->rgba);
+
+		// Strings are UTF-8, and characters the font doesn't have are skipped.
+		const unsigned char *pCur = (const unsigned char *)pCurString->str.c_str(),
+							*pEnd = pCur + pCurString->str.size();
+		unsigned int prevCode = 0;
+		float penX = pCurString->pos.x;
+		while (pCur < pEnd)
 		{
-			pGlyph = &fontGlyphs[pCurString->str[i]];
-
-			glTranslatef(0, pGlyph->offsetY * pCurString->size, 0);
-			glBegin(GL_QUADS);
-
-			// Upper Left.
-			glTexCoord2f(pGlyph->uOrigin, pGlyph->vOrigin);
-			glVertex2f(0, pGlyph->scaleY * pCurString->size);
-
-			// Lower Left.
-			glTexCoord2f(pGlyph->uOrigin, pGlyph->vOrigin + pGlyph->vHeight);
-			glVertex2f(0, 0);
-
-			// Lower Right.
-			glTexCoord2f(pGlyph->uOrigin + pGlyph->uWidth, pGlyph->vOrigin + pGlyph->vHeight);
-			glVertex2f(pGlyph->scaleX * pCurString->size, 0);	
-
-			// Upper Right.
-			glTexCoord2f(pGlyph->uOrigin + pGlyph->uWidth, pGlyph->vOrigin);
-			glVertex2f(pGlyph->scaleX * pCurString->size, pGlyph->scaleY * pCurString->size);
-				
-			glEnd();
+			const unsigned int Code = DecodeUTF8(pCur, pEnd);
+			if (!(pGlyph = FindGlyph(Code)))
+				continue;
+
+			// Pull the pair together or push it apart.
+			penX += GetKerning(prevCode, Code) * Size;
+			prevCode = Code;
+
+			const float Left = penX, Right = penX + pGlyph->scaleX * Size,
+						Bottom = pCurString->pos.y + pGlyph->offsetY * Size, Top = Bottom + pGlyph->scaleY * Size,
+						ULeft = pGlyph->uOrigin, URight = pGlyph->uOrigin + pGlyph->uWidth,
+						VTop = pGlyph->vOrigin, VBottom = pGlyph->vOrigin + pGlyph->vHeight;
+
+			// Upper Left, Lower Left, Lower Right, Upper Right.
+			corners[0].Set(Left, Top, 0, ULeft, VTop);
+			corners[1].Set(Left, Bottom, 0, ULeft, VBottom);
+			corners[2].Set(Right, Bottom, 0, URight, VBottom);
+			corners[3].Set(Right, Top, 0, URight, VTop);
+			vQuadCorners.insert(vQuadCorners.end(), corners, corners + 4);
 
 			// Advance to the next character.
-			glTranslatef(0, -pGlyph->offsetY * pCurString->size, 0);
-			glTranslatef(pGlyph->offsetX * pCurString->size, 0, 0);
+			penX += pGlyph->offsetX * Size;
 		}
-		glPopMatrix();
 	}
-	numStrings = 0;
+	FlushQuads(fontTexName, backend);
 
 	// Return the matrix stack to its original state.
-	glMatrixMode(GL_PROJECTION);
-	glPopMatrix();
-	glMatrixMode(GL_MODELVIEW);
-	glPopMatrix();
+	backend.EndOverlay();
 }
 
 bool PI_GUI::LoadFont(const char *name)
@@ -134,117 +181,270 @@ bool PI_GUI::LoadFont(const char *name)
 	if (!renderer.LoadTarga(textureName.c_str(), fontTexName, false))
 		return false;
 
-	// Load font descriptor.
-	string filename = name;
-	filename += ".fnt";
-	ifstream ifl(filename.c_str());
+	// The font is used by every level.
+	renderer.PinAsset(textureName.c_str());
+	PI_AtlasRegion region;
+	renderer.GetTextureRegion(textureName.c_str(), fontTexName, region);
+
+	// Load the glyphs, cooking the font descriptor first if it's changed.
+	const string Descriptor = string(name) + ".fnt", Cooked = string(name) + PI_FONT_EXT;
+	if (!PI_IsCookedCurrent(Descriptor.c_str(), Cooked.c_str()) || !ReadCookedFont(Cooked.c_str(), font))
+	{
+		if (!ParseFont(Descriptor.c_str(), font))
+			return false;
+		if (!WriteCookedFont(Cooked.c_str(), font))
+			PI_Logger::GetInstance() << "Failed to write the cooked font " << Cooked << ".\n";
+	}
+
+	// Glyphs are cooked against the font's own texture, which may have been packed into an atlas.
+	const unsigned int NumGlyphs = (unsigned int)font.vGlyphs.size();
+	for (unsigned int i = 0; i < NumGlyphs; ++i)
+	{
+		PI_Glyph &glyph = font.vGlyphs[i];
+		glyph.uOrigin = region.U(glyph.uOrigin), glyph.uWidth *= region.uWidth;
+		glyph.vOrigin = region.V(glyph.vOrigin), glyph.vHeight *= region.vHeight;
+	}
+	return true;
+}
+
+// Find the glyph for a code point.
+//
+// Returns					The glyph, or 0 if the font doesn't have one.
+const PI_GUI::PI_Glyph *PI_GUI::FindGlyph(unsigned int code) const
+{
+	// Binary search the ranges.
+	unsigned int first = 0, last = (unsigned int)font.vRanges.size();
+	while (first < last)
+	{
+		const unsigned int Mid = (first + last) / 2;
+		const PI_GlyphRange &range = font.vRanges[Mid];
+		if (code < range.firstCode)
+			last = Mid;
+		else if (code >= range.firstCode + range.numCodes)
+			first = Mid + 1;
+		else
+			return &font.vGlyphs[range.firstGlyph + code - range.firstCode];
+	}
+	return 0;
+}
+
+// How much closer or further apart should two characters be drawn?
+float PI_GUI::GetKerning(unsigned int first, unsigned int second) const
+{
+	PI_Kerning pair;
+	pair.first = first, pair.second = second;
+	vector<PI_Kerning>::const_iterator iter = lower_bound(font.vKerning.begin(), font.vKerning.end(), pair);
+	if (iter == font.vKerning.end() || iter->first != first || iter->second != second)
+		return 0;
+	return iter->amount;
+}
+
+// A glyph on its way from a font descriptor into a font.
+struct PI_ParsedGlyph
+{
+	unsigned int code;
+	float x, y, width, height, xOffset, yOffset, xAdvance;
+
+	bool operator<(const PI_ParsedGlyph &rhs) const { return code < rhs.code; }
+};
+
+// Read and normalize an AngelCode BMFont text descriptor.
+bool PI_GUI::ParseFont(const char *filename, PI_Font &out)
+{
+	ifstream ifl(filename);
 	if (!ifl.is_open())
 		return false;
 
-	const unsigned short BufferSize = 100;
-	char buffer[BufferSize];
-
-	// Get the point size.
-	int size;
-	while (!strstr(buffer, "size="))
-		ifl >> buffer;
-	size = atoi(buffer + strlen("size="));
-
-	// Get the font texture dimensions.
-	float fileX = 0, fileY = 0;	
-	while (!strstr(buffer, "scaleW="))
-		ifl >> buffer;
-	fileX = (float)atoi(buffer + strlen("scaleW="));	
-	ifl >> buffer;
-	fileY = (float)atoi(buffer + strlen("scaleH="));
-
-	// Load each font glyph.
-	int id;
-	PI_Glyph glyph;
-	float maxWidth = 0, maxHeight = 0, maxOffsetX = 0, maxOffsetY = 0;
-	while (ifl >> buffer)
+	// Read every line we're interested in.
+	float size = 32, fileX = 0, fileY = 0;
+	vector<PI_ParsedGlyph> vParsed;
+	vector<PI_Kerning> vKerning;
+	string line;
+	while (getline(ifl, line))
 	{
-		if (strstr(buffer, "char"))
+		const char *pLine = line.c_str(), *pField;
+		PI_ParsedGlyph glyph;
+		PI_Kerning pair;
+		if (!strncmp(pLine, "info ", 5) && (pField = strstr(pLine, " size=")))
+			size = (float)atof(pField + strlen(" size="));
+		else if (!strncmp(pLine, "common ", 7) && (pField = strstr(pLine, "scaleW=")))
 		{
-			// Character ID's aren't necessarily stored sequentially...
-			ifl >> buffer;
-			id = atoi(buffer + 3);
-
-			// Read the dimensions for the current glyph.
-			ifl >> buffer;
-			glyph.uOrigin = (float)atof(buffer + 2);
-			ifl >> buffer;
-			glyph.vOrigin = (float)atof(buffer + 2);
-			ifl >> buffer;
-			glyph.uWidth = (float)atof(buffer + strlen("width="));
-			ifl >> buffer;
-			glyph.vHeight = (float)atof(buffer + strlen("height="));
-
-			ifl >> buffer >> buffer;
-			glyph.offsetY = 32 - glyph.vHeight - (float)atof(buffer + strlen("yoffset="));
-
-			ifl >> buffer;
-			glyph.offsetX = (float)atof(buffer + strlen("xadvance="));
-
-			// Store the greatest glyph widths and heights to normalize all later.
-			if (glyph.uWidth > maxWidth)
-				maxWidth = glyph.uWidth;
-			if (glyph.vHeight > maxHeight)
-				maxHeight = glyph.vHeight;
-			if (glyph.offsetX > maxOffsetX)
-				maxOffsetX = glyph.offsetX;
-			if (glyph.offsetY > maxOffsetY)
-				maxOffsetY = glyph.offsetY;
-
-			fontGlyphs[id] = glyph;
+			fileX = (float)atof(pField + strlen("scaleW="));
+			if ((pField = strstr(pLine, "scaleH=")))
+				fileY = (float)atof(pField + strlen("scaleH="));
 		}
+		else if (sscanf_s(pLine, "char id=%u x=%f y=%f width=%f height=%f xoffset=%f yoffset=%f xadvance=%f",
+						  &glyph.code, &glyph.x, &glyph.y, &glyph.width, &glyph.height,
+						  &glyph.xOffset, &glyph.yOffset, &glyph.xAdvance) == 8)
+			vParsed.push_back(glyph);
+		else if (sscanf_s(pLine, "kerning first=%u second=%u amount=%f", &pair.first, &pair.second, &pair.amount) == 3)
+			vKerning.push_back(pair);
 	}
+	ifl.close();
+	if (vParsed.empty() || !fileX || !fileY)
+		return false;
 
-	for (unsigned int i = 0; i < 256; i++)
+	// Character ID's aren't necessarily stored sequentially...
+	sort(vParsed.begin(), vParsed.end());
+
+	// Store the greatest glyph widths and heights to normalize all later.
+	float maxWidth = 0, maxHeight = 0, maxOffsetX = 0, maxOffsetY = 0;
+	const unsigned int NumParsed = (unsigned int)vParsed.size();
+	for (unsigned int i = 0; i < NumParsed; i++)
 	{
-		// Normalize the scaling factors.
-		fontGlyphs[i].scaleX = fontGlyphs[i].uWidth / maxWidth;
-		fontGlyphs[i].scaleY = fontGlyphs[i].vHeight / maxHeight;
-		fontGlyphs[i].offsetX /= maxOffsetX;
-		fontGlyphs[i].offsetY /= maxOffsetY;
-
-
-		// Normalize the UV data.
-		fontGlyphs[i].uOrigin /= fileX;
-		fontGlyphs[i].uWidth /= fileX;
-		fontGlyphs[i].vHeight /= fileY;
-		fontGlyphs[i].vOrigin /= fileY;
+		const PI_ParsedGlyph &glyph = vParsed[i];
+		if (glyph.width > maxWidth)
+			maxWidth = glyph.width;
+		if (glyph.height > maxHeight)
+			maxHeight = glyph.height;
+		if (glyph.xAdvance > maxOffsetX)
+			maxOffsetX = glyph.xAdvance;
+		if (size - glyph.height - glyph.yOffset > maxOffsetY)
+			maxOffsetY = size - glyph.height - glyph.yOffset;
 	}
+	if (!maxWidth || !maxHeight || !maxOffsetX)
+		return false;
+	if (!maxOffsetY)
+		maxOffsetY = 1;
 
-	// Success!
-	ifl.close();
+	// Normalize each glyph, and gather runs of consecutive code points into ranges.
+	out.vRanges.clear();
+	out.vGlyphs.clear();
+	for (unsigned int i = 0; i < NumParsed; i++)
+	{
+		const PI_ParsedGlyph &parsed = vParsed[i];
+		if (i && parsed.code == vParsed[i - 1].code)
+			continue;
+
+		PI_Glyph glyph;
+		glyph.scaleX = parsed.width / maxWidth;
+		glyph.scaleY = parsed.height / maxHeight;
+		glyph.offsetX = parsed.xAdvance / maxOffsetX;
+		glyph.offsetY = (size - parsed.height - parsed.yOffset) / maxOffsetY;
+		glyph.uOrigin = parsed.x / fileX;
+		glyph.vOrigin = parsed.y / fileY;
+		glyph.uWidth = parsed.width / fileX;
+		glyph.vHeight = parsed.height / fileY;
+
+		if (out.vRanges.empty() || out.vRanges.back().firstCode + out.vRanges.back().numCodes != parsed.code)
+		{
+			PI_GlyphRange range;
+			range.firstCode = parsed.code;
+			range.numCodes = 0;
+			range.firstGlyph = (unsigned int)out.vGlyphs.size();
+			out.vRanges.push_back(range);
+		}
+		++out.vRanges.back().numCodes;
+		out.vGlyphs.push_back(glyph);
+	}
+
+	// Kerning is in pixels, like the advance.
+	const unsigned int NumKerning = (unsigned int)vKerning.size();
+	for (unsigned int i = 0; i < NumKerning; i++)
+		vKerning[i].amount /= maxOffsetX;
+	sort(vKerning.begin(), vKerning.end());
+	out.vKerning.swap(vKerning);
 	return true;
 }
 
-void PI_GUI::DrawString(const char *string, float x, float y, float size, float r, float g, float b, float a)
+// Read a cooked font in one go.
+bool PI_GUI::ReadCookedFont(const char *filename, PI_Font &out)
+{
+	vector<unsigned char> file;
+	if (!PI_ReadFile(filename, file))
+		return false;
+
+	PI_CookedFontHeader header;
+	PI_MemReader reader(file.size() ? &file[0] : 0, (unsigned int)file.size());
+	if (!reader.Read(&header, sizeof(header)) || memcmp(header.magic, "PIF1", 4) ||
+		reader.BytesLeft() != header.numRanges * sizeof(PI_GlyphRange) + header.numGlyphs * sizeof(PI_Glyph) +
+							  header.numKerning * sizeof(PI_Kerning))
+		return false;
+
+	out.vRanges.resize(header.numRanges);
+	out.vGlyphs.resize(header.numGlyphs);
+	out.vKerning.resize(header.numKerning);
+	if (header.numRanges)
+		reader.Read(&out.vRanges[0], header.numRanges * sizeof(PI_GlyphRange));
+	if (header.numGlyphs)
+		reader.Read(&out.vGlyphs[0], header.numGlyphs * sizeof(PI_Glyph));
+	if (header.numKerning)
+		reader.Read(&out.vKerning[0], header.numKerning * sizeof(PI_Kerning));
+
+	// Don't trust the ranges to stay inside the glyphs.
+	for (unsigned int i = 0; i < header.numRanges; i++)
+		if (out.vRanges[i].firstGlyph + out.vRanges[i].numCodes > header.numGlyphs)
+			return false;
+	return true;
+}
+
+// Write a cooked font.
+bool PI_GUI::WriteCookedFont(const char *filename, const PI_Font &font)
+{
+	PI_CookedFontHeader header;
+	memcpy(header.magic, "PIF1", 4);
+	header.numRanges = (unsigned int)font.vRanges.size();
+	header.numGlyphs = (unsigned int)font.vGlyphs.size();
+	header.numKerning = (unsigned int)font.vKerning.size();
+
+	ofstream fout(filename, ios_base::binary | ios_base::out);
+	if (!fout.is_open())
+		return false;
+	fout.write((const char *)&header, sizeof(header));
+	if (header.numRanges)
+		fout.write((const char *)&font.vRanges[0], header.numRanges * sizeof(PI_GlyphRange));
+	if (header.numGlyphs)
+		fout.write((const char *)&font.vGlyphs[0], header.numGlyphs * sizeof(PI_Glyph));
+	if (header.numKerning)
+		fout.write((const char *)&font.vKerning[0], header.numKerning * sizeof(PI_Kerning));
+	return fout.good();
+}
+
+void PI_GUI::PI_GUIFrame::AddString(const char *string, float x, float y, float size, float r, float g, float b, float a)
 {
 	// Look for an "unused" spot in the string vector.
-	if (++numStrings < vStrings.size())
-		vStrings[numStrings - 1] = PI_String(string, x, y, size, r, g, b, a);
+	if (numStrings < vStrings.size())
+		vStrings[numStrings] = PI_String(string, x, y, size, r, g, b, a);
 	else
 		// Make room!
 		vStrings.push_back(PI_String(string, x, y, size, r, g, b, a));
+	++numStrings;
 }
 
-void PI_GUI::DrawString(const ostringstream &ostr, float x, float y, float size, float r, float g, float b, float a)
+void PI_GUI::PI_GUIFrame::AddObject(const PI_GUIObject &obj)
 {
-	// Look for an "unused" spot in the string vector.
-	if (++numStrings < vStrings.size())
-		vStrings[numStrings - 1] = PI_String(ostr.str().c_str(), x, y, size, r, g, b, a);
+	if (numObjects < vObjects.size())
+		vObjects[numObjects] = obj;
 	else
-		// Make room!
-		vStrings.push_back(PI_String(ostr.str().c_str(), x, y, size, r, g, b, a));
+		vObjects.push_back(obj);
+	++numObjects;
+}
+
+void PI_GUI::DrawString(const char *string, float x, float y, float size, float r, float g, float b, float a)
+{
+	recording.AddString(string, x, y, size, r, g, b, a);
+}
+
+void PI_GUI::DrawString(const ostringstream &ostr, float x, float y, float size, float r, float g, float b, float a)
+{
+	recording.AddString(ostr.str().c_str(), x, y, size, r, g, b, a);
 }
 
+// Objects are copied, so they can change while the frame is drawn.
 void PI_GUI::DrawGUIObject(const PI_GUIObject *pObj)
 {
-	if (++numGUIObjects < vpGUIObjects.size())
-		vpGUIObjects[numGUIObjects - 1] = pObj;
-	else
-		vpGUIObjects.push_back(pObj);
+	recording.AddObject(*pObj);
+}
+
+// Hand over everything drawn since the last call, and start recording the next frame.
+// The frame passed in is recycled for that.
+//
+// Out:		out				What was drawn.
+void PI_GUI::TakeFrame(PI_GUIFrame &out)
+{
+	out.vStrings.swap(recording.vStrings);
+	out.vObjects.swap(recording.vObjects);
+	out.numStrings = recording.numStrings;
+	out.numObjects = recording.numObjects;
+	recording.numStrings = recording.numObjects = 0;
 }
\ No newline at end of file
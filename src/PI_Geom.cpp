@@ -2,6 +2,8 @@
 //
 // Copyright Evan Beeton 6/11/2005
 
+#include <cmath>
+
 #include "PI_Geom.h"
 
 bool PI_Triangle::SharesEdge(const PI_Triangle &rhs, PI_Edge &sharedEdge) const
@@ -45,6 +47,164 @@ void PI_Triangle::GetFaceNormal(PI_Vec3 &normalOut) const
 	normalOut.Normalize();
 }
 
+// Open hash table helpers for PI_BuildEdgeList.
+static unsigned int HashCell(int x, int y, int z)
+{
+	// Multiply unsigned, as signed overflow is undefined.
+	return (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)z * 83492791u;
+}
+
+static unsigned int HashEdge(unsigned int v0, unsigned int v1)
+{
+	return v0 * 2654435761u ^ v1 * 40503u;
+}
+
+// Round up to a power of two of at least twice the size, so the tables stay sparse.
+static unsigned int TableSize(unsigned int numEntries)
+{
+	unsigned int size = 16;
+	while (size < numEntries * 2)
+		size <<= 1;
+	return size;
+}
+
+// Build the silhouette edge list for a triangle soup in linear time.
+// Vertices closer than weldTolerance are welded, and edges are matched up by their welded
+// vertex IDs. Degenerate triangles are skipped, and edges that can never be silhouettes
+// (duplicates, and edges between coplanar faces) are dropped.
+//
+// Edge verts follow face 0's winding. An edge on an open border gets the reverse of face 0's
+// normal as face 1's, so it always casts.
+//
+// In:		pTris, numTris	The triangles.
+//			weldTolerance	How close two verts have to be to count as the same vertex.
+//
+// Out:		out				The edge list, replacing whatever was there.
+void PI_BuildEdgeList(const PI_Triangle *pTris, unsigned int numTris, vector<PI_Edge> &out, float weldTolerance)
+{
+	// An edge and the (up to) two faces that share it.
+	struct EdgeRecord
+	{
+		unsigned int verts[2];
+		PI_Vec3 faceNormals[2];
+		unsigned int numFaces;
+	};
+
+	out.clear();
+	if (!numTris)
+		return;
+	if (weldTolerance <= 0)
+		weldTolerance = 1e-6f;
+
+	// Weld the verts. Each unique vertex lives in a grid cell the size of the tolerance,
+	// so a match can only be in the same cell or one of its neighbours.
+	const unsigned int NumVerts = numTris * 3, VertMask = TableSize(NumVerts) - 1;
+	const float InvCell = 1.0f / weldTolerance, ToleranceSq = weldTolerance * weldTolerance;
+	vector<int> vVertHeads(VertMask + 1, -1), vVertNext;
+	vector<PI_Vec3> vWelded;
+	vector<unsigned int> vWeldIDs(NumVerts);
+	vVertNext.reserve(NumVerts);
+	vWelded.reserve(NumVerts);
+
+	for (unsigned int v = 0; v < NumVerts; ++v)
+	{
+		const PI_Vec3 &vert = pTris[v / 3].verts[v % 3];
+		const int CX = (int)floor(vert.x * InvCell), CY = (int)floor(vert.y * InvCell), CZ = (int)floor(vert.z * InvCell);
+
+		int match = -1;
+		for (int dx = -1; dx <= 1 && match < 0; ++dx)
+			for (int dy = -1; dy <= 1 && match < 0; ++dy)
+				for (int dz = -1; dz <= 1 && match < 0; ++dz)
+					for (int i = vVertHeads[HashCell(CX + dx, CY + dy, CZ + dz) & VertMask]; i >= 0 && match < 0; i = vVertNext[i])
+						if ((vWelded[i] - vert).MagnitudeSquared() <= ToleranceSq)
+							match = i;
+
+		if (match < 0)
+		{
+			// A new vertex.
+			match = (int)vWelded.size();
+			const unsigned int Bucket = HashCell(CX, CY, CZ) & VertMask;
+			vWelded.push_back(vert);
+			vVertNext.push_back(vVertHeads[Bucket]);
+			vVertHeads[Bucket] = match;
+		}
+		vWeldIDs[v] = (unsigned int)match;
+	}
+
+	// Match up the edges by their sorted vertex IDs.
+	const unsigned int EdgeMask = TableSize(NumVerts) - 1;
+	vector<int> vEdgeHeads(EdgeMask + 1, -1), vEdgeNext;
+	vector<EdgeRecord> vRecords;
+	vEdgeNext.reserve(NumVerts);
+	vRecords.reserve(NumVerts);
+
+	for (unsigned int t = 0; t < numTris; ++t)
+	{
+		const unsigned int *pIDs = &vWeldIDs[t * 3];
+
+		// Skip triangles that collapse to a line or a point.
+		if (pIDs[0] == pIDs[1] || pIDs[1] == pIDs[2] || pIDs[2] == pIDs[0])
+			continue;
+		PI_Vec3 normal = (vWelded[pIDs[1]] - vWelded[pIDs[0]]).Cross(vWelded[pIDs[2]] - vWelded[pIDs[0]]);
+		if (normal.MagnitudeSquared() <= ToleranceSq * ToleranceSq)
+			continue;
+		normal.Normalize();
+
+		for (unsigned int e = 0; e < 3; ++e)
+		{
+			const unsigned int V0 = pIDs[e], V1 = pIDs[(e + 1) % 3];
+			const unsigned int Lo = V0 < V1 ? V0 : V1, Hi = V0 < V1 ? V1 : V0;
+			const unsigned int Bucket = HashEdge(Lo, Hi) & EdgeMask;
+
+			int i = vEdgeHeads[Bucket];
+			for ( ; i >= 0; i = vEdgeNext[i])
+			{
+				const EdgeRecord &r = vRecords[i];
+				if ((r.verts[0] == Lo && r.verts[1] == Hi) || (r.verts[0] == Hi && r.verts[1] == Lo))
+					break;
+			}
+
+			if (i < 0)
+			{
+				// First face on this edge - the edge takes its winding.
+				EdgeRecord r;
+				r.verts[0] = V0;
+				r.verts[1] = V1;
+				r.faceNormals[0] = normal;
+				r.numFaces = 1;
+				vEdgeNext.push_back(vEdgeHeads[Bucket]);
+				vEdgeHeads[Bucket] = (int)vRecords.size();
+				vRecords.push_back(r);
+			}
+			else if (vRecords[i].numFaces++ == 1)
+				vRecords[i].faceNormals[1] = normal;
+			// Any further faces make the mesh non-manifold; the first two are kept.
+		}
+	}
+
+	// Emit everything that could ever be a silhouette.
+	const float CoplanarDot = 0.9999f;
+	const unsigned int NumRecords = (unsigned int)vRecords.size();
+	out.reserve(NumRecords);
+	for (unsigned int i = 0; i < NumRecords; ++i)
+	{
+		const EdgeRecord &r = vRecords[i];
+		PI_Edge edge;
+		edge.verts[0] = vWelded[r.verts[0]];
+		edge.verts[1] = vWelded[r.verts[1]];
+		edge.faceNormals[0] = r.faceNormals[0];
+		if (r.numFaces == 1)
+			// Open border.
+			edge.faceNormals[1] = -r.faceNormals[0];
+		else if (r.faceNormals[0].Dot(r.faceNormals[1]) >= CoplanarDot)
+			// Both faces always point the same way as each other.
+			continue;
+		else
+			edge.faceNormals[1] = r.faceNormals[1];
+		out.push_back(edge);
+	}
+}
+
 // The assignment operator is a private data member of PI_MeshNode.
 // PI_Render is the only friend allowed to make copies.
 PI_MeshNode &PI_MeshNode::operator=(const PI_MeshNode &r)
@@ -55,7 +215,8 @@ PI_MeshNode &PI_MeshNode::operator=(const PI_MeshNode &r)
 		name = r.name;
 		aabb_min = r.aabb_min;
 		aabb_max = r.aabb_max;
-		displayList = r.displayList;
+		geometry = r.geometry;
+		pGeometry = r.pGeometry;
 		diffTexName = r.diffTexName;
 		normalTexName = r.normalTexName;
 		flags = r.flags;
@@ -72,7 +233,8 @@ PI_MeshNode::PI_MeshNode(const PI_MeshNode &r)
 	name = r.name;
 	aabb_min = r.aabb_min;
 	aabb_max = r.aabb_max;
-	displayList = r.displayList;
+	geometry = r.geometry;
+	pGeometry = r.pGeometry;
 	diffTexName = r.diffTexName;
 	normalTexName = r.normalTexName;
 	flags = r.flags;
@@ -0,0 +1,313 @@
+// PigIron static geometry buffer implementation.
+
+#include <cstddef>
+
+#include "PI_GeometryBuffer.h"
+#include "PI_Asset.h"
+
+static PFNGLGENBUFFERSPROC glGenBuffersPI;
+static PFNGLBINDBUFFERPROC glBindBufferPI;
+static PFNGLBUFFERDATAPROC glBufferDataPI;
+static PFNGLDELETEBUFFERSPROC glDeleteBuffersPI;
+static PFNGLGETBUFFERSUBDATAPROC glGetBufferSubDataPI;
+static PFNGLMULTIDRAWELEMENTSPROC glMultiDrawElementsPI;
+static PFNGLCLIENTACTIVETEXTUREPROC glClientActiveTexturePI;
+static PFNGLDRAWELEMENTSINSTANCEDEXTPROC glDrawElementsInstancedPI;
+
+// Find a core entry point, or its extension equivalent for older drivers.
+//
+// Returns					The entry point, or 0 if the driver has neither.
+PROC PI_GetGLProc(const char *coreName, const char *extName)
+{
+	PROC proc = wglGetProcAddress(coreName);
+	return proc ? proc : wglGetProcAddress(extName);
+}
+
+// Load the buffer object, multi-draw and client texture entry points.
+// Must be called with a current rendering context, before any buffer is uploaded.
+//
+// Returns					True if buffer objects are available. Geometry stays in
+//							system memory vertex arrays if they aren't.
+bool PI_InitGeometryBuffers(void)
+{
+	glGenBuffersPI = (PFNGLGENBUFFERSPROC)PI_GetGLProc("glGenBuffers", "glGenBuffersARB");
+	glBindBufferPI = (PFNGLBINDBUFFERPROC)PI_GetGLProc("glBindBuffer", "glBindBufferARB");
+	glBufferDataPI = (PFNGLBUFFERDATAPROC)PI_GetGLProc("glBufferData", "glBufferDataARB");
+	glDeleteBuffersPI = (PFNGLDELETEBUFFERSPROC)PI_GetGLProc("glDeleteBuffers", "glDeleteBuffersARB");
+	glGetBufferSubDataPI = (PFNGLGETBUFFERSUBDATAPROC)PI_GetGLProc("glGetBufferSubData", "glGetBufferSubDataARB");
+	glMultiDrawElementsPI = (PFNGLMULTIDRAWELEMENTSPROC)PI_GetGLProc("glMultiDrawElements", "glMultiDrawElementsEXT");
+	glClientActiveTexturePI = (PFNGLCLIENTACTIVETEXTUREPROC)PI_GetGLProc("glClientActiveTexture", "glClientActiveTextureARB");
+	glDrawElementsInstancedPI = (PFNGLDRAWELEMENTSINSTANCEDEXTPROC)PI_GetGLProc("glDrawElementsInstanced", "glDrawElementsInstancedARB");
+	if (!glDrawElementsInstancedPI)
+		glDrawElementsInstancedPI = (PFNGLDRAWELEMENTSINSTANCEDEXTPROC)wglGetProcAddress("glDrawElementsInstancedEXT");
+
+	// Without all four, fall back to plain vertex arrays.
+	if (!glGenBuffersPI || !glBindBufferPI || !glBufferDataPI || !glDeleteBuffersPI)
+	{
+		glGenBuffersPI = 0;
+		return false;
+	}
+	return true;
+}
+
+// Can buffers draw many instances in one call?
+bool PI_CanDrawInstanced(void)
+{
+	return glDrawElementsInstancedPI != 0;
+}
+
+// Weld a batch of triangles and append it. Nothing reaches the GL until Upload.
+//
+// In:		pTris, numTris	The triangles.
+//
+// Returns					The index the batch starts at. It's numTris * 3 indices long.
+unsigned int PI_GeometryBuffer::AddTriangles(const PI_Triangle *pTris, unsigned int numTris)
+{
+	const unsigned int FirstIndex = (unsigned int)vIndices.size();
+
+	// An open addressing table of vertex indices + 1, at most half full.
+	unsigned int tableSize = 16;
+	while (tableSize < numTris * 6)
+		tableSize <<= 1;
+	vector<unsigned int> vTable(tableSize, 0);
+
+	for (unsigned int t = 0; t < numTris; ++t)
+	{
+		for (unsigned int v = 0; v < 3; ++v)
+		{
+			PI_Vertex vert;
+			vert.pos[0] = pTris[t].verts[v].x, vert.pos[1] = pTris[t].verts[v].y, vert.pos[2] = pTris[t].verts[v].z;
+			vert.normal[0] = pTris[t].normals[v].x, vert.normal[1] = pTris[t].normals[v].y, vert.normal[2] = pTris[t].normals[v].z;
+			vert.uv[0] = pTris[t].texCoord[v].u, vert.uv[1] = pTris[t].texCoord[v].v;
+			vert.rgba[0] = vert.rgba[1] = vert.rgba[2] = 255;
+			vert.rgba[3] = (unsigned char)(pTris[t].vertAlpha[v] * 255.0f + 0.5f);
+
+			// Identical vertices are only stored once.
+			unsigned int slot = (unsigned int)PI_HashBytes(&vert, sizeof(vert)) & (tableSize - 1);
+			while (vTable[slot] && memcmp(&vVerts[vTable[slot] - 1], &vert, sizeof(vert)))
+				slot = (slot + 1) & (tableSize - 1);
+			if (!vTable[slot])
+			{
+				vVerts.push_back(vert);
+				vTable[slot] = (unsigned int)vVerts.size();
+			}
+			vIndices.push_back(vTable[slot] - 1);
+		}
+	}
+	return FirstIndex;
+}
+
+// Make everything added so far drawable. Buffer objects get their own copy,
+// so the system memory copy is dropped if they're available.
+//
+// In:		texCoordSets	How many texture units get the texture coordinates (1 or 2).
+//			colors			Use the vertex alpha as the color? Otherwise the current color is used.
+void PI_GeometryBuffer::Upload(unsigned int texCoordSets, bool colors)
+{
+	numTexCoordSets = texCoordSets;
+	hasColors = colors;
+	PackIndices();
+
+	if (!glGenBuffersPI || vVerts.empty())
+		return;
+
+	if (!vertexBuffer)
+		glGenBuffersPI(1, &vertexBuffer);
+	glBindBufferPI(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferDataPI(GL_ARRAY_BUFFER, vVerts.size() * sizeof(PI_Vertex), &vVerts[0], GL_STATIC_DRAW);
+	glBindBufferPI(GL_ARRAY_BUFFER, 0);
+
+	if (!indexBuffer)
+		glGenBuffersPI(1, &indexBuffer);
+	glBindBufferPI(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBufferDataPI(GL_ELEMENT_ARRAY_BUFFER, vIndexData.size(), &vIndexData[0], GL_STATIC_DRAW);
+	glBindBufferPI(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// The driver has its own copy now.
+	vector<PI_Vertex>().swap(vVerts);
+	vector<unsigned char>().swap(vIndexData);
+}
+
+// Convert the indices to the type they're drawn with.
+void PI_GeometryBuffer::PackIndices(void)
+{
+	numVerts = (unsigned int)vVerts.size();
+	numIndices = (unsigned int)vIndices.size();
+
+	// Halve the index data when every vertex can be reached with 16 bits.
+	if (numVerts <= 0x10000)
+	{
+		indexType = GL_UNSIGNED_SHORT;
+		vIndexData.resize(numIndices * sizeof(unsigned short));
+		unsigned short *pIndex = numIndices ? (unsigned short *)&vIndexData[0] : 0;
+		for (unsigned int i = 0; i < numIndices; ++i)
+			pIndex[i] = (unsigned short)vIndices[i];
+	}
+	else
+	{
+		indexType = GL_UNSIGNED_INT;
+		vIndexData.resize(numIndices * sizeof(unsigned int));
+		if (numIndices)
+			memcpy(&vIndexData[0], &vIndices[0], vIndexData.size());
+	}
+	vector<unsigned int>().swap(vIndices);
+}
+
+// Does the buffer hold exactly what a batch of triangles would weld into?
+// Buffer objects are read back, so this is for confirming a match, not searching for one.
+//
+// In:		pTris, numTris	The triangles.
+//
+// Returns					True if they'd draw the same as everything uploaded.
+bool PI_GeometryBuffer::Holds(const PI_Triangle *pTris, unsigned int numTris) const
+{
+	PI_GeometryBuffer welded;
+	welded.AddTriangles(pTris, numTris);
+	welded.PackIndices();
+	if (welded.numVerts != numVerts || welded.numIndices != numIndices || welded.indexType != indexType)
+		return false;
+	if (!numVerts)
+		return true;
+
+	// Without buffer objects, everything is still in system memory.
+	const unsigned int VertBytes = numVerts * sizeof(PI_Vertex), IndexBytes = (unsigned int)welded.vIndexData.size();
+	if (!vertexBuffer)
+		return !memcmp(&vVerts[0], &welded.vVerts[0], VertBytes) && !memcmp(&vIndexData[0], &welded.vIndexData[0], IndexBytes);
+	if (!glGetBufferSubDataPI)
+		return false;
+
+	vector<PI_Vertex> vResidentVerts(numVerts);
+	vector<unsigned char> vResidentIndices(IndexBytes);
+	glBindBufferPI(GL_ARRAY_BUFFER, vertexBuffer);
+	glGetBufferSubDataPI(GL_ARRAY_BUFFER, 0, VertBytes, &vResidentVerts[0]);
+	glBindBufferPI(GL_ARRAY_BUFFER, 0);
+	glBindBufferPI(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glGetBufferSubDataPI(GL_ELEMENT_ARRAY_BUFFER, 0, IndexBytes, &vResidentIndices[0]);
+	glBindBufferPI(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return !memcmp(&vResidentVerts[0], &welded.vVerts[0], VertBytes) && !memcmp(&vResidentIndices[0], &welded.vIndexData[0], IndexBytes);
+}
+
+// Release the buffers and everything added.
+void PI_GeometryBuffer::Release(void)
+{
+	if (vertexBuffer)
+		glDeleteBuffersPI(1, &vertexBuffer);
+	if (indexBuffer)
+		glDeleteBuffersPI(1, &indexBuffer);
+	vertexBuffer = indexBuffer = 0;
+	numVerts = numIndices = 0;
+	vector<PI_Vertex>().swap(vVerts);
+	vector<unsigned int>().swap(vIndices);
+	vector<unsigned char>().swap(vIndexData);
+}
+
+// Point the vertex arrays at this buffer. Draw only between Bind and Unbind.
+void PI_GeometryBuffer::Bind(void) const
+{
+	// With a buffer bound, the pointers are offsets into it.
+	const unsigned char *pBase = 0;
+	if (vertexBuffer)
+	{
+		glBindBufferPI(GL_ARRAY_BUFFER, vertexBuffer);
+		glBindBufferPI(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	}
+	else if (vVerts.size())
+		pBase = (const unsigned char *)&vVerts[0];
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(PI_Vertex), pBase + offsetof(PI_Vertex, pos));
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glNormalPointer(GL_FLOAT, sizeof(PI_Vertex), pBase + offsetof(PI_Vertex, normal));
+	if (hasColors)
+	{
+		glEnableClientState(GL_COLOR_ARRAY);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(PI_Vertex), pBase + offsetof(PI_Vertex, rgba));
+	}
+
+	for (unsigned int i = 0; i < numTexCoordSets; ++i)
+	{
+		if (glClientActiveTexturePI)
+			glClientActiveTexturePI(GL_TEXTURE0 + i);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(PI_Vertex), pBase + offsetof(PI_Vertex, uv));
+	}
+	if (glClientActiveTexturePI)
+		glClientActiveTexturePI(GL_TEXTURE0);
+}
+
+// Disable the vertex arrays Bind enabled.
+void PI_GeometryBuffer::Unbind(void) const
+{
+	for (unsigned int i = 0; i < numTexCoordSets; ++i)
+	{
+		if (glClientActiveTexturePI)
+			glClientActiveTexturePI(GL_TEXTURE0 + i);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+	if (glClientActiveTexturePI)
+		glClientActiveTexturePI(GL_TEXTURE0);
+
+	if (hasColors)
+		glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	if (vertexBuffer)
+	{
+		glBindBufferPI(GL_ARRAY_BUFFER, 0);
+		glBindBufferPI(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
+
+// Where an index starts, as the GL wants it for the bound index buffer or array.
+const GLvoid *PI_GeometryBuffer::IndexOffset(unsigned int index) const
+{
+	const unsigned int Offset = index * (indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int));
+	if (indexBuffer)
+		return (const GLvoid *)(size_t)Offset;
+	return &vIndexData[0] + Offset;
+}
+
+// Draw part of the buffer.
+//
+// In:		firstIndex		Where the batch starts, as returned by AddTriangles.
+//			count			How many indices to draw.
+void PI_GeometryBuffer::Draw(unsigned int firstIndex, unsigned int count) const
+{
+	if (count)
+		glDrawElements(GL_TRIANGLES, count, indexType, IndexOffset(firstIndex));
+}
+
+// Draw several parts of the buffer in one call.
+//
+// In:		pFirstIndices	Where each part starts.
+//			pCounts			How many indices are in each part.
+//			numDraws		How many parts there are.
+void PI_GeometryBuffer::MultiDraw(const unsigned int *pFirstIndices, const GLsizei *pCounts, unsigned int numDraws) const
+{
+	if (!glMultiDrawElementsPI)
+	{
+		for (unsigned int i = 0; i < numDraws; ++i)
+			Draw(pFirstIndices[i], pCounts[i]);
+		return;
+	}
+
+	const unsigned int MaxDraws = 64;
+	const GLvoid *pOffsets[MaxDraws];
+	for (unsigned int first = 0; first < numDraws; first += MaxDraws)
+	{
+		const unsigned int NumInCall = numDraws - first < MaxDraws ? numDraws - first : MaxDraws;
+		for (unsigned int i = 0; i < NumInCall; ++i)
+			pOffsets[i] = IndexOffset(pFirstIndices[first + i]);
+		glMultiDrawElementsPI(GL_TRIANGLES, pCounts + first, indexType, pOffsets, NumInCall);
+	}
+}
+
+// Draw the whole buffer several times in one call. Only if PI_CanDrawInstanced.
+//
+// In:		numInstances	How many times to draw it.
+void PI_GeometryBuffer::DrawInstanced(unsigned int numInstances) const
+{
+	if (numIndices && numInstances)
+		glDrawElementsInstancedPI(GL_TRIANGLES, numIndices, indexType, IndexOffset(0), numInstances);
+}
\ No newline at end of file
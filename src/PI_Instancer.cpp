@@ -0,0 +1,218 @@
+// PigIron hardware instancing implementation.
+
+#include <cstddef>
+#include <cstring>
+
+#include "PI_Instancer.h"
+#include "PI_Logger.h"
+
+#ifndef GL_ARB_instanced_arrays
+typedef void (APIENTRYP PFNGLVERTEXATTRIBDIVISORARBPROC) (GLuint index, GLuint divisor);
+#endif
+
+static PFNGLCREATESHADERPROC glCreateShaderPI;
+static PFNGLSHADERSOURCEPROC glShaderSourcePI;
+static PFNGLCOMPILESHADERPROC glCompileShaderPI;
+static PFNGLGETSHADERIVPROC glGetShaderivPI;
+static PFNGLGETSHADERINFOLOGPROC glGetShaderInfoLogPI;
+static PFNGLDELETESHADERPROC glDeleteShaderPI;
+static PFNGLCREATEPROGRAMPROC glCreateProgramPI;
+static PFNGLATTACHSHADERPROC glAttachShaderPI;
+static PFNGLBINDATTRIBLOCATIONPROC glBindAttribLocationPI;
+static PFNGLLINKPROGRAMPROC glLinkProgramPI;
+static PFNGLGETPROGRAMIVPROC glGetProgramivPI;
+static PFNGLUSEPROGRAMPROC glUseProgramPI;
+static PFNGLDELETEPROGRAMPROC glDeleteProgramPI;
+static PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointerPI;
+static PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArrayPI;
+static PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArrayPI;
+static PFNGLVERTEXATTRIBDIVISORARBPROC glVertexAttribDivisorPI;
+static PFNGLGENBUFFERSPROC glGenBuffersPI;
+static PFNGLBINDBUFFERPROC glBindBufferPI;
+static PFNGLBUFFERDATAPROC glBufferDataPI;
+static PFNGLDELETEBUFFERSPROC glDeleteBuffersPI;
+
+// Generic attribute slots for the instance stream. The transform takes four.
+// These alias texture coordinate sets 2 to 6 on some drivers, which nothing else uses.
+static const GLuint XformAttrib = 10, LightAttrib = 14;
+
+// Transform each vertex by its instance's world transform, and pass the instance's
+// light direction on as the primary color for the DOT3 combiner.
+// Stage 2 gets the eye linear texture coordinates fixed-function would generate for shadow maps.
+static const char *InstanceVertexProgram =
+	"#version 110\n"
+	"attribute mat4 instanceXform;\n"
+	"attribute vec4 instanceLight;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 eye = gl_ModelViewMatrix * (instanceXform * gl_Vertex);\n"
+	"	gl_Position = gl_ProjectionMatrix * eye;\n"
+	"	gl_FrontColor = instanceLight;\n"
+	"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+	"	gl_TexCoord[1] = gl_MultiTexCoord1;\n"
+	"	gl_TexCoord[2] = vec4(dot(eye, gl_EyePlaneS[2]), dot(eye, gl_EyePlaneT[2]),\n"
+	"						  dot(eye, gl_EyePlaneR[2]), dot(eye, gl_EyePlaneQ[2]));\n"
+	"}\n";
+
+// Load the entry points and build the vertex program.
+// Must be called with a current rendering context.
+//
+// Returns					True if instanced drawing is available. Draw must not be used otherwise.
+bool PI_Instancer::Init(void)
+{
+	PI_Logger &logger = PI_Logger::GetInstance();
+	const char *extstr = (const char *)glGetString(GL_EXTENSIONS);
+	if (!PI_CanDrawInstanced() || !extstr || !strstr(extstr, "ARB_instanced_arrays"))
+	{
+		logger << "Instanced arrays are unavailable - repeated meshes will be drawn one at a time.\n";
+		return false;
+	}
+
+	// The instance stream's fixed slots have to exist on this driver.
+	GLint maxAttribs = 0;
+	glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &maxAttribs);
+	if (maxAttribs <= (GLint)LightAttrib)
+	{
+		logger << "Only " << maxAttribs << " vertex attributes are available - repeated meshes will be drawn one at a time.\n";
+		return false;
+	}
+
+	glCreateShaderPI = (PFNGLCREATESHADERPROC)wglGetProcAddress("glCreateShader");
+	glShaderSourcePI = (PFNGLSHADERSOURCEPROC)wglGetProcAddress("glShaderSource");
+	glCompileShaderPI = (PFNGLCOMPILESHADERPROC)wglGetProcAddress("glCompileShader");
+	glGetShaderivPI = (PFNGLGETSHADERIVPROC)wglGetProcAddress("glGetShaderiv");
+	glGetShaderInfoLogPI = (PFNGLGETSHADERINFOLOGPROC)wglGetProcAddress("glGetShaderInfoLog");
+	glDeleteShaderPI = (PFNGLDELETESHADERPROC)wglGetProcAddress("glDeleteShader");
+	glCreateProgramPI = (PFNGLCREATEPROGRAMPROC)wglGetProcAddress("glCreateProgram");
+	glAttachShaderPI = (PFNGLATTACHSHADERPROC)wglGetProcAddress("glAttachShader");
+	glBindAttribLocationPI = (PFNGLBINDATTRIBLOCATIONPROC)wglGetProcAddress("glBindAttribLocation");
+	glLinkProgramPI = (PFNGLLINKPROGRAMPROC)wglGetProcAddress("glLinkProgram");
+	glGetProgramivPI = (PFNGLGETPROGRAMIVPROC)wglGetProcAddress("glGetProgramiv");
+	glUseProgramPI = (PFNGLUSEPROGRAMPROC)wglGetProcAddress("glUseProgram");
+	glDeleteProgramPI = (PFNGLDELETEPROGRAMPROC)wglGetProcAddress("glDeleteProgram");
+	glVertexAttribPointerPI = (PFNGLVERTEXATTRIBPOINTERPROC)PI_GetGLProc("glVertexAttribPointer", "glVertexAttribPointerARB");
+	glEnableVertexAttribArrayPI = (PFNGLENABLEVERTEXATTRIBARRAYPROC)PI_GetGLProc("glEnableVertexAttribArray", "glEnableVertexAttribArrayARB");
+	glDisableVertexAttribArrayPI = (PFNGLDISABLEVERTEXATTRIBARRAYPROC)PI_GetGLProc("glDisableVertexAttribArray", "glDisableVertexAttribArrayARB");
+	glVertexAttribDivisorPI = (PFNGLVERTEXATTRIBDIVISORARBPROC)PI_GetGLProc("glVertexAttribDivisor", "glVertexAttribDivisorARB");
+	glGenBuffersPI = (PFNGLGENBUFFERSPROC)PI_GetGLProc("glGenBuffers", "glGenBuffersARB");
+	glBindBufferPI = (PFNGLBINDBUFFERPROC)PI_GetGLProc("glBindBuffer", "glBindBufferARB");
+	glBufferDataPI = (PFNGLBUFFERDATAPROC)PI_GetGLProc("glBufferData", "glBufferDataARB");
+	glDeleteBuffersPI = (PFNGLDELETEBUFFERSPROC)PI_GetGLProc("glDeleteBuffers", "glDeleteBuffersARB");
+
+	if (!glCreateShaderPI || !glShaderSourcePI || !glCompileShaderPI || !glGetShaderivPI || !glGetShaderInfoLogPI ||
+		!glDeleteShaderPI || !glCreateProgramPI || !glAttachShaderPI || !glBindAttribLocationPI || !glLinkProgramPI ||
+		!glGetProgramivPI || !glUseProgramPI || !glDeleteProgramPI || !glVertexAttribPointerPI ||
+		!glEnableVertexAttribArrayPI || !glDisableVertexAttribArrayPI || !glVertexAttribDivisorPI)
+	{
+		logger << "GLSL is unavailable - repeated meshes will be drawn one at a time.\n";
+		return false;
+	}
+
+	// Compile the vertex program. There's no fragment program; the combiners do that part.
+	GLuint shader = glCreateShaderPI(GL_VERTEX_SHADER);
+	glShaderSourcePI(shader, 1, &InstanceVertexProgram, 0);
+	glCompileShaderPI(shader);
+	GLint status = GL_FALSE;
+	glGetShaderivPI(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		char infoLog[512];
+		glGetShaderInfoLogPI(shader, sizeof(infoLog), 0, infoLog);
+		logger << "Failed to compile the instancing vertex program:\n" << infoLog << '\n';
+		glDeleteShaderPI(shader);
+		return false;
+	}
+
+	program = glCreateProgramPI();
+	glAttachShaderPI(program, shader);
+	glBindAttribLocationPI(program, XformAttrib, "instanceXform");
+	glBindAttribLocationPI(program, LightAttrib, "instanceLight");
+	glLinkProgramPI(program);
+	glDeleteShaderPI(shader);
+	glGetProgramivPI(program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		logger << "Failed to link the instancing vertex program.\n";
+		glDeleteProgramPI(program);
+		program = 0;
+		return false;
+	}
+
+	// Without buffer objects, the instances are streamed from system memory.
+	if (glGenBuffersPI && glBindBufferPI && glBufferDataPI && glDeleteBuffersPI)
+		glGenBuffersPI(1, &instanceBuffer);
+	return true;
+}
+
+// Release the vertex program and instance buffer.
+void PI_Instancer::Shutdown(void)
+{
+	if (program)
+		glDeleteProgramPI(program);
+	if (instanceBuffer)
+		glDeleteBuffersPI(1, &instanceBuffer);
+	program = instanceBuffer = 0;
+	vector<PI_Instance>().swap(vInstances);
+}
+
+// Switch to and from the instancing vertex program. Draw only between Begin and End.
+void PI_Instancer::Begin(void) const
+{
+	glUseProgramPI(program);
+}
+
+void PI_Instancer::End(void) const
+{
+	glUseProgramPI(0);
+}
+
+// Draw a bound geometry buffer once per instance.
+//
+// In:		geometry		The geometry, already bound.
+//			pInstances		The copies to draw.
+//			numInstances	How many copies there are.
+void PI_Instancer::Draw(const PI_GeometryBuffer &geometry, const PI_Instance *pInstances, unsigned int numInstances)
+{
+	if (!numInstances)
+		return;
+
+	// Stream the instances in. Respecifying the whole buffer lets the driver
+	// hand back fresh storage rather than wait on the last draw.
+	const unsigned char *pBase = 0;
+	if (instanceBuffer)
+	{
+		glBindBufferPI(GL_ARRAY_BUFFER, instanceBuffer);
+		glBufferDataPI(GL_ARRAY_BUFFER, numInstances * sizeof(PI_Instance), pInstances, GL_STREAM_DRAW);
+	}
+	else
+	{
+		vInstances.assign(pInstances, pInstances + numInstances);
+		pBase = (const unsigned char *)&vInstances[0];
+	}
+
+	// One column of the transform per slot, then the light, each advancing once per instance.
+	for (GLuint c = 0; c < 4; ++c)
+	{
+		glEnableVertexAttribArrayPI(XformAttrib + c);
+		glVertexAttribPointerPI(XformAttrib + c, 4, GL_FLOAT, GL_FALSE, sizeof(PI_Instance),
+								pBase + offsetof(PI_Instance, worldXform) + c * 4 * sizeof(float));
+		glVertexAttribDivisorPI(XformAttrib + c, 1);
+	}
+	glEnableVertexAttribArrayPI(LightAttrib);
+	glVertexAttribPointerPI(LightAttrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PI_Instance), pBase + offsetof(PI_Instance, lightColor));
+	glVertexAttribDivisorPI(LightAttrib, 1);
+
+	// Each pointer latched the buffer bound when it was set, so the geometry's arrays still point into its own.
+	if (instanceBuffer)
+		glBindBufferPI(GL_ARRAY_BUFFER, 0);
+	geometry.DrawInstanced(numInstances);
+
+	// Leave the slots as every other draw expects them.
+	for (GLuint c = 0; c < 4; ++c)
+	{
+		glVertexAttribDivisorPI(XformAttrib + c, 0);
+		glDisableVertexAttribArrayPI(XformAttrib + c);
+	}
+	glVertexAttribDivisorPI(LightAttrib, 0);
+	glDisableVertexAttribArrayPI(LightAttrib);
+}
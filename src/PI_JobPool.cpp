@@ -0,0 +1,149 @@
+// PigIron worker thread pool implementation.
+
+#include <process.h>
+
+#include "PI_JobPool.h"
+#include "PI_Logger.h"
+
+PI_JobPool PI_JobPool::m_instance;
+
+PI_JobPool::PI_JobPool(void) : hWakeSemaphore(0), hDoneEvent(0), func(0), pContext(0), count(0), nextIndex(0), numAwake(0),
+							   quit(false)
+{
+	InitializeCriticalSection(&cs);
+}
+
+PI_JobPool::~PI_JobPool(void)
+{
+	Shutdown();
+	DeleteCriticalSection(&cs);
+}
+
+// Start the worker threads.
+//
+// In:		numWorkers		How many threads to start. 0 starts one less than the number of processors.
+//
+// Returns					True if every worker started.
+bool PI_JobPool::Init(unsigned int numWorkers)
+{
+	if (vThreads.size())
+		return true;
+
+	if (!numWorkers)
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		numWorkers = info.dwNumberOfProcessors > 1 ? info.dwNumberOfProcessors - 1 : 0;
+	}
+
+	quit = false;
+	hWakeSemaphore = CreateSemaphore(0, 0, numWorkers ? numWorkers : 1, 0);
+	hDoneEvent = CreateEvent(0, FALSE, FALSE, 0);
+	if (!hWakeSemaphore || !hDoneEvent)
+	{
+		Shutdown();
+		return false;
+	}
+
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		HANDLE hThread = (HANDLE)_beginthreadex(0, 0, WorkerThread, this, 0, 0);
+		if (!hThread)
+		{
+			Shutdown();
+			return false;
+		}
+		vThreads.push_back(hThread);
+	}
+
+	PI_Logger::GetInstance() << "PI_JobPool started " << numWorkers << " worker threads.\n";
+	return true;
+}
+
+// Stop and wait for the worker threads.
+void PI_JobPool::Shutdown(void)
+{
+	const unsigned int NumThreads = (unsigned int)vThreads.size();
+	if (NumThreads)
+	{
+		quit = true;
+		ReleaseSemaphore(hWakeSemaphore, NumThreads, 0);
+		for (unsigned int i = 0; i < NumThreads; ++i)
+		{
+			WaitForSingleObject(vThreads[i], INFINITE);
+			CloseHandle(vThreads[i]);
+		}
+		vThreads.clear();
+	}
+
+	if (hWakeSemaphore)
+		CloseHandle(hWakeSemaphore);
+	if (hDoneEvent)
+		CloseHandle(hDoneEvent);
+	hWakeSemaphore = hDoneEvent = 0;
+}
+
+// Run func(pContext, i) for every i in [0, count), and wait for them all to finish.
+// Only one loop at a time has the workers - a loop started while another thread's loop
+// has them runs on its caller instead. Don't call this from inside a job.
+// Threads below normal priority always run their loops themselves.
+void PI_JobPool::ParallelFor(JobFunc jobFunc, void *pJobContext, unsigned int jobCount)
+{
+	if (!jobCount)
+		return;
+
+	// A background thread holding the pool would keep the render and game threads
+	// waiting on it for as long as the scheduler leaves it waiting, so it goes without.
+	// The render and game threads don't wait for each other either - whichever finds the
+	// workers busy runs its own loop alongside, rather than sitting idle until they're free.
+	if (GetThreadPriority(GetCurrentThread()) < THREAD_PRIORITY_NORMAL || !TryEnterCriticalSection(&cs))
+	{
+		for (unsigned int i = 0; i < jobCount; ++i)
+			jobFunc(pJobContext, i);
+		return;
+	}
+
+	func = jobFunc;
+	pContext = pJobContext;
+	count = jobCount;
+	nextIndex = 0;
+
+	// Every worker wakes up for every loop, even if there's nothing left for it by then.
+	// That way none of them can still be looking at this loop when the next one starts.
+	const unsigned int NumThreads = (unsigned int)vThreads.size();
+	if (NumThreads)
+	{
+		numAwake = NumThreads;
+		ReleaseSemaphore(hWakeSemaphore, NumThreads, 0);
+	}
+
+	RunJobs();
+
+	if (NumThreads)
+		WaitForSingleObject(hDoneEvent, INFINITE);
+	LeaveCriticalSection(&cs);
+}
+
+// Worker thread entry point.
+unsigned int __stdcall PI_JobPool::WorkerThread(void *pPool)
+{
+	PI_JobPool *pJobPool = (PI_JobPool *)pPool;
+	while (WaitForSingleObject(pJobPool->hWakeSemaphore, INFINITE) == WAIT_OBJECT_0 && !pJobPool->quit)
+	{
+		pJobPool->RunJobs();
+
+		// The last one out lets the caller go.
+		if (!InterlockedDecrement(&pJobPool->numAwake))
+			SetEvent(pJobPool->hDoneEvent);
+	}
+	_endthreadex(0);
+	return 0;
+}
+
+// Run iterations of the current loop until there are none left.
+void PI_JobPool::RunJobs(void)
+{
+	LONG index;
+	while ((index = InterlockedIncrement(&nextIndex) - 1) < (LONG)count)
+		func(pContext, (unsigned int)index);
+}
@@ -0,0 +1,198 @@
+// PigIron block compression implementation.
+
+#include <cstring>
+#include <vector>
+using std::vector;
+
+#include "PI_LZ.h"
+
+// Block format limits. Matches are at least MinMatch bytes and within MaxOffset,
+// the last LastLiterals bytes are always literals, and no match starts in the last MatchLimit bytes.
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MATCH_LIMIT 12
+#define MAX_OFFSET 65535
+#define HASH_BITS 14
+
+static unsigned int Read32(const unsigned char *p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static unsigned int Hash32(unsigned int v)
+{
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Write a length that didn't fit in its token nibble.
+//
+// Returns					False if there wasn't room.
+static bool WriteLength(unsigned int len, unsigned char *pDst, unsigned int &op, unsigned int dstCapacity)
+{
+	for ( ; len >= 255; len -= 255)
+	{
+		if (op >= dstCapacity)
+			return false;
+		pDst[op++] = 255;
+	}
+	if (op >= dstCapacity)
+		return false;
+	pDst[op++] = (unsigned char)len;
+	return true;
+}
+
+// Write one sequence: literals, then a match if matchLen is non-zero.
+//
+// Returns					False if there wasn't room.
+static bool WriteSequence(const unsigned char *pLiterals, unsigned int litLen, unsigned int offset, unsigned int matchLen,
+						  unsigned char *pDst, unsigned int &op, unsigned int dstCapacity)
+{
+	if (op >= dstCapacity)
+		return false;
+
+	const unsigned int Token = op++;
+	const unsigned int MatchCode = matchLen ? matchLen - MIN_MATCH : 0;
+	pDst[Token] = (unsigned char)(((litLen < 15 ? litLen : 15) << 4) | (MatchCode < 15 ? MatchCode : 15));
+
+	if (litLen >= 15 && !WriteLength(litLen - 15, pDst, op, dstCapacity))
+		return false;
+	if (dstCapacity - op < litLen)
+		return false;
+	memcpy(pDst + op, pLiterals, litLen);
+	op += litLen;
+
+	// The last sequence has no match.
+	if (!matchLen)
+		return true;
+
+	if (dstCapacity - op < 2)
+		return false;
+	pDst[op++] = (unsigned char)(offset & 0xff);
+	pDst[op++] = (unsigned char)(offset >> 8);
+	return MatchCode < 15 || WriteLength(MatchCode - 15, pDst, op, dstCapacity);
+}
+
+// Compress a block.
+//
+// In:		pSrc, srcSize	The data to compress.
+//			dstCapacity		Room available at pDst.
+//
+// Out:		pDst			The compressed block.
+//
+// Returns					The size of the compressed block, or 0 if it didn't fit.
+unsigned int PI_LZCompress(const unsigned char *pSrc, unsigned int srcSize, unsigned char *pDst, unsigned int dstCapacity)
+{
+	unsigned int ip = 0, anchor = 0, op = 0;
+
+	if (srcSize > MATCH_LIMIT)
+	{
+		// Most recent position of each hashed 4 byte sequence.
+		vector<unsigned int> vTable(1 << HASH_BITS, 0);
+		const unsigned int Limit = srcSize - MATCH_LIMIT, MatchEnd = srcSize - LAST_LITERALS;
+
+		while (ip < Limit)
+		{
+			const unsigned int Sequence = Read32(pSrc + ip);
+			unsigned int &slot = vTable[Hash32(Sequence)];
+			const unsigned int Ref = slot;
+			slot = ip;
+
+			if (Ref >= ip || ip - Ref > MAX_OFFSET || Read32(pSrc + Ref) != Sequence)
+			{
+				++ip;
+				continue;
+			}
+
+			// Found a match, so see how far it goes.
+			unsigned int matchLen = MIN_MATCH;
+			while (ip + matchLen < MatchEnd && pSrc[Ref + matchLen] == pSrc[ip + matchLen])
+				++matchLen;
+
+			if (!WriteSequence(pSrc + anchor, ip - anchor, ip - Ref, matchLen, pDst, op, dstCapacity))
+				return 0;
+			ip += matchLen;
+			anchor = ip;
+		}
+	}
+
+	// Everything left over is literals.
+	if (!WriteSequence(pSrc + anchor, srcSize - anchor, 0, 0, pDst, op, dstCapacity))
+		return 0;
+	return op;
+}
+
+// Decompress a block.
+//
+// In:		pSrc, srcSize	The compressed block.
+//			dstSize			Exact size of the decompressed data.
+//
+// Out:		pDst			The decompressed data.
+//
+// Returns					True if the block was valid and decompressed to exactly dstSize bytes.
+bool PI_LZDecompress(const unsigned char *pSrc, unsigned int srcSize, unsigned char *pDst, unsigned int dstSize)
+{
+	unsigned int ip = 0, op = 0;
+	while (ip < srcSize)
+	{
+		const unsigned char Token = pSrc[ip++];
+
+		// Literals.
+		unsigned int len = Token >> 4;
+		if (len == 15)
+		{
+			unsigned char extra;
+			do
+			{
+				if (ip >= srcSize)
+					return false;
+				len += extra = pSrc[ip++];
+			}
+			while (extra == 255);
+		}
+		if (srcSize - ip < len || dstSize - op < len)
+			return false;
+		memcpy(pDst + op, pSrc + ip, len);
+		ip += len;
+		op += len;
+
+		// The last sequence ends after its literals.
+		if (ip == srcSize)
+			break;
+
+		// Match.
+		if (srcSize - ip < 2)
+			return false;
+		const unsigned int Offset = pSrc[ip] | (pSrc[ip + 1] << 8);
+		ip += 2;
+		if (!Offset || Offset > op)
+			return false;
+
+		len = Token & 15;
+		if (len == 15)
+		{
+			unsigned char extra;
+			do
+			{
+				if (ip >= srcSize)
+					return false;
+				len += extra = pSrc[ip++];
+			}
+			while (extra == 255);
+		}
+		len += MIN_MATCH;
+		if (dstSize - op < len)
+			return false;
+
+		// Matches can overlap what they're writing, which repeats the pattern.
+		const unsigned char *pRef = pDst + op - Offset;
+		if (Offset >= len)
+			memcpy(pDst + op, pRef, len);
+		else
+			for (unsigned int i = 0; i < len; ++i)
+				pDst[op + i] = pRef[i];
+		op += len;
+	}
+	return op == dstSize;
+}
@@ -0,0 +1,41 @@
+// PigIron level manifest implementation.
+
+#include <fstream>
+using std::ifstream;
+using std::ios_base;
+#include <cstdio>
+
+#include "PI_LevelManifest.h"
+#include "PI_Logger.h"
+
+// Read the asset list of every level script in a directory,
+// from level0.PLS up to the first one that's missing.
+//
+// In:		directory		Where the level scripts are, e.g. "DATA".
+//
+// Returns					How many levels were found.
+unsigned int PI_LevelManifest::Load(const char *directory)
+{
+	vLevels.clear();
+	while (true)
+	{
+		const int MaxLen = 1000;
+		char scriptName[MaxLen];
+		sprintf_s(scriptName, MaxLen, "%s\\level%d.PLS", directory, (int)vLevels.size());
+		ifstream fin(scriptName, ios_base::in);
+		if (!fin.is_open())
+			break;
+
+		PI_Level level;
+		level.scriptName = scriptName;
+		unsigned int numAssets = 0;
+		(fin >> numAssets).get();
+		level.vAssets.resize(numAssets);
+		for (unsigned int i = 0; i < numAssets; i++)
+			getline(fin, level.vAssets[i]);
+		vLevels.push_back(level);
+	}
+
+	PI_Logger::GetInstance() << "PI_LevelManifest found " << (unsigned int)vLevels.size() << " levels in " << directory << ".\n";
+	return (unsigned int)vLevels.size();
+}
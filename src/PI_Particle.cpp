@@ -5,10 +5,13 @@
 #include <fstream>
 using std::ifstream;
 using std::ofstream;
+using std::ios_base;
 #include <algorithm>
 using std::sort;
 
 #include "PI_Particle.h"
+#include "PI_Asset.h"
+#include "PI_Logger.h"
 #include "PI_Utils.h"
 
 
@@ -83,90 +86,38 @@ void PI_ParticleEmitter::Update(float deltaTime)
 	}
 }
 
+// Configure the emitter from a preset. Each preset is only read from disk once.
+//
+// In:		filename		The preset's text file, e.g. "DATA\\cannonFlash.txt".
+//
+// Returns					True if the preset was found.
 bool PI_ParticleEmitter::LoadPreset(const char *filename)
 {
-	const int TrashBufferLen = 100;
-	char trash[TrashBufferLen];
-	int temp;
-
-	ifstream fin(filename);
-	if (!fin.is_open())
+	const PI_ParticlePreset *pPreset = PI_ParticlePresetCache::GetInstance().Get(filename);
+	if (!pPreset)
 		return false;
-
-	fin.get(trash, TrashBufferLen);
-	fin >> pos.x >> pos.y >> pos.z;
-	while (fin.get() != '\n');
-	fin.get();
-
-	fin.get(trash, TrashBufferLen);
-	fin >> temp;
-	posVar = temp;
-	while (fin.get() != '\n');
-	fin.get();
-
-	fin.get(trash, TrashBufferLen);
-	fin >> dir.x >> dir.y >> dir.z;
-	while (fin.get() != '\n');
-	fin.get();
-
-	fin.get(trash, TrashBufferLen);
-	fin >> temp;
-	dirVar = temp;
-	while (fin.get() != '\n');
-	fin.get();
-
-	fin.get(trash, TrashBufferLen);
-	fin >> force.x >> force.y >> force.z;
-	while (fin.get() != '\n');
-	fin.get();
-
-	fin.get(trash, TrashBufferLen);
-	fin >> maxLife >> temp;
-	lifeVar = temp;
-	while (fin.get() != '\n');
-	fin.get();
-
-	fin.get(trash, TrashBufferLen);
-	fin >> size >> temp;
-	sizeVar = temp;
-	while (fin.get() != '\n');
-	fin.get();
-
-	fin.get(trash, TrashBufferLen);
-	fin >> speed >> temp;
-	speedVar = temp;
-	while (fin.get() != '\n');
-	fin.get();
-
-	// Read the number of color keyframes.
-	fin.get(trash, TrashBufferLen);
-	fin >> temp;
-	while (fin.get() != '\n');
-	fin.get();
-
-	if (temp > 0)
-	{
-		fin.get(trash, TrashBufferLen);
-
-		// Read in the actual color keyframes.
-		vColors.resize(temp);
-		const unsigned int NumColors = (unsigned int)vColors.size();
-		for (unsigned int i = 0; i < NumColors; i++)
-		{
-			fin >> vColors[i].val[PI_ColorKeyframe::Red]
-				>> vColors[i].val[PI_ColorKeyframe::Green]
-				>> vColors[i].val[PI_ColorKeyframe::Blue]
-				>> vColors[i].val[PI_ColorKeyframe::Alpha]
-				>> vColors[i].lifeTime;
-			while (fin.get() != '\n');
-		}
-	}
-
-	fin.close();
+	ApplyPreset(*pPreset);
 	return true;
+}
 
+// Configure the emitter from a preset that's already been read.
+void PI_ParticleEmitter::ApplyPreset(const PI_ParticlePreset &preset)
+{
+	pos = preset.pos;
+	dir = preset.dir;
+	force = preset.force;
+	maxLife = preset.maxLife;
+	size = preset.size;
+	speed = preset.speed;
+	posVar = preset.posVar;
+	dirVar = preset.dirVar;
+	lifeVar = preset.lifeVar;
+	sizeVar = preset.sizeVar;
+	speedVar = preset.speedVar;
+	vColors = preset.vColors;
 }
 
+// Write the emitter's settings out as a text preset.
 void PI_ParticleEmitter::SavePreset(const char *filename) const
 {
 	ofstream fout(filename);
@@ -253,4 +204,227 @@ PI_ParticleEmitter::PI_ColorKeyframe PI_ParticleEmitter::GetInterpolatedColor(fl
 							omt * prev->val[PI_ColorKeyframe::Alpha] + normalizedTime * next->val[PI_ColorKeyframe::Alpha],
 							//omt * keyTime + time0to1 * rhs.keyTime);
 							0);
-}
\ No newline at end of file
+}
+
+PI_ParticlePresetCache PI_ParticlePresetCache::m_instance;
+
+// The fixed size part of a compiled preset. The color keyframes follow it.
+struct PI_CompiledPreset
+{
+	char magic[4];					// "PIP1"
+	float pos[3], dir[3], force[3];
+	float maxLife, size, speed;
+	unsigned char posVar, dirVar, lifeVar, sizeVar, speedVar, pad[3];
+	unsigned int numColors;
+};
+
+// Find a preset, loading it if this is the first time it's been asked for.
+//
+// In:		filename		The preset's text file.
+//
+// Returns					The preset, or 0 if it couldn't be loaded. Valid until Clear.
+const PI_ParticlePreset *PI_ParticlePresetCache::Get(const char *filename)
+{
+	EnterCriticalSection(&cs);
+	map<string, PI_ParticlePreset>::iterator iter = presets.find(filename);
+	if (iter == presets.end())
+	{
+		// Prefer the compiled preset, and compile the text if it's out of date.
+		const string Compiled = string(filename) + PI_PRESET_EXT;
+		PI_ParticlePreset preset;
+		bool loaded = PI_IsCookedCurrent(filename, Compiled.c_str()) && ReadCompiledPreset(Compiled.c_str(), preset);
+		if (!loaded && (loaded = ParsePreset(filename, preset)) && !WriteCompiledPreset(Compiled.c_str(), preset))
+			PI_Logger::GetInstance() << "Failed to write the compiled preset " << Compiled << ".\n";
+		if (loaded)
+			iter = presets.insert(map<string, PI_ParticlePreset>::value_type(filename, preset)).first;
+	}
+	const PI_ParticlePreset *pPreset = iter != presets.end() ? &iter->second : 0;
+	LeaveCriticalSection(&cs);
+	return pPreset;
+}
+
+// Forget every preset, so they're read again next time.
+void PI_ParticlePresetCache::Clear(void)
+{
+	EnterCriticalSection(&cs);
+	presets.clear();
+	LeaveCriticalSection(&cs);
+}
+
+// Parse a text preset.
+bool PI_ParticlePresetCache::ParsePreset(const char *filename, PI_ParticlePreset &out)
+{
+	const int TrashBufferLen = 100;
+	char trash[TrashBufferLen];
+	int temp;
+
+	ifstream fin(filename);
+	if (!fin.is_open())
+		return false;
+
+	fin.get(trash, TrashBufferLen);
+	fin >> out.pos.x >> out.pos.y >> out.pos.z;
+	while (fin.get() != '\n');
+	fin.get();
+
+	fin.get(trash, TrashBufferLen);
+	fin >> temp;
+	out.posVar = temp;
+	while (fin.get() != '\n');
+	fin.get();
+
+	fin.get(trash, TrashBufferLen);
+	fin >> out.dir.x >> out.dir.y >> out.dir.z;
+	while (fin.get() != '\n');
+	fin.get();
+
+	fin.get(trash, TrashBufferLen);
+	fin >> temp;
+	out.dirVar = temp;
+	while (fin.get() != '\n');
+	fin.get();
+
+	fin.get(trash, TrashBufferLen);
+	fin >> out.force.x >> out.force.y >> out.force.z;
+	while (fin.get() != '\n');
+	fin.get();
+
+	fin.get(trash, TrashBufferLen);
+	fin >> out.maxLife >> temp;
+	out.lifeVar = temp;
+	while (fin.get() != '\n');
+	fin.get();
+
+	fin.get(trash, TrashBufferLen);
+	fin >> out.size >> temp;
+	out.sizeVar = temp;
+	while (fin.get() != '\n');
+	fin.get();
+
+	fin.get(trash, TrashBufferLen);
+	fin >> out.speed >> temp;
+	out.speedVar = temp;
+	while (fin.get() != '\n');
+	fin.get();
+
+	// Read the number of color keyframes.
+	fin.get(trash, TrashBufferLen);
+	fin >> temp;
+	while (fin.get() != '\n');
+	fin.get();
+
+	if (temp > 0)
+	{
+		fin.get(trash, TrashBufferLen);
+
+		// Read in the actual color keyframes.
+		out.vColors.resize(temp);
+		const unsigned int NumColors = (unsigned int)out.vColors.size();
+		for (unsigned int i = 0; i < NumColors; i++)
+		{
+			fin >> out.vColors[i].val[PI_ParticleEmitter::PI_ColorKeyframe::Red]
+				>> out.vColors[i].val[PI_ParticleEmitter::PI_ColorKeyframe::Green]
+				>> out.vColors[i].val[PI_ParticleEmitter::PI_ColorKeyframe::Blue]
+				>> out.vColors[i].val[PI_ParticleEmitter::PI_ColorKeyframe::Alpha]
+				>> out.vColors[i].lifeTime;
+			while (fin.get() != '\n');
+		}
+	}
+
+	fin.close();
+	return true;
+}
+
+// Read a compiled preset.
+bool PI_ParticlePresetCache::ReadCompiledPreset(const char *filename, PI_ParticlePreset &out)
+{
+	vector<unsigned char> file;
+	if (!PI_ReadFile(filename, file))
+		return false;
+
+	PI_CompiledPreset header;
+	PI_MemReader reader(file.size() ? &file[0] : 0, (unsigned int)file.size());
+	if (!reader.Read(&header, sizeof(header)) || memcmp(header.magic, "PIP1", 4) ||
+		reader.BytesLeft() != header.numColors * sizeof(PI_ParticleEmitter::PI_ColorKeyframe))
+		return false;
+
+	out.pos = PI_Vec3(header.pos[0], header.pos[1], header.pos[2]);
+	out.dir = PI_Vec3(header.dir[0], header.dir[1], header.dir[2]);
+	out.force = PI_Vec3(header.force[0], header.force[1], header.force[2]);
+	out.maxLife = header.maxLife;
+	out.size = header.size;
+	out.speed = header.speed;
+	out.posVar = header.posVar;
+	out.dirVar = header.dirVar;
+	out.lifeVar = header.lifeVar;
+	out.sizeVar = header.sizeVar;
+	out.speedVar = header.speedVar;
+	out.vColors.resize(header.numColors);
+	return !header.numColors || reader.Read(&out.vColors[0], reader.BytesLeft());
+}
+
+// Write a compiled preset.
+bool PI_ParticlePresetCache::WriteCompiledPreset(const char *filename, const PI_ParticlePreset &preset)
+{
+	PI_CompiledPreset header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "PIP1", 4);
+	header.pos[0] = preset.pos.x, header.pos[1] = preset.pos.y, header.pos[2] = preset.pos.z;
+	header.dir[0] = preset.dir.x, header.dir[1] = preset.dir.y, header.dir[2] = preset.dir.z;
+	header.force[0] = preset.force.x, header.force[1] = preset.force.y, header.force[2] = preset.force.z;
+	header.maxLife = preset.maxLife;
+	header.size = preset.size;
+	header.speed = preset.speed;
+	header.posVar = preset.posVar;
+	header.dirVar = preset.dirVar;
+	header.lifeVar = preset.lifeVar;
+	header.sizeVar = preset.sizeVar;
+	header.speedVar = preset.speedVar;
+	header.numColors = (unsigned int)preset.vColors.size();
+
+	ofstream fout(filename, ios_base::binary | ios_base::out);
+	if (!fout.is_open())
+		return false;
+	fout.write((const char *)&header, sizeof(header));
+	if (header.numColors)
+		fout.write((const char *)&preset.vColors[0], header.numColors * sizeof(PI_ParticleEmitter::PI_ColorKeyframe));
+	return fout.good();
+}
+
+// Fill a table of colors evenly spaced over the keyframes, so particles can look theirs up.
+// A particle's entry is (life - lifeBase) * lifeScale, rounded and clamped to the table.
+//
+// In:		numSteps		How many entries the table has. At least 2.
+//
+// Out:		pRGBA			numSteps colors, 4 bytes each.
+//			lifeBase		The life of the first entry.
+//			lifeScale		Entries per unit of life.
+//
+// Returns					False if there aren't two keyframes to fade between.
+bool PI_ParticleEmitter::BuildColorTable(unsigned char *pRGBA, unsigned int numSteps, float &lifeBase, float &lifeScale) const
+{
+	// Keyframes are sorted from the most life left to the least.
+	const unsigned int NumColors = (unsigned int)vColors.size();
+	if (NumColors < 2 || vColors[0].lifeTime <= vColors[NumColors - 1].lifeTime)
+		return false;
+
+	lifeBase = vColors[NumColors - 1].lifeTime;
+	lifeScale = (numSteps - 1) / (vColors[0].lifeTime - lifeBase);
+
+	// Walk the keyframes along with the table, interpolating as GetInterpolatedColor does.
+	unsigned int next = NumColors - 1;
+	for (unsigned int s = 0; s < numSteps; ++s)
+	{
+		const float Life = lifeBase + s / lifeScale;
+		while (next > 0 && vColors[next - 1].lifeTime <= Life)
+			--next;
+		const PI_ColorKeyframe &Next = vColors[next], &Prev = vColors[next ? next - 1 : 0];
+		const float Span = Prev.lifeTime - Next.lifeTime, T = Span > 0 ? (Prev.lifeTime - Life) / Span : 1, OMT = 1 - T;
+		for (int c = 0; c < 4; ++c)
+		{
+			const float Val = OMT * Prev.val[c] + T * Next.val[c];
+			pRGBA[s * 4 + c] = (unsigned char)((Val < 0 ? 0 : Val > 1 ? 1 : Val) * 255.0f + 0.5f);
+		}
+	}
+	return true;
+}
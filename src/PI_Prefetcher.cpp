@@ -0,0 +1,298 @@
+// PigIron background asset prefetch implementation.
+
+#include <process.h>
+
+#include "PI_Prefetcher.h"
+#include "PI_Logger.h"
+
+// Is a filename in a list of assets?
+static bool IsListed(const vector<string> &vAssets, const string &filename)
+{
+	const unsigned int NumAssets = (unsigned int)vAssets.size();
+	for (unsigned int i = 0; i < NumAssets; ++i)
+		if (!_stricmp(vAssets[i].c_str(), filename.c_str()))
+			return true;
+	return false;
+}
+
+PI_Prefetcher::PI_Prefetcher(void) : hThread(0), hWakeEvent(0), quit(false), budget(0), cachedBytes(0)
+{
+	InitializeCriticalSection(&cs);
+}
+
+PI_Prefetcher::~PI_Prefetcher(void)
+{
+	Stop();
+	DeleteCriticalSection(&cs);
+}
+
+// Start the worker thread.
+//
+// In:		budget			The most decoded data to hold at once (bytes).
+//
+// Returns					True if the worker thread is running.
+bool PI_Prefetcher::Start(unsigned int budgetBytes)
+{
+	budget = budgetBytes;
+	if (hThread)
+		return true;
+
+	quit = false;
+	if (!(hWakeEvent = CreateEvent(0, FALSE, FALSE, 0)))
+		return false;
+
+	if (!(hThread = (HANDLE)_beginthreadex(0, 0, PrefetchThread, this, 0, 0)))
+	{
+		CloseHandle(hWakeEvent);
+		hWakeEvent = 0;
+		return false;
+	}
+
+	// Prefetching should never hold up the game or the renderer.
+	SetThreadPriority(hThread, THREAD_PRIORITY_LOWEST);
+	return true;
+}
+
+// Stop the worker thread and drop everything cached.
+void PI_Prefetcher::Stop(void)
+{
+	if (hThread)
+	{
+		quit = true;
+		SetEvent(hWakeEvent);
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+		CloseHandle(hWakeEvent);
+		hThread = hWakeEvent = 0;
+	}
+
+	EnterCriticalSection(&cs);
+	vQueue.clear();
+	vResident.clear();
+	const unsigned int NumCached = (unsigned int)vpCache.size();
+	for (unsigned int i = 0; i < NumCached; ++i)
+		delete vpCache[i];
+	vpCache.clear();
+	cachedBytes = 0;
+	LeaveCriticalSection(&cs);
+}
+
+// Replace whatever was being prefetched with a new set of assets.
+// Anything cached that the new set doesn't need is dropped.
+//
+// In:		vAssets			The assets to prefetch, most important first.
+//			vResident		Textures the renderer already has, which meshes needn't bring along.
+void PI_Prefetcher::Prefetch(const vector<string> &vAssets, const vector<string> &vResidentTextures)
+{
+	EnterCriticalSection(&cs);
+	vResident = vResidentTextures;
+
+	// Keep whatever the new set lists, and the textures any kept mesh brought along.
+	vector<string> vNeeded;
+	const unsigned int NumCached = (unsigned int)vpCache.size();
+	for (unsigned int i = 0; i < NumCached; ++i)
+		if (vpCache[i]->isMesh && IsListed(vAssets, vpCache[i]->filename))
+		{
+			const vector<PI_MeshNodeData> &vNodes = vpCache[i]->mesh.vNodes;
+			const unsigned int NumNodes = (unsigned int)vNodes.size();
+			for (unsigned int n = 0; n < NumNodes; ++n)
+			{
+				vNeeded.push_back(vNodes[n].diffTexFilename);
+				vNeeded.push_back(vNodes[n].normTexFilename);
+			}
+		}
+
+	vector<PI_CachedAsset *> vpKept;
+	cachedBytes = 0;
+	for (unsigned int i = 0; i < NumCached; ++i)
+	{
+		PI_CachedAsset *pAsset = vpCache[i];
+		if (IsListed(vAssets, pAsset->filename) || (!pAsset->isMesh && IsListed(vNeeded, pAsset->filename) &&
+																		!IsListed(vResident, pAsset->filename)))
+		{
+			vpKept.push_back(pAsset);
+			cachedBytes += pAsset->bytes;
+		}
+		else
+			delete pAsset;
+	}
+	vpCache.swap(vpKept);
+
+	// Whatever is being decoded right now belongs to the old set.
+	decoding.clear();
+
+	// Only what isn't cached yet needs decoding. Textures kept meshes are still waiting on go first.
+	vQueue.clear();
+	const unsigned int NumAssets = (unsigned int)vAssets.size();
+	for (unsigned int i = 0; i < NumAssets; ++i)
+		if (FindCached(vAssets[i].c_str()) < 0)
+			vQueue.push_back(vAssets[i]);
+	const unsigned int NumNeeded = (unsigned int)vNeeded.size();
+	for (unsigned int i = 0; i < NumNeeded; ++i)
+		if (vNeeded[i].size() && !IsKnown(vNeeded[i]))
+			vQueue.insert(vQueue.begin(), vNeeded[i]);
+	LeaveCriticalSection(&cs);
+
+	if (hWakeEvent)
+		SetEvent(hWakeEvent);
+}
+
+// Take a prefetched texture out of the cache.
+//
+// Out:		out				The decoded image.
+//
+// Returns					True if the texture was cached.
+bool PI_Prefetcher::TakeImage(const char *filename, PI_Image &out)
+{
+	PI_CachedAsset *pAsset = 0;
+	EnterCriticalSection(&cs);
+	const int Index = FindCached(filename);
+	if (Index >= 0 && !vpCache[Index]->isMesh)
+	{
+		pAsset = vpCache[Index];
+		vpCache.erase(vpCache.begin() + Index);
+		cachedBytes -= pAsset->bytes;
+	}
+	LeaveCriticalSection(&cs);
+
+	if (!pAsset)
+		return false;
+	out.width = pAsset->image.width;
+	out.height = pAsset->image.height;
+	out.components = pAsset->image.components;
+	out.format = pAsset->image.format;
+	out.pixels.swap(pAsset->image.pixels);
+	delete pAsset;
+	return true;
+}
+
+// Take a prefetched mesh out of the cache.
+//
+// Out:		out				The decoded mesh.
+//
+// Returns					True if the mesh was cached.
+bool PI_Prefetcher::TakeMesh(const char *filename, PI_MeshData &out)
+{
+	PI_CachedAsset *pAsset = 0;
+	EnterCriticalSection(&cs);
+	const int Index = FindCached(filename);
+	if (Index >= 0 && vpCache[Index]->isMesh)
+	{
+		pAsset = vpCache[Index];
+		vpCache.erase(vpCache.begin() + Index);
+		cachedBytes -= pAsset->bytes;
+	}
+	LeaveCriticalSection(&cs);
+
+	if (!pAsset)
+		return false;
+	out.filename = pAsset->mesh.filename;
+	out.vNodes.swap(pAsset->mesh.vNodes);
+	delete pAsset;
+	return true;
+}
+
+// Worker thread entry point.
+unsigned int __stdcall PI_Prefetcher::PrefetchThread(void *pPrefetcher)
+{
+	((PI_Prefetcher *)pPrefetcher)->Run();
+	_endthreadex(0);
+	return 0;
+}
+
+// Decode queued assets until told to stop.
+void PI_Prefetcher::Run(void)
+{
+	PI_Logger &logger = PI_Logger::GetInstance();
+
+	while (WaitForSingleObject(hWakeEvent, INFINITE) == WAIT_OBJECT_0 && !quit)
+	{
+		while (!quit)
+		{
+			// Take the next asset.
+			EnterCriticalSection(&cs);
+			if (vQueue.empty())
+			{
+				decoding.clear();
+				LeaveCriticalSection(&cs);
+				break;
+			}
+			const string Filename = decoding = vQueue.front();
+			vQueue.erase(vQueue.begin());
+			LeaveCriticalSection(&cs);
+
+			const unsigned int Length = (unsigned int)Filename.length();
+			const char *ext = Length >= 3 ? Filename.c_str() + Length - 3 : "";
+			PI_CachedAsset *pAsset = new PI_CachedAsset;
+			pAsset->filename = Filename;
+			pAsset->bytes = 0;
+
+			bool decoded = false;
+			if (!_stricmp(ext, "tga"))
+			{
+				pAsset->isMesh = false;
+				decoded = PI_LoadTargaData(Filename.c_str(), pAsset->image);
+				pAsset->bytes = (unsigned int)pAsset->image.pixels.size();
+			}
+			else if (!_stricmp(ext, "pim") || !_stricmp(ext, "pwm"))
+			{
+				pAsset->isMesh = true;
+				decoded = PI_LoadPIMData(Filename.c_str(), pAsset->mesh);
+				const unsigned int NumNodes = (unsigned int)pAsset->mesh.vNodes.size();
+				for (unsigned int n = 0; n < NumNodes; ++n)
+					pAsset->bytes += (unsigned int)(pAsset->mesh.vNodes[n].vTris.size() * sizeof(PI_Triangle) +
+													pAsset->mesh.vNodes[n].vEdges.size() * sizeof(PI_Edge));
+			}
+
+			EnterCriticalSection(&cs);
+			if (!decoded || decoding != Filename)
+				// Unreadable, or the set changed while it was being decoded.
+				delete pAsset;
+			else if (cachedBytes + pAsset->bytes > budget)
+			{
+				logger << "PI_Prefetcher skipped " << pAsset->filename << " - it doesn't fit in the budget.\n";
+				delete pAsset;
+			}
+			else
+			{
+				// Meshes depend on their textures, so those are fetched next.
+				if (pAsset->isMesh)
+				{
+					const unsigned int NumNodes = (unsigned int)pAsset->mesh.vNodes.size();
+					for (unsigned int n = 0; n < NumNodes; ++n)
+					{
+						const PI_MeshNodeData &node = pAsset->mesh.vNodes[n];
+						if (node.diffTexFilename.size() && !IsKnown(node.diffTexFilename))
+							vQueue.insert(vQueue.begin(), node.diffTexFilename);
+						if (node.normTexFilename.size() && !IsKnown(node.normTexFilename))
+							vQueue.insert(vQueue.begin(), node.normTexFilename);
+					}
+				}
+				cachedBytes += pAsset->bytes;
+				vpCache.push_back(pAsset);
+			}
+			decoding.clear();
+			LeaveCriticalSection(&cs);
+		}
+	}
+}
+
+// Find a cached asset. The lock must be held.
+//
+// Returns					Its index, or -1 if it isn't cached.
+int PI_Prefetcher::FindCached(const char *filename) const
+{
+	const unsigned int NumCached = (unsigned int)vpCache.size();
+	for (unsigned int i = 0; i < NumCached; ++i)
+		if (!_stricmp(vpCache[i]->filename.c_str(), filename))
+			return (int)i;
+	return -1;
+}
+
+// Is an asset queued, cached, being decoded or already resident? The lock must be held.
+bool PI_Prefetcher::IsKnown(const string &filename) const
+{
+	if (FindCached(filename.c_str()) >= 0 || !_stricmp(decoding.c_str(), filename.c_str()))
+		return true;
+	return IsListed(vQueue, filename) || IsListed(vResident, filename);
+}
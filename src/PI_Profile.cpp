@@ -0,0 +1,168 @@
+// PigIron load and frame profiling implementation.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <fstream>
+using std::ofstream;
+#include <algorithm>
+using std::sort;
+
+#include "PI_Profile.h"
+#include "PI_Logger.h"
+
+// Read a high resolution clock.
+//
+// Returns					Seconds since some arbitrary point. Only differences are meaningful.
+double PI_GetSeconds(void)
+{
+	static LARGE_INTEGER frequency = { 0 };
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return double(now.QuadPart) / double(frequency.QuadPart);
+}
+
+// How long did the asset take altogether?
+double PI_AssetProfile::TotalSeconds(void) const
+{
+	double total = 0;
+	for (int i = 0; i < NumStages; ++i)
+		total += seconds[i];
+	return total;
+}
+
+// Did reading the compressed file and inflating it beat reading the raw bytes?
+// The raw read time is estimated from the throughput of the compressed read.
+bool PI_AssetProfile::CompressionPaidOff(void) const
+{
+	if (!IsCompressed() || !bytes[Read])
+		return false;
+	const double RawReadSeconds = seconds[Read] * bytes[Inflate] / bytes[Read];
+	return seconds[Read] + seconds[Inflate] < RawReadSeconds;
+}
+
+// Find the profile of an asset recorded during this batch.
+//
+// Returns					The profile, or 0 if the asset hasn't been recorded. Only valid until the next Add.
+PI_AssetProfile *PI_LoadProfiler::Find(const char *filename)
+{
+	const unsigned int NumProfiles = (unsigned int)vProfiles.size();
+	for (unsigned int i = 0; i < NumProfiles; ++i)
+		if (vProfiles[i].filename == filename)
+			return &vProfiles[i];
+	return 0;
+}
+
+// Sort profiles slowest first.
+static bool SlowerThan(const PI_AssetProfile *p1, const PI_AssetProfile *p2)
+{
+	return p1->TotalSeconds() > p2->TotalSeconds();
+}
+
+// Start a report with the build that wrote it, so reports from different builds can be compared.
+static void WriteBuildStamp(ofstream &fout)
+{
+	fout << "build," << __DATE__ " " __TIME__ << '\n';
+}
+
+// Write a CSV report with one row per asset, and log a summary.
+//
+// In:		filename		Where to write the report.
+//
+// Returns					True if the report was written.
+bool PI_LoadProfiler::WriteReport(const char *filename) const
+{
+	static const char *StageNames[PI_AssetProfile::NumStages] = { "open", "read", "inflate", "decode", "mipgen", "edges", "upload" };
+	PI_Logger &logger = PI_Logger::GetInstance();
+
+	ofstream fout(filename);
+	if (!fout.is_open())
+	{
+		logger << "Failed to write the load profile " << filename << ".\n";
+		return false;
+	}
+
+	WriteBuildStamp(fout);
+	fout << "asset";
+	for (int s = 0; s < PI_AssetProfile::NumStages; ++s)
+		fout << ',' << StageNames[s] << "_ms," << StageNames[s] << "_bytes";
+	fout << ",total_ms,compression\n";
+
+	vector<const PI_AssetProfile *> vpSorted;
+	double batchSeconds = 0;
+	unsigned int numCompressed = 0, numPaidOff = 0;
+	const unsigned int NumProfiles = (unsigned int)vProfiles.size();
+	for (unsigned int i = 0; i < NumProfiles; ++i)
+	{
+		const PI_AssetProfile &p = vProfiles[i];
+		fout << p.filename;
+		for (int s = 0; s < PI_AssetProfile::NumStages; ++s)
+			fout << ',' << p.seconds[s] * 1000.0 << ',' << p.bytes[s];
+		fout << ',' << p.TotalSeconds() * 1000.0 << ',' << (!p.IsCompressed() ? "none" : p.CompressionPaidOff() ? "paid" : "lost") << '\n';
+
+		if (p.IsCompressed())
+			++numCompressed;
+		if (p.CompressionPaidOff())
+			++numPaidOff;
+
+		batchSeconds += p.TotalSeconds();
+		vpSorted.push_back(&p);
+	}
+	fout.close();
+
+	// Point out the worst offenders in the log.
+	sort(vpSorted.begin(), vpSorted.end(), SlowerThan);
+	logger << "Loaded " << NumProfiles << " assets in " << batchSeconds << " sec. Slowest:\n";
+	for (unsigned int i = 0; i < NumProfiles && i < 5; ++i)
+		logger << '\t' << vpSorted[i]->filename << '\t' << vpSorted[i]->TotalSeconds() << " sec.\n";
+	if (numCompressed)
+		logger << "Compression paid off for " << numPaidOff << " of " << numCompressed << " compressed assets.\n";
+	logger << "Full load profile written to " << filename << ".\n\n";
+	return true;
+}
+
+
+// Write a CSV report with one row per frame, and log a summary with percentiles.
+//
+// In:		filename		Where to write the report.
+//
+// Returns					True if the report was written.
+bool PI_FrameProfiler::WriteReport(const char *filename) const
+{
+	PI_Logger &logger = PI_Logger::GetInstance();
+	const unsigned int NumFrames = (unsigned int)vFrameSeconds.size();
+	if (!NumFrames)
+		return false;
+
+	ofstream fout(filename);
+	if (!fout.is_open())
+	{
+		logger << "Failed to write the frame profile " << filename << ".\n";
+		return false;
+	}
+
+	WriteBuildStamp(fout);
+	fout << "frame,ms\n";
+	double totalSeconds = 0;
+	for (unsigned int i = 0; i < NumFrames; ++i)
+	{
+		fout << i << ',' << vFrameSeconds[i] * 1000.0 << '\n';
+		totalSeconds += vFrameSeconds[i];
+	}
+	fout.close();
+
+	// Percentiles are read from a sorted copy, nearest rank.
+	vector<double> vSorted(vFrameSeconds);
+	sort(vSorted.begin(), vSorted.end());
+	logger << "Rendered " << NumFrames << " frames in " << totalSeconds << " sec. ("
+		   << NumFrames / totalSeconds << " FPS)\n";
+	logger << "Frame ms: min " << vSorted[0] * 1000.0
+		   << ", median " << vSorted[NumFrames / 2] * 1000.0
+		   << ", 95th " << vSorted[NumFrames * 95 / 100] * 1000.0
+		   << ", 99th " << vSorted[NumFrames * 99 / 100] * 1000.0
+		   << ", max " << vSorted[NumFrames - 1] * 1000.0 << '\n';
+	logger << "Full frame profile written to " << filename << ".\n\n";
+	return true;
+}
\ No newline at end of file
@@ -8,10 +8,16 @@ using std::ios;
 using std::ios_base;
 
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+using std::sort;
+using std::unique;
+using std::binary_search;
 
 #include "PI_Render.h"
 #include "PI_Logger.h"
 #include "PI_Utils.h"
+#include "PI_JobPool.h"
 
 #define RGBA_WHITE 1.0f, 1.0f, 1.0f, 1.0f
 #define RGBA_RED 1.0f, 0, 0, 1.0f
@@ -22,8 +28,23 @@ using std::ios_base;
 #define RGB_BLUE 0, 0, 1.0f
 
 PI_Render PI_Render::m_instance;
+const double PI_Render::AssetTimeSlice = 0.010;
+const unsigned int PI_Render::PrefetchBudget = 64 * 1024 * 1024;
+const DWORD PI_Render::FrameWaitTime = 5;
+const unsigned int PI_Render::ShadowMapSize = 2048;
+const float PI_Render::ShadowMapRadius = 60.0f;
+const unsigned int PI_Render::ParticleChunkSize = 1024;
+const unsigned int PI_Render::WorldCullSplitDepth = 4;
 PFNGLACTIVETEXTUREPROC glActiveTextureARB;
-PFNGLMULTITEXCOORD2FPROC glMultiTexCoord2f;
+static PFNGLGENFRAMEBUFFERSEXTPROC glGenFramebuffersPI;
+static PFNGLBINDFRAMEBUFFEREXTPROC glBindFramebufferPI;
+static PFNGLDELETEFRAMEBUFFERSEXTPROC glDeleteFramebuffersPI;
+static PFNGLGENRENDERBUFFERSEXTPROC glGenRenderbuffersPI;
+static PFNGLBINDRENDERBUFFEREXTPROC glBindRenderbufferPI;
+static PFNGLRENDERBUFFERSTORAGEEXTPROC glRenderbufferStoragePI;
+static PFNGLDELETERENDERBUFFERSEXTPROC glDeleteRenderbuffersPI;
+static PFNGLFRAMEBUFFERRENDERBUFFEREXTPROC glFramebufferRenderbufferPI;
+static PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC glCheckFramebufferStatusPI;
 extern CRITICAL_SECTION g_cs;
 
 // BEGIN PUBLIC MEMBER FUNCTIONS
@@ -114,20 +135,28 @@ bool PI_Render::Init(void)
 	return true;
 }
 
-// Commit all changes to the render list and render the current frame to the screen.
-void PI_Render::CommitFrame(void)
+// Render into an offscreen buffer instead of the window, and time a number of frames
+// once there's a scene to draw. The timings are written to benchmark.csv.
+// Must be called before Init.
+//
+// In:		width, height	The size of the offscreen buffer.
+//			numFrames		How many frames to time.
+//			nullRender		Build every frame without drawing it, to time the CPU alone?
+void PI_Render::SetBenchmark(int width, int height, unsigned int numFrames, bool nullRender)
 {
-	EnterCriticalSection(&g_cs);
-	state = CommitFrameState;
-	LeaveCriticalSection(&g_cs);
+	offscreenWidth = width;
+	offscreenHeight = height;
+	pBackend = nullRender ? (PI_RenderBackend *)&nullBackend : &glBackend;
+	frameProfiler.Start(numFrames);
+	benchmarkFinished = false;
 }
 
-// Tell the renderer to calculate and apply the camera during the next update.
-void PI_Render::SetUpdateCameraState(void)
+// Publish the recorded frame, along with the GUI drawn since the last one.
+// The render thread draws the newest frame it's been given, so this never waits on it.
+void PI_Render::CommitFrame(void)
 {
-	EnterCriticalSection(&g_cs);
-	state = UpdateCameraState;
-	LeaveCriticalSection(&g_cs);
+	gui.TakeFrame(frameQueue.GetWritePacket().gui);
+	frameQueue.Publish();
 }
 
 // Tell the renderer to unload all assets during the next update.
@@ -154,17 +183,30 @@ bool PI_Render::Update(void)
 	//EnterCriticalSection(&cs);
 	switch (state)
 	{
-	case LoadAssetState:
-		if (!LoadAssetList())
-			ERRORBOX("PI_Render::LoadAssetList() failed!\n");
-		break;
-	case UpdateCameraState:
-		ApplyCamera();
-		break;
-	case CommitFrameState:
-		RenderScene();
+	case ReadyState:
+		// Draw the newest frame the game has finished, if it hasn't been drawn already.
+		if ((pFrame = frameQueue.AcquireLatest()) != 0)
+			RenderScene();
+
+		// Stream in some assets between frames, or sleep until the next frame if there's nothing to load.
+		if (numPendingRequests)
+			ProcessAssetRequests();
+		else
+		{
+			// A level that lists no assets never finishes a batch, so what the last one used is released here.
+			if (releasePending)
+			{
+				EnterCriticalSection(&g_cs);
+				if (releasePending && !numPendingRequests)
+					ReleaseUnusedAssets();
+				LeaveCriticalSection(&g_cs);
+			}
+			frameQueue.WaitForPublish(FrameWaitTime);
+		}
 		break;
 	case UnloadAssetState:
+		// Frames published before now may name what's being released.
+		frameQueue.AcquireLatest();
 		UnloadAllAssets();
 		break;
 	case ShutdownState:
@@ -174,15 +216,134 @@ bool PI_Render::Update(void)
 	return true;
 }
 
-// Set the asset list to load.
-void PI_Render::SetAssetList(const vector<string> *assetList)
+// Queue an asset to be loaded - can be a mesh, texture or world geometry.
+// Requests are loaded a few at a time between frames, so this returns immediately.
+//
+// In:		filename		Name of desired file, can be relative or absolute.
+//			priority		How soon it's needed.
+//			callback		Called when the request is finished. May be 0.
+//			pUserData		Passed to the callback.
+//
+// Returns					A handle for GetRequestStatus. Never 0.
+unsigned int PI_Render::RequestAsset(const char *filename, AssetPriority priority, AssetCallback callback, void *pUserData)
+{
+	EnterCriticalSection(&g_cs);
+
+	// Start a new batch once the last one has finished.
+	if (!numPendingRequests)
+	{
+		firstRequest += (unsigned int)vRequests.size();
+		vRequests.clear();
+	}
+
+	PI_AssetRequest request = { filename, priority, callback, pUserData, RequestPending };
+	vRequests.push_back(request);
+	numBatchRequests = (LONG)vRequests.size();
+	InterlockedIncrement(&numPendingRequests);
+	const unsigned int Handle = firstRequest + (unsigned int)vRequests.size() - 1;
+
+	LeaveCriticalSection(&g_cs);
+	return Handle;
+}
+
+// Accessor for the state of an asset request.
+//
+// In:		request			A handle returned by RequestAsset.
+//
+// Returns					The request's status, or RequestUnknown once a newer batch has started.
+PI_Render::RequestStatus PI_Render::GetRequestStatus(unsigned int request) const
+{
+	RequestStatus status = RequestUnknown;
+	EnterCriticalSection(&g_cs);
+	if (request >= firstRequest && request - firstRequest < vRequests.size())
+		status = vRequests[request - firstRequest].status;
+	LeaveCriticalSection(&g_cs);
+	return status;
+}
+
+// Make a level's assets resident, and release whatever the previous level used that this one doesn't.
+// Each asset is requested as with RequestAsset, so anything both levels share is already resident
+// and finishes straight away. The release happens once the batch of requests has finished.
+//
+// In:		vAssets			Every asset the level lists.
+//			callback		Called as each request is finished. May be 0.
+//			pUserData		Passed to the callback.
+void PI_Render::RequestLevelAssets(const vector<string> &vAssets, AssetCallback callback, void *pUserData)
+{
+	EnterCriticalSection(&g_cs);
+	vLevelAssets = vAssets;
+	releasePending = true;
+
+	const unsigned int NumAssets = (unsigned int)vAssets.size();
+	for (unsigned int i = 0; i < NumAssets; ++i)
+		RequestAsset(vAssets[i].c_str(), PriorityNormal, callback, pUserData);
+	LeaveCriticalSection(&g_cs);
+}
+
+// Read and decode assets that will be needed soon in the background, so that loading
+// them later only has to upload them. Assets that are already resident are skipped.
+//
+// In:		vAssets			The assets to prefetch, most important first.
+void PI_Render::PrefetchAssets(const vector<string> &vAssets)
+{
+	if (!prefetcher.Start(PrefetchBudget))
+		return;
+
+	// The resident textures go along too, so the textures of prefetched meshes can be skipped.
+	vector<string> vMissing, vResidentTextures;
+	EnterCriticalSection(&g_cs);
+	const unsigned int NumTextures = (unsigned int)vTextures.size();
+	vResidentTextures.reserve(NumTextures);
+	for (unsigned int t = 0; t < NumTextures; ++t)
+		vResidentTextures.push_back(vTextures[t].filename);
+
+	const unsigned int NumAssets = (unsigned int)vAssets.size();
+	for (unsigned int i = 0; i < NumAssets; ++i)
+	{
+		bool resident = false;
+		for (unsigned int t = 0; t < NumTextures && !resident; ++t)
+			resident = !_stricmp(vTextures[t].filename.c_str(), vAssets[i].c_str());
+		const unsigned int NumMeshes = (unsigned int)vMeshes.size();
+		for (unsigned int m = 0; m < NumMeshes && !resident; ++m)
+			resident = !_stricmp(vMeshes[m].filename.c_str(), vAssets[i].c_str());
+		if (!resident)
+			vMissing.push_back(vAssets[i]);
+	}
+	LeaveCriticalSection(&g_cs);
+
+	prefetcher.Prefetch(vMissing, vResidentTextures);
+}
+
+// Keep an asset resident across level changes, whether or not the levels list it.
+void PI_Render::PinAsset(const char *filename)
 {
 	EnterCriticalSection(&g_cs);
-	vpAssetList = assetList;
-	state = LoadAssetState;
+	vPinnedAssets.push_back(filename);
 	LeaveCriticalSection(&g_cs);
 }
 
+// How far along is the current batch of asset requests?
+// A batch runs from the first request made while nothing is pending until every request is finished.
+//
+// Out:		numFinished		How many requests have been loaded or have failed.
+//			numRequested	How many requests are in the batch.
+void PI_Render::GetAssetProgress(unsigned int &numFinished, unsigned int &numRequested) const
+{
+	// Nothing to lock - loading only ever lowers the pending count.
+	numRequested = (unsigned int)numBatchRequests;
+	numFinished = numRequested - (unsigned int)numPendingRequests;
+}
+
+// Watch a directory for changed assets, and swap them in as they change.
+//
+// In:		directory		The directory asset filenames start with, e.g. "DATA".
+//
+// Returns					True if the directory is being watched.
+bool PI_Render::WatchAssetDirectory(const char *directory)
+{
+	return assetWatcher.Start(directory);
+}
+
 // Accessor for loaded mesh hierarchies.
 //
 // In:		filename	What's it called?
@@ -192,17 +353,19 @@ void PI_Render::SetAssetList(const vector<string> *assetList)
 // Returns				True if the mesh was found.
 bool PI_Render::GetMeshHandle(const char *filename, PI_Mesh &out) const
 {
+	// The render thread can be adding or releasing meshes.
+	bool found = false;
+	EnterCriticalSection(&g_cs);
 	const unsigned int NumMeshes = (unsigned int)vMeshes.size();
-	for (unsigned int i = 0; i < NumMeshes; i++)
+	for (unsigned int i = 0; i < NumMeshes && !found; i++)
 		if (!strcmp(filename, vMeshes[i].filename.c_str()))
 		{
 			// Found it!
 			out = vMeshes[i];
-			return true;
+			found = true;
 		}
-
-	// Mesh not found!
-	return false;
+	LeaveCriticalSection(&g_cs);
+	return found;
 }
 
 // Accessor for loaded textures.
@@ -214,17 +377,131 @@ bool PI_Render::GetMeshHandle(const char *filename, PI_Mesh &out) const
 // Returns				True if the texture was found.
 bool PI_Render::GetTextureHandle(const char *filename, unsigned int &texName) const
 {
-	// Don't reload a texture that's already resident.
+	// The render thread can be adding or releasing textures.
+	bool found = false;
+	EnterCriticalSection(&g_cs);
 	const unsigned int NumTextures = (unsigned int)vTextures.size();
-	for (unsigned int i = 0; i < NumTextures; i++)
+	for (unsigned int i = 0; i < NumTextures && !found; i++)
+		if (!strcmp(vTextures[i].filename.c_str(), filename))
+		{
+			texName = vTextures[i].texName;
+			found = true;
+		}
+	LeaveCriticalSection(&g_cs);
+	return found;
+}
+
+// Accessor for where a loaded texture is drawn from. Textures packed into an atlas share a page.
+//
+// In:		filename	What's it called?
+//
+// Out:		texName		The texture to bind.
+//			region		Where the image is in that texture. The whole texture unless it's in an atlas.
+//
+// Returns				True if the texture was found.
+bool PI_Render::GetTextureRegion(const char *filename, unsigned int &texName, PI_AtlasRegion &region) const
+{
+	// The render thread can be adding or releasing textures.
+	bool found = false;
+	EnterCriticalSection(&g_cs);
+	const unsigned int NumTextures = (unsigned int)vTextures.size();
+	for (unsigned int i = 0; i < NumTextures && !found; i++)
 		if (!strcmp(vTextures[i].filename.c_str(), filename))
 		{
 			texName = vTextures[i].texName;
+			region = vTextures[i].region;
+			found = true;
+		}
+	LeaveCriticalSection(&g_cs);
+	return found;
+}
+
+// Load an atlas descriptor, and pack the images it lists into shared pages.
+// Images that are already resident keep their own textures, and images that can't
+// be packed are left to load on their own.
+//
+// In:		filename		Name of desired file, can be relative or absolute.
+//
+// Returns					True if the atlas was loaded successfully (or is already loaded)
+bool PI_Render::LoadAtlas(const char *filename)
+{
+	const unsigned int NumTextures = (unsigned int)vTextures.size();
+	for (unsigned int i = 0; i < NumTextures; i++)
+		if (vTextures[i].filename == filename)
 			return true;
+
+	// The descriptor reads like a level script: a count, then one image per line.
+	ifstream fin(filename, ios_base::in);
+	if (!fin.is_open())
+		return false;
+	unsigned int numImages = 0;
+	(fin >> numImages).get();
+
+	PI_Logger &logger = PI_Logger::GetInstance();
+	PI_AtlasBuilder builder;
+	PI_Image image;
+	string imageName;
+	for (unsigned int i = 0; i < numImages && getline(fin, imageName); i++)
+	{
+		unsigned int ignoreTexName;
+		if (GetTextureHandle(imageName.c_str(), ignoreTexName))
+		{
+			logger << imageName << " is already resident, so it was left out of " << filename << ".\n";
+			continue;
 		}
 
-		// Texture not found!
+		PI_AssetProfile profile(imageName.c_str());
+		if (prefetcher.TakeImage(imageName.c_str(), image))
+			++numPrefetchHits;
+		else if (!PI_LoadTargaData(imageName.c_str(), image, &profile))
+			continue;
+		loadProfiler.Add(profile);
+
+		if (!builder.Add(imageName.c_str(), image))
+			logger << imageName << " is too large to share a page in " << filename << ".\n";
+	}
+	fin.close();
+
+	builder.Pack();
+	const unsigned int NumPages = builder.GetNumPages();
+	if (!NumPages)
 		return false;
+
+	// Upload the pages. Each is listed under the descriptor's name, so the atlas is released as a whole.
+	PI_AssetProfile profile(filename);
+	vector<GLuint> vPageNames(NumPages);
+	PI_Image page;
+	for (unsigned int p = 0; p < NumPages; p++)
+	{
+		builder.BuildPage(p, page);
+		glGenTextures(1, &vPageNames[p]);
+		UploadTexture(vPageNames[p], page, false, &profile);
+	}
+	loadProfiler.Add(profile);
+
+	// The game thread looks textures up under the lock.
+	EnterCriticalSection(&g_cs);
+	for (unsigned int p = 0; p < NumPages; p++)
+	{
+		PI_TexID pageID = {filename, vPageNames[p], false, 0, true};
+		vTextures.push_back(pageID);
+	}
+
+	// The images are found by their own names, and drawn from their pages.
+	const vector<PI_AtlasBuilder::PI_Placement> &vPlacements = builder.GetPlacements();
+	const unsigned int NumPlacements = (unsigned int)vPlacements.size();
+	for (unsigned int i = 0; i < NumPlacements; i++)
+	{
+		const PI_AtlasBuilder::PI_Placement &placement = vPlacements[i];
+		PI_TexID texID = {placement.name, vPageNames[placement.page], false, 0, true,
+						  placement.x, placement.y, placement.width, placement.height, placement.region};
+		vTextures.push_back(texID);
+	}
+	LeaveCriticalSection(&g_cs);
+
+	logger << "Packed " << NumPlacements << " images from " << filename << " into " << NumPages << ' '
+		   << builder.GetPageSize() << 'x' << builder.GetPageSize() << " pages.\n";
+	return true;
 }
 
 // Find the first point of intersection between a ray and the world.
@@ -279,8 +556,14 @@ void PI_Render::Shutdown(void)
 	pActiveCam = 0;
 	pActiveDLight = 0;
 
+	// Stop watching for changed assets, and stop prefetching.
+	assetWatcher.Stop();
+	prefetcher.Stop();
+
 	// Unload everything.
 	UnloadAllAssets();
+	pBackend->Shutdown();
+	ReleaseOffscreenTarget();
 
 	// Unbind and free the rendering context.
 	if (m_HGLRC)
@@ -322,7 +605,26 @@ bool PI_Render::InitOpenGL(void)
 	if (!strstr(extstr, "ARB_multitexture"))
 		return false;
 	glActiveTextureARB = (PFNGLCLIENTACTIVETEXTUREPROC)wglGetProcAddress("glActiveTextureARB");
-	glMultiTexCoord2f = (PFNGLMULTITEXCOORD2FPROC)wglGetProcAddress("glMultiTexCoord2f");
+
+	// Static geometry lives in buffer objects, or vertex arrays without them.
+	if (!PI_InitGeometryBuffers())
+		PI_Logger::GetInstance() << "Buffer objects are unavailable - static geometry will be drawn from system memory.\n";
+
+	// Frames are drawn by the GL, unless they're only being timed.
+	pBackend->Init(m_HDC);
+	if (pBackend == &nullBackend)
+		PI_Logger::GetInstance() << "Using the null render backend - frames are built but not drawn.\n";
+	if (shadowTechnique == ShadowMaps && !pBackend->CreateShadowMap(ShadowMapSize))
+	{
+		PI_Logger::GetInstance() << "Shadow maps are unavailable - shadows will be drawn with stencil volumes.\n";
+		shadowTechnique = ShadowVolumes;
+	}
+
+	// Set the swap interval either way, as drivers don't agree on a default.
+	typedef BOOL (WINAPI *PFNWGLSWAPINTERVALPROC)(int interval);
+	PFNWGLSWAPINTERVALPROC wglSwapIntervalPI = (PFNWGLSWAPINTERVALPROC)wglGetProcAddress("wglSwapIntervalEXT");
+	if ((!wglSwapIntervalPI || !wglSwapIntervalPI(vsync ? 1 : 0)) && vsync)
+		PI_Logger::GetInstance() << "VSync is unavailable - presents won't wait for the display.\n";
 
 	// Back buffer clear color
 	glClearColor(0,0,0,1);
@@ -354,6 +656,10 @@ bool PI_Render::InitOpenGL(void)
 	// Necessary for lighting the world geometry correctly.
 	glEnable(GL_COLOR_MATERIAL);
 
+	// Benchmarks never show the window, so they draw somewhere that's always rendered to.
+	if (offscreenWidth && !CreateOffscreenTarget())
+		PI_Logger::GetInstance() << "Offscreen buffers are unavailable - the benchmark will draw to the hidden window.\n";
+
 	UpdateViewport();
 	return true;
 }
@@ -415,10 +721,18 @@ void PI_Render::LogOpenGLErrors(const char *function) const
 // Update the renderer's viewport.
 void PI_Render::UpdateViewport(void)
 {
-	RECT rClient;
-	GetClientRect(m_HWND, &rClient);
-	m_width = rClient.right;
-	m_height = rClient.bottom;
+	if (offscreenWidth)
+	{
+		m_width = offscreenWidth;
+		m_height = offscreenHeight;
+	}
+	else
+	{
+		RECT rClient;
+		GetClientRect(m_HWND, &rClient);
+		m_width = rClient.right;
+		m_height = rClient.bottom;
+	}
 
 	if (!m_width || !m_height)
 		return;
@@ -435,110 +749,261 @@ void PI_Render::UpdateViewport(void)
 	glLoadIdentity();
 }
 
-// Apply the camera and build its frustum planes.
-void PI_Render::ApplyCamera(void)
+// Create the offscreen buffer benchmarks render into, and make it the draw target.
+//
+// Returns					True if successful. Frames are drawn to the hidden window otherwise.
+bool PI_Render::CreateOffscreenTarget(void)
 {
-	EnterCriticalSection(&g_cs);
-	if (!pActiveCam) {
-		LeaveCriticalSection(&g_cs);
-		return;
+	const char *extstr = (const char *)glGetString(GL_EXTENSIONS);
+	if (!strstr(extstr, "EXT_framebuffer_object") || !strstr(extstr, "EXT_packed_depth_stencil"))
+		return false;
+
+	glGenFramebuffersPI = (PFNGLGENFRAMEBUFFERSEXTPROC)PI_GetGLProc("glGenFramebuffers", "glGenFramebuffersEXT");
+	glBindFramebufferPI = (PFNGLBINDFRAMEBUFFEREXTPROC)PI_GetGLProc("glBindFramebuffer", "glBindFramebufferEXT");
+	glDeleteFramebuffersPI = (PFNGLDELETEFRAMEBUFFERSEXTPROC)PI_GetGLProc("glDeleteFramebuffers", "glDeleteFramebuffersEXT");
+	glGenRenderbuffersPI = (PFNGLGENRENDERBUFFERSEXTPROC)PI_GetGLProc("glGenRenderbuffers", "glGenRenderbuffersEXT");
+	glBindRenderbufferPI = (PFNGLBINDRENDERBUFFEREXTPROC)PI_GetGLProc("glBindRenderbuffer", "glBindRenderbufferEXT");
+	glRenderbufferStoragePI = (PFNGLRENDERBUFFERSTORAGEEXTPROC)PI_GetGLProc("glRenderbufferStorage", "glRenderbufferStorageEXT");
+	glDeleteRenderbuffersPI = (PFNGLDELETERENDERBUFFERSEXTPROC)PI_GetGLProc("glDeleteRenderbuffers", "glDeleteRenderbuffersEXT");
+	glFramebufferRenderbufferPI = (PFNGLFRAMEBUFFERRENDERBUFFEREXTPROC)PI_GetGLProc("glFramebufferRenderbuffer", "glFramebufferRenderbufferEXT");
+	glCheckFramebufferStatusPI = (PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC)PI_GetGLProc("glCheckFramebufferStatus", "glCheckFramebufferStatusEXT");
+	if (!glGenFramebuffersPI || !glBindFramebufferPI || !glDeleteFramebuffersPI || !glGenRenderbuffersPI || !glBindRenderbufferPI ||
+		!glRenderbufferStoragePI || !glDeleteRenderbuffersPI || !glFramebufferRenderbufferPI || !glCheckFramebufferStatusPI)
+		return false;
+
+	// Shadow volumes need the stencil buffer as much as the depth buffer.
+	glGenRenderbuffersPI(1, &offscreenColor);
+	glBindRenderbufferPI(GL_RENDERBUFFER_EXT, offscreenColor);
+	glRenderbufferStoragePI(GL_RENDERBUFFER_EXT, GL_RGBA8, offscreenWidth, offscreenHeight);
+	glGenRenderbuffersPI(1, &offscreenDepthStencil);
+	glBindRenderbufferPI(GL_RENDERBUFFER_EXT, offscreenDepthStencil);
+	glRenderbufferStoragePI(GL_RENDERBUFFER_EXT, GL_DEPTH24_STENCIL8_EXT, offscreenWidth, offscreenHeight);
+	glBindRenderbufferPI(GL_RENDERBUFFER_EXT, 0);
+
+	glGenFramebuffersPI(1, &offscreenFramebuffer);
+	glBindFramebufferPI(GL_FRAMEBUFFER_EXT, offscreenFramebuffer);
+	glFramebufferRenderbufferPI(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, offscreenColor);
+	glFramebufferRenderbufferPI(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, offscreenDepthStencil);
+	glFramebufferRenderbufferPI(GL_FRAMEBUFFER_EXT, GL_STENCIL_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, offscreenDepthStencil);
+	if (glCheckFramebufferStatusPI(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT)
+	{
+		ReleaseOffscreenTarget();
+		return false;
 	}
 
-	glLoadIdentity();	
-	gluLookAt(pActiveCam->pos.x, pActiveCam->pos.y, pActiveCam->pos.z,
-			  pActiveCam->target.x, pActiveCam->target.y, pActiveCam->target.z,
-			  pActiveCam->up.x, pActiveCam->up.y, pActiveCam->up.z);
-
-	// Combine the modelview and projection matricies, and use the result to extract the frustum planes.
-	PI_Mat44 modelviewMat, worldSpaceMat;
-	glGetFloatv(GL_MODELVIEW_MATRIX, modelviewMat);
-	worldSpaceMat = projectionMat * modelviewMat;
-
-	pActiveCam->frustumPlanes[PlaneLeft].normal.x = worldSpaceMat.mat[3] + worldSpaceMat.mat[0];
-	pActiveCam->frustumPlanes[PlaneLeft].normal.y = worldSpaceMat.mat[7] + worldSpaceMat.mat[4];
-	pActiveCam->frustumPlanes[PlaneLeft].normal.z = worldSpaceMat.mat[11] + worldSpaceMat.mat[8];
-	pActiveCam->frustumPlanes[PlaneLeft].d = worldSpaceMat.mat[15] + worldSpaceMat.mat[12];
-
-	pActiveCam->frustumPlanes[PlaneRight].normal.x = worldSpaceMat.mat[3] - worldSpaceMat.mat[0];
-	pActiveCam->frustumPlanes[PlaneRight].normal.y = worldSpaceMat.mat[7] - worldSpaceMat.mat[4];
-	pActiveCam->frustumPlanes[PlaneRight].normal.z = worldSpaceMat.mat[11] - worldSpaceMat.mat[8];
-	pActiveCam->frustumPlanes[PlaneRight].d = worldSpaceMat.mat[15] - worldSpaceMat.mat[12];
-
-	pActiveCam->frustumPlanes[PlaneBottom].normal.x = worldSpaceMat.mat[3] + worldSpaceMat.mat[1];
-	pActiveCam->frustumPlanes[PlaneBottom].normal.y = worldSpaceMat.mat[7] + worldSpaceMat.mat[5];
-	pActiveCam->frustumPlanes[PlaneBottom].normal.z = worldSpaceMat.mat[11] + worldSpaceMat.mat[9];
-	pActiveCam->frustumPlanes[PlaneBottom].d = worldSpaceMat.mat[15] + worldSpaceMat.mat[13];
-	
-	pActiveCam->frustumPlanes[PlaneTop].normal.x = worldSpaceMat.mat[3] - worldSpaceMat.mat[1];
-	pActiveCam->frustumPlanes[PlaneTop].normal.y = worldSpaceMat.mat[7] - worldSpaceMat.mat[5];
-	pActiveCam->frustumPlanes[PlaneTop].normal.z = worldSpaceMat.mat[11] - worldSpaceMat.mat[9];
-	pActiveCam->frustumPlanes[PlaneTop].d = worldSpaceMat.mat[15] - worldSpaceMat.mat[13];
-
-	pActiveCam->frustumPlanes[PlaneNear].normal.x = worldSpaceMat.mat[3] + worldSpaceMat.mat[2];
-	pActiveCam->frustumPlanes[PlaneNear].normal.y = worldSpaceMat.mat[7] + worldSpaceMat.mat[6];
-	pActiveCam->frustumPlanes[PlaneNear].normal.z = worldSpaceMat.mat[11] + worldSpaceMat.mat[10];
-	pActiveCam->frustumPlanes[PlaneNear].d = worldSpaceMat.mat[15] + worldSpaceMat.mat[14];
-
-	pActiveCam->frustumPlanes[PlaneFar].normal.x = worldSpaceMat.mat[3] - worldSpaceMat.mat[2];
-	pActiveCam->frustumPlanes[PlaneFar].normal.y = worldSpaceMat.mat[7] - worldSpaceMat.mat[6];
-	pActiveCam->frustumPlanes[PlaneFar].normal.z = worldSpaceMat.mat[11] - worldSpaceMat.mat[10];
-	pActiveCam->frustumPlanes[PlaneFar].d = worldSpaceMat.mat[15] - worldSpaceMat.mat[14];
-	
-	for (int i = 0; i < 6; ++i)
-		pActiveCam->frustumPlanes[i].Normalize();
+	// Everything is drawn here from now on.
+	return true;
+}
 
-	// There may be a frame pending...
-	if (vpRenderList->size())
-		state = CommitFrameState;
-	else
-		state = ReadyState;
-	LeaveCriticalSection(&g_cs);
+// Release the offscreen buffer.
+void PI_Render::ReleaseOffscreenTarget(void)
+{
+	if (!offscreenFramebuffer && !offscreenColor && !offscreenDepthStencil)
+		return;
+
+	glBindFramebufferPI(GL_FRAMEBUFFER_EXT, 0);
+	if (offscreenFramebuffer)
+		glDeleteFramebuffersPI(1, &offscreenFramebuffer);
+	if (offscreenColor)
+		glDeleteRenderbuffersPI(1, &offscreenColor);
+	if (offscreenDepthStencil)
+		glDeleteRenderbuffersPI(1, &offscreenDepthStencil);
+	offscreenFramebuffer = offscreenColor = offscreenDepthStencil = 0;
 }
 
-// Load a list of assets - meshes, textures and world geometry.
-//
-// Returns				True if ALL assets are loaded.
-bool PI_Render::LoadAssetList(void)
+// Load the active camera's view and projection.
+// The frustum planes were built on the game thread, along with the view.
+void PI_Render::ApplyCamera(void)
 {
-	EnterCriticalSection(&g_cs);
-	bool foundAllAssets = true;
-	unsigned int ignoreTexName;
-	PI_Mesh ignoreMesh;
-	const char *ext;
+	pBackend->SetCamera(pActiveCam->projectionMat, pActiveCam->viewMat);
+}
+
+// Load the most important asset requests until the time slice runs out.
+void PI_Render::ProcessAssetRequests(void)
+{
+	// Don't bother locking anything when there's nothing to do.
+	if (!numPendingRequests)
+		return;
 
-	const unsigned int NumAssets = (unsigned int)vpAssetList->size();
-	for (unsigned int i = 0; i < NumAssets; i++)
+	PI_Logger &logger = PI_Logger::GetInstance();
+	const double Start = PI_GetSeconds();
+	do
 	{
-		// Get a pointer to the extension.
-		ext = (*vpAssetList)[i].c_str();
-		ext += (*vpAssetList)[i].length() - 3;
+		// Take the oldest of the most important requests. The batch can't be cleared while
+		// it's pending, so its index stays good, but the request itself can move as more are made.
+		EnterCriticalSection(&g_cs);
+		unsigned int index = 0;
+		const unsigned int NumRequests = (unsigned int)vRequests.size();
+		for (unsigned int i = 0; i < NumRequests; ++i)
+			if (vRequests[i].status == RequestPending && (vRequests[index].status != RequestPending || vRequests[i].priority > vRequests[index].priority))
+				index = i;
+		const string Filename = vRequests[index].filename;
+		AssetCallback callback = vRequests[index].callback;
+		void *pUserData = vRequests[index].pUserData;
+		LeaveCriticalSection(&g_cs);
 
-		if (!_stricmp(ext, "tga"))
+		// Loading takes the lock only to change the asset tables, so the game thread
+		// isn't held up while files are read, decoded and uploaded.
+		const bool Loaded = LoadAsset(Filename.c_str());
+		if (!Loaded)
+			logger << "PI_Render failed to load requested asset " << Filename << ".\n";
+
+		// The callback runs before the request is finished, so by the time the batch
+		// shows as finished, every callback has seen its result.
+		if (callback)
+			callback(Filename.c_str(), Loaded, pUserData);
+
+		EnterCriticalSection(&g_cs);
+		vRequests[index].status = Loaded ? RequestLoaded : RequestFailed;
+
+		// Report where the time went once the whole batch is in.
+		if (!InterlockedDecrement(&numPendingRequests))
 		{
-			// Targa texture.
-			if (!LoadTarga((*vpAssetList)[i].c_str(), ignoreTexName, true))
-				foundAllAssets = false;
-			continue;
+			loadProfiler.WriteReport("loadprofile.csv");
+			loadProfiler.Clear();
+
+			logger << "Content hashing shared " << numSharedTextures << " textures and " << numSharedNodes;
+			logger << " mesh nodes, saving " << sharedBytes << " bytes.\n";
+			logger << numPrefetchHits << " assets were already decoded by the prefetcher.\n\n";
+			numSharedTextures = numSharedNodes = sharedBytes = numPrefetchHits = 0;
+
+			// The new level is in, so the last one's leftovers can go.
+			if (releasePending)
+				ReleaseUnusedAssets();
 		}
-		else if (!_stricmp(ext, "pim"))
+		LeaveCriticalSection(&g_cs);
+	}
+	while (numPendingRequests && PI_GetSeconds() - Start < AssetTimeSlice);
+}
+
+// Is a filename in a list of assets?
+static bool IsListed(const vector<string> &vAssets, const string &filename)
+{
+	const unsigned int NumAssets = (unsigned int)vAssets.size();
+	for (unsigned int i = 0; i < NumAssets; ++i)
+		if (!_stricmp(vAssets[i].c_str(), filename.c_str()))
+			return true;
+	return false;
+}
+
+// Release every asset that isn't listed by the current level or pinned, and isn't used by one that is.
+void PI_Render::ReleaseUnusedAssets(void)
+{
+	releasePending = false;
+
+	// Frames published before now may name what's being released.
+	frameQueue.AcquireLatest();
+
+	// Mark everything the kept meshes use, including textures their files name.
+	vector<PI_Mesh> vKeptMeshes;
+	vector<unsigned int> vKeptTexNames, vKeptGeometry, vDeadNames, vDeadGeometry;
+	bool releaseWorld = false;
+	const unsigned int NumMeshes = (unsigned int)vMeshes.size();
+	for (unsigned int i = 0; i < NumMeshes; i++)
+	{
+		const PI_Mesh &mesh = vMeshes[i];
+		const bool Keep = IsListed(vLevelAssets, mesh.filename) || IsListed(vPinnedAssets, mesh.filename);
+		if (Keep)
+			vKeptMeshes.push_back(mesh);
+		else if (mesh.filename == worldFilename)
+			releaseWorld = true;
+
+		for (unsigned int n = 0; n < mesh.numNodes; n++)
 		{
-			// PigIron Mesh file.
-			if (!LoadPIM((*vpAssetList)[i].c_str(), ignoreMesh))
-				foundAllAssets = false;
-			continue;
+			const PI_MeshNode &node = mesh.pNodes[n];
+			if (Keep)
+			{
+				vKeptTexNames.push_back(node.diffTexName);
+				vKeptTexNames.push_back(node.normalTexName);
+				vKeptGeometry.push_back(node.geometry);
+			}
+			else if (node.geometry)
+				vDeadGeometry.push_back(node.geometry);
 		}
-		else if (!_stricmp(ext, "pwm"))
-		{
-			// PigIron World Mesh.
-			if (!LoadWorldPIM((*vpAssetList)[i].c_str()))
-				foundAllAssets = false;
+	}
+
+	const unsigned int NumTextures = (unsigned int)vTextures.size();
+	for (unsigned int i = 0; i < NumTextures; i++)
+		if (IsListed(vLevelAssets, vTextures[i].filename) || IsListed(vPinnedAssets, vTextures[i].filename))
+			vKeptTexNames.push_back(vTextures[i].texName);
+	sort(vKeptTexNames.begin(), vKeptTexNames.end());
+	sort(vKeptGeometry.begin(), vKeptGeometry.end());
+
+	// Sweep the textures. Names shared with a kept texture stay alive.
+	vector<PI_TexID> vKeptTextures;
+	for (unsigned int i = 0; i < NumTextures; i++)
+		if (binary_search(vKeptTexNames.begin(), vKeptTexNames.end(), vTextures[i].texName))
+			vKeptTextures.push_back(vTextures[i]);
+		else
+			vDeadNames.push_back(vTextures[i].texName);
+	sort(vDeadNames.begin(), vDeadNames.end());
+	vDeadNames.erase(unique(vDeadNames.begin(), vDeadNames.end()), vDeadNames.end());
+	const unsigned int NumDeadNames = (unsigned int)vDeadNames.size();
+	for (unsigned int i = 0; i < NumDeadNames; i++)
+		glDeleteTextures(1, &vDeadNames[i]);
+
+	// Sweep the meshes. Geometry shared with a kept node stays alive.
+	sort(vDeadGeometry.begin(), vDeadGeometry.end());
+	vDeadGeometry.erase(unique(vDeadGeometry.begin(), vDeadGeometry.end()), vDeadGeometry.end());
+	unsigned int numDeadGeometry = 0;
+	const unsigned int NumDeadGeometry = (unsigned int)vDeadGeometry.size();
+	for (unsigned int i = 0; i < NumDeadGeometry; i++)
+	{
+		if (binary_search(vKeptGeometry.begin(), vKeptGeometry.end(), vDeadGeometry[i]))
 			continue;
-		}
+		DeleteGeometry(vDeadGeometry[i]);
+		for (map<ULONGLONG, unsigned int>::iterator h = meshNodeHashes.begin(); h != meshNodeHashes.end(); )
+			if (h->second == vDeadGeometry[i])
+				meshNodeHashes.erase(h++);
+			else
+				++h;
+		++numDeadGeometry;
 	}
 
-	state = ReadyState;
-	LeaveCriticalSection(&g_cs);
-	return foundAllAssets;
+	if (releaseWorld)
+	{
+		pWorld->Clear();
+		worldFilename.clear();
+	}
+
+	PI_Logger::GetInstance() << "Level change released " << NumTextures - (unsigned int)vKeptTextures.size() << " textures and "
+							 << NumMeshes - (unsigned int)vKeptMeshes.size() << " meshes (" << NumDeadNames << " texture names, "
+							 << numDeadGeometry << " geometry buffers).\n\n";
+	vTextures.swap(vKeptTextures);
+	vMeshes.swap(vKeptMeshes);
+}
+
+// Load an asset - can be a mesh, texture or world geometry.
+//
+// In:		filename		Name of desired file, can be relative or absolute.
+//
+// Returns					True if the asset is resident.
+bool PI_Render::LoadAsset(const char *filename)
+{
+	unsigned int ignoreTexName;
+	PI_Mesh ignoreMesh;
+
+	// Get a pointer to the extension.
+	const unsigned int Length = (unsigned int)strlen(filename);
+	if (Length < 3)
+		return false;
+	const char *ext = filename + Length - 3;
+
+	if (!_stricmp(ext, "tga"))
+		// Targa texture.
+		return LoadTarga(filename, ignoreTexName, true);
+	else if (!_stricmp(ext, "pim"))
+		// PigIron Mesh file.
+		return LoadPIM(filename, ignoreMesh);
+	else if (!_stricmp(ext, "pwm"))
+		// PigIron World Mesh.
+		return LoadWorldPIM(filename);
+	else if (!_stricmp(ext, "pat"))
+		// PigIron texture atlas.
+		return LoadAtlas(filename);
+
+	// Unknown asset type.
+	return false;
 }
 
 // Load a PigIron Mesh (PIM) file.
@@ -550,178 +1015,223 @@ bool PI_Render::LoadAssetList(void)
 // Returns					True if the file was loaded successfully (or is already loaded)
 bool PI_Render::LoadPIM(const char *filename, PI_Mesh &out)
 {
-	string tempStr, filepath;
-	unsigned int t = 0, v = 0, n = 0, numTris = 0, numTexs = 0;
-	unsigned char tempFlags = 0;
-
-	// The file path will be need when textures are loaded because the exporter doesn't
-	// include paths in the texture filenames used by this mesh.
-	filepath = filename;
-	unsigned int index;
-	if ((index = (unsigned int)filepath.find_last_of('\\')) != string::npos)
-	{
-		filepath.erase(index + 1);
-	}
-	else
-		// No path.
-		filepath.clear();
-
-	// Temporary storage for the new mesh.
-	PI_Triangle *pTris = 0;
-	//PI_MeshNode node;
-	PI_Mesh mesh;
-	mesh.filename = filename;
-
 	// Don't reload a PIM file that's already resident.
 	const unsigned int NumMeshes = (unsigned int)vMeshes.size();
 	for (unsigned int i = 0; i < NumMeshes; i++)
-		if (mesh.filename == vMeshes[i].filename)
+		if (vMeshes[i].filename == filename)
 		{
 			// Found it!
 			out = vMeshes[i];
 			return true;
 		}
 
-	// Attempt to open the file.
-	ifstream fin(filename, ios_base::binary | ios_base::in);
-	if (!fin.is_open())
+	// Read the whole file in and decode it, unless the prefetcher already has.
+	PI_AssetProfile profile(filename);
+	PI_MeshData data;
+	if (prefetcher.TakeMesh(filename, data))
+		++numPrefetchHits;
+	else if (!PI_LoadPIMData(filename, data, &profile))
 		return false;
 
-	// Get the number of nodes, then allocate them.
-	fin.read((char *)&mesh.numNodes, sizeof(unsigned int));
+	CreateMesh(data, out, &profile);
+	loadProfiler.Add(profile);
+	return true;
+}
+
+// Create GL resources for a decoded PIM file and make it resident.
+//
+// In:		data			The decoded PIM file.
+//			pProfile		Where to record upload timings. May be 0.
+//
+// Out:		out				The new mesh.
+void PI_Render::CreateMesh(const PI_MeshData &data, PI_Mesh &out, PI_AssetProfile *pProfile)
+{
+	PI_Mesh mesh;
+	mesh.filename = data.filename;
+	mesh.numNodes = (unsigned int)data.vNodes.size();
 	mesh.pNodes = new PI_MeshNode[mesh.numNodes];
 
-	// Read 'em all in.
-	for (n = 0; n < mesh.numNodes; n++)
+	for (unsigned int n = 0; n < mesh.numNodes; n++)
 	{
-		// Read the node's name.
-		getline(fin, mesh.pNodes[n].name);
-
-		// How many textures does this node use?
-		fin.read((char *)&numTexs, sizeof(unsigned int));
+		const PI_MeshNodeData &src = data.vNodes[n];
+		PI_MeshNode &node = mesh.pNodes[n];
+		node.name = src.name;
 
-// TODO:: Load up more than just one texture. This code loads the last listed texture.
-		if (numTexs > 0)
+		// Attempt to load the textures.
+		if (src.diffTexFilename.size())
 		{
-			// Read in each filename.			
-			for (t = 0; t < numTexs; t++)
-				getline(fin, tempStr);
-
-			// Add the path, and attempt to load.
-			tempStr = filepath + tempStr;
-			LoadTarga(tempStr.c_str(), mesh.pNodes[n].diffTexName, true);
-
-// HACK:: Attempt to load a normal map by changing the last letter of the filename to an 'N',
-//		  and trying to open the file.
-// TODO:: Update the exporter to embed the normal map filename in the PIM file.
-			tempStr[tempStr.find_last_of('.') - 1] = 'N';
-			if (LoadTarga(tempStr.c_str(), mesh.pNodes[n].normalTexName, true))
-				mesh.pNodes[n].flags |= NORMALMAPPED;
+			LoadTarga(src.diffTexFilename.c_str(), node.diffTexName, true);
+			if (src.normTexFilename.size() && LoadTarga(src.normTexFilename.c_str(), node.normalTexName, true))
+				node.flags |= NORMALMAPPED;
 		}
 
-		// Read in the flags.
-		fin.read((char *)&tempFlags, sizeof(unsigned char));
-		mesh.pNodes[n].flags |= tempFlags;
+		node.flags |= src.flags;
+		node.ltm = src.ltm;
 
-		// Read in the local transformation matrix.
-		fin.read((char *)mesh.pNodes[n].ltm.mat, sizeof(float) * 16);
-		
-		// If the node isn't renderable, there won't be any geometry data in the file.
-		if (!(mesh.pNodes[n].flags & RENDERABLE))
+		// If the node isn't renderable, there's no geometry.
+		if (!(node.flags & RENDERABLE))
 			continue;
 
-		// Read all geometric data.
-		fin.read((char *)&numTris, sizeof(unsigned int));
-		pTris = new PI_Triangle[numTris];
-		fin.read((char *)pTris, sizeof(PI_Triangle) * numTris);
-	
-		// Make sure the diffuse and normal texture names get stored per-triangle.
-		for (unsigned int i = 0; i < numTris; ++i)
-		{
-			pTris[i].diffTex = mesh.pNodes[n].diffTexName;
-			pTris[i].normTex = mesh.pNodes[n].normalTexName;
-		}
-
 		// Is this the world, or just an ordinary mesh?
-		if (mesh.pNodes[n].flags & WORLD)
-		{
-			pWorld->AddToWorld(pTris, numTris);
-		}
+		bool shared = false;
+		PI_StageTimer uploadTimer(pProfile, PI_AssetProfile::Upload);
+		if (node.flags & WORLD)
+			AddNodeToWorld(src.vTris, node);
 		else
 		{
-			// Build a display list for the mesh node.
-			mesh.pNodes[n].displayList = glGenLists(1);
-			glNewList(mesh.pNodes[n].displayList, GL_COMPILE);
-			glBegin(GL_TRIANGLES);
-			for (t = 0; t < numTris; t++)
+			// Reuse the geometry of an identical node if there is one.
+			// A matching hash only finds a candidate; the triangles and edges have to match too.
+			const ULONGLONG Hash = PI_HashMeshNode(src, node.flags & (NORMALMAPPED | CASTSHADOWS));
+			map<ULONGLONG, unsigned int>::const_iterator match = meshNodeHashes.find(Hash);
+			if (match != meshNodeHashes.end() && GeometryHolds(match->second, src, node.flags))
 			{
-				for (v = 0; v < 3; ++v)
-				{
-					glNormal3f(pTris[t].normals[v].x, pTris[t].normals[v].y, pTris[t].normals[v].z);
-					if (mesh.pNodes[n].flags & NORMALMAPPED)
-					{
-						glMultiTexCoord2f(GL_TEXTURE0, pTris[t].texCoord[v].u, pTris[t].texCoord[v].v);
-						glMultiTexCoord2f(GL_TEXTURE1, pTris[t].texCoord[v].u, pTris[t].texCoord[v].v);
-					}
-					else
-						glTexCoord2f(pTris[t].texCoord[v].u, pTris[t].texCoord[v].v);
-					glVertex3f(pTris[t].verts[v].x, pTris[t].verts[v].y, pTris[t].verts[v].z);
-				}
+				node.geometry = match->second;
+				node.pGeometry = &nodeGeometry[node.geometry];
+				shared = true;
+				++numSharedNodes;
+				sharedBytes += (unsigned int)(src.vTris.size() * sizeof(PI_Triangle) + src.vEdges.size() * sizeof(PI_Edge));
 			}
-			glEnd();
-			glEndList();
-		}
-
-		// If this mesh casts shadows, we need to read in the edge data.
-		if (mesh.pNodes[n].flags & CASTSHADOWS)
-		{
-			vector<PI_Edge> edgeVec;
-			PI_Edge tempEdge;
-			unsigned int numEdges = 0;
-			fin.read((char *)&numEdges, sizeof(unsigned int));
-			for (unsigned int i = 0; i < numEdges; i++)
+			else
 			{
-				fin.read((char *)&tempEdge, sizeof(PI_Edge));
-				edgeVec.push_back(tempEdge);
+				// Build a geometry buffer for the mesh node, and keep its edges alongside.
+				node.geometry = nextGeometry++;
+				node.pGeometry = &nodeGeometry[node.geometry];
+				CompileMeshNode(src.vTris, node);
+				if (node.flags & CASTSHADOWS)
+					node.pGeometry->vEdges = src.vEdges;
+				if (match == meshNodeHashes.end())
+					meshNodeHashes[Hash] = node.geometry;
 			}
-
-			// Add the edge vector into the master edge data map, using the node's display list as the key.
-			edgeDataMap.insert(pair<unsigned int, vector<PI_Edge> >(mesh.pNodes[n].displayList, edgeVec));
 		}
+		uploadTimer.Stop(shared ? 0 : (unsigned int)(src.vTris.size() * sizeof(PI_Triangle)));
 
-		// Read the bounding data.
-		fin.read((char *)&mesh.pNodes[n].aabb_min, sizeof(PI_Vec3));
-		fin.read((char *)&mesh.pNodes[n].aabb_max, sizeof(PI_Vec3));
-		fin.read((char *)&mesh.pNodes[n].boundingRadius, sizeof(float));
-		
-		// Done processing this node.
-		delete [] pTris;
+		// Copy the bounding data.
+		node.aabb_min = src.aabb_min;
+		node.aabb_max = src.aabb_max;
+		node.boundingRadius = src.boundingRadius;
 	}
 
-	// Successfully read in the PIM file.
-	fin.close();
+	// Successfully created the mesh. The game thread looks meshes up under the lock.
 	out = mesh;
+	EnterCriticalSection(&g_cs);
 	vMeshes.push_back(mesh);
-	return true;
+	LeaveCriticalSection(&g_cs);
 }
 
-// Load a PigIron Mesh (PIM) file as the world, and build the world tree.
-//
-// In:		filename		Name of desired file, can be relative or absolute.
+// Weld a mesh node's geometry into the node's geometry buffer, replacing whatever was there.
+//
+// In:		vTris			The node's triangles.
+//			node			The node, whose geometry handle must already be assigned.
+void PI_Render::CompileMeshNode(const vector<PI_Triangle> &vTris, const PI_MeshNode &node)
+{
+	PI_GeometryBuffer &geometry = nodeGeometry[node.geometry].buffer;
+	geometry.Release();
+	if (vTris.size())
+		geometry.AddTriangles(&vTris[0], (unsigned int)vTris.size());
+
+	// Normal mapped nodes need their texture coordinates on both stages.
+	geometry.Upload((node.flags & NORMALMAPPED) ? 2 : 1, false);
+}
+
+// Does a geometry handle hold exactly what a node would be compiled into?
+//
+// In:		geometry		The handle.
+//			src				The decoded node.
+//			flags			The node's rendering flags.
+//
+// Returns					True if the node can share the handle.
+bool PI_Render::GeometryHolds(unsigned int geometry, const PI_MeshNodeData &src, unsigned char flags) const
+{
+	map<unsigned int, PI_NodeGeometry>::const_iterator iter = nodeGeometry.find(geometry);
+	if (iter == nodeGeometry.end())
+		return false;
+	const PI_NodeGeometry &existing = iter->second;
+
+	if (existing.buffer.GetNumTexCoordSets() != ((flags & NORMALMAPPED) ? 2u : 1u))
+		return false;
+	if (flags & CASTSHADOWS)
+	{
+		const unsigned int NumEdges = (unsigned int)src.vEdges.size();
+		if (existing.vEdges.size() != NumEdges || (NumEdges && memcmp(&existing.vEdges[0], &src.vEdges[0], NumEdges * sizeof(PI_Edge))))
+			return false;
+	}
+	const unsigned int NumTris = (unsigned int)src.vTris.size();
+	return existing.buffer.Holds(NumTris ? &src.vTris[0] : 0, NumTris);
+}
+
+// Is a node's geometry drawn by any other resident node?
+bool PI_Render::IsGeometryShared(const PI_MeshNode &node) const
+{
+	const unsigned int NumMeshes = (unsigned int)vMeshes.size();
+	for (unsigned int i = 0; i < NumMeshes; i++)
+		for (unsigned int n = 0; n < vMeshes[i].numNodes; n++)
+			if (&vMeshes[i].pNodes[n] != &node && vMeshes[i].pNodes[n].geometry == node.geometry)
+				return true;
+	return false;
+}
+
+// Release a mesh node's geometry and edges.
+void PI_Render::DeleteGeometry(unsigned int geometry)
+{
+	map<unsigned int, PI_NodeGeometry>::iterator iter = nodeGeometry.find(geometry);
+	if (iter == nodeGeometry.end())
+		return;
+	iter->second.buffer.Release();
+	nodeGeometry.erase(iter);
+
+	// Cached shadows point at the edges.
+	frameLight.ClearShadowCache();
+}
+
+// Add a world node's geometry to the world.
+//
+// In:		vTris			The node's triangles.
+//			node			The node, with its textures already loaded.
+void PI_Render::AddNodeToWorld(const vector<PI_Triangle> &vTris, const PI_MeshNode &node)
+{
+	if (vTris.empty())
+		return;
+
+	// Make sure the diffuse and normal texture names get stored per-triangle.
+	vector<PI_Triangle> vWorldTris(vTris);
+	const unsigned int NumTris = (unsigned int)vWorldTris.size();
+	for (unsigned int i = 0; i < NumTris; ++i)
+	{
+		vWorldTris[i].diffTex = node.diffTexName;
+		vWorldTris[i].normTex = node.normalTexName;
+	}
+	pWorld->AddToWorld(&vWorldTris[0], NumTris);
+}
+
+// Load a PigIron Mesh (PIM) file as the world, and build the world tree.
+//
+// In:		filename		Name of desired file, can be relative or absolute.
 //
 // Returns					True if successful.
 bool PI_Render::LoadWorldPIM(const char *filename)
 {
-	ULONGLONG start = GetTickCount64();
+	// A level change can keep the same world.
+	if (worldFilename == filename && pWorld->pRootNode)
+		return true;
+
+	const double Start = PI_GetSeconds();
 
 	pWorld->Clear();
+	worldFilename.clear();
 	PI_Mesh temp;
 	if (!LoadPIM(filename, temp))
 		return false;
+	worldFilename = filename;
+
+	// Building the tree uploads the world's geometry, so charge it to the upload stage.
+	const double BuildStart = PI_GetSeconds();
 	pWorld->BuildWorldTree();
+	PI_AssetProfile *pProfile = loadProfiler.Find(filename);
+	if (pProfile)
+		pProfile->Add(PI_AssetProfile::Upload, PI_GetSeconds() - BuildStart);
 
 	PI_Logger &logger = PI_Logger::GetInstance();
-	logger << "PI_Render::LoadWorldPIM() elapsed " << (GetTickCount64() - start) * 0.001f << " sec.\n";
+	logger << "PI_Render::LoadWorldPIM() elapsed " << PI_GetSeconds() - Start << " sec.\n";
 	logger << "World tree contains " << pWorld->numWorldTris << " triangles split into " << pWorld->leafNodeCount << " leaf nodes ";
 	logger << '(' << pWorld->nodeCount << " total nodes).\n\n";
 
@@ -738,11 +1248,7 @@ bool PI_Render::LoadWorldPIM(const char *filename)
 // Returns					True if the file was loaded successfully (or is already loaded)
 bool PI_Render::LoadTarga(const char *filename, unsigned int &texName, bool genMipMaps)
 {
-	PI_TexID texID = {filename, 0};
-	GLenum format;
-	unsigned int imageBytes;
-	unsigned short width, height;
-	unsigned char ID_Length, ColorMapType, ImageType, depth, *imageData, components;
+	PI_TexID texID = {filename, 0, genMipMaps, 0};
 
 	// Don't reload a texture that's already resident.
 	const unsigned int NumTextures = (unsigned int)vTextures.size();
@@ -753,65 +1259,58 @@ bool PI_Render::LoadTarga(const char *filename, unsigned int &texName, bool genM
 			return true;
 		}
 
-	// Attempt to open the file.
-	ifstream ifl(filename, ios::binary | ios::in);
-	if (!ifl.is_open())
+	// Read the whole file in and decode it, unless the prefetcher already has.
+	PI_AssetProfile profile(filename);
+	PI_Image image;
+	if (prefetcher.TakeImage(filename, image))
+		++numPrefetchHits;
+	else if (!PI_LoadTargaData(filename, image, &profile))
 		return false;
 
-	// Image ID length - should be 0.
-	ifl.read((char *)&ID_Length, sizeof ID_Length);
-
-	// Color Map Type - should be 0.
-	ifl.read((char *)&ColorMapType, sizeof ColorMapType);
-
-	// Image Type - should be 2 (Uncompressed true color image).
-	ifl.read((char *)&ImageType, sizeof ImageType);
-
-	// Make sure it's a type we can handle.
-	if (ID_Length || ColorMapType || ImageType != 2)
-	{
-		// This format is unsupported.
-		ifl.close();
-		return false;
-	}
-
-	// Skip the color map specification field and X/Y origins.
-	ifl.seekg(9, ios_base::cur);
-
-	// Dimensions & color depth.
-	ifl.read((char *)&width, sizeof width);
-	ifl.read((char *)&height, sizeof height);
-	ifl.read((char *)&depth, sizeof depth);
-
-	// Only 24-bit and 32-bit supported.
-	if (depth != 24 && depth != 32)
-	{
-		// This format is unsupported.
-		ifl.close();
-		return false;
-	}
-	else if (depth == 24)
-		format = GL_BGR_EXT;
-	else
-		format = GL_BGRA_EXT;
-
-	// Ignore the descriptor.
-	ifl.seekg(1, ios_base::cur);
-
-	// Image ID and Color Map fields should be zero bytes if we got this far,
-	// so read in the actual image data.
-	components = depth >> 3;
-	imageBytes = width * height * components;
-	imageData = new unsigned char[imageBytes];
-	ifl.read((char *)imageData, imageBytes);
-	ifl.close();
+	// Identical images saved under different names share one texture.
+	// A matching hash only finds a candidate; the texels have to match too.
+	PI_StageTimer hashTimer(&profile, PI_AssetProfile::Decode);
+	texID.hash = PI_HashImage(image);
+	hashTimer.Stop();
+	for (unsigned int i = 0; i < NumTextures; i++)
+		if (vTextures[i].hash == texID.hash && vTextures[i].mipMapped == genMipMaps && !vTextures[i].inAtlas &&
+			TextureHolds(vTextures[i].texName, image))
+		{
+			texName = texID.texName = vTextures[i].texName;
+			EnterCriticalSection(&g_cs);
+			vTextures.push_back(texID);
+			LeaveCriticalSection(&g_cs);
+			loadProfiler.Add(profile);
+
+			++numSharedTextures;
+			sharedBytes += (unsigned int)image.pixels.size();
+			return true;
+		}
 
-	// Generate a texture name and get ready to set it up.
+	// Generate a texture name and fill it. The game thread looks textures up under the lock.
 	glGenTextures(1, &texID.texName);
 	texName = texID.texName;
+	UploadTexture(texID.texName, image, genMipMaps, &profile);
+	loadProfiler.Add(profile);
+	EnterCriticalSection(&g_cs);
 	vTextures.push_back(texID);
-	glBindTexture(GL_TEXTURE_2D, texID.texName);
-	activeTexStage0 = texID.texName;
+	LeaveCriticalSection(&g_cs);
+
+	// Success!
+	return true;
+}
+
+// Upload a decoded image into a texture name.
+//
+// In:		texName			The texture to fill. Any previous contents are replaced.
+//			image			The decoded image.
+//			genMipMaps		Generate MIP maps?
+//			pProfile		Where to record MIP generation and upload timings. May be 0.
+void PI_Render::UploadTexture(unsigned int texName, const PI_Image &image, bool genMipMaps, PI_AssetProfile *pProfile)
+{
+	glActiveTextureARB(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texName);
+	activeTexStage0 = texName;
 
 	// Don't rely on the "defaults" really being default...
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -820,19 +1319,213 @@ bool PI_Render::LoadTarga(const char *filename, unsigned int &texName, bool genM
 
 	// Set the filters and build the texture.
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// GLU builds and uploads each level in one go, so MIP mapped textures are all charged to MIP generation.
 	if (genMipMaps)
 	{
+		PI_StageTimer mipTimer(pProfile, PI_AssetProfile::MipGen);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		gluBuild2DMipmaps(GL_TEXTURE_2D, components, width, height, format, GL_UNSIGNED_BYTE, imageData);
+		gluBuild2DMipmaps(GL_TEXTURE_2D, image.components, image.width, image.height, image.format, GL_UNSIGNED_BYTE, &image.pixels[0]);
+		mipTimer.Stop((unsigned int)image.pixels.size());
 	}
 	else
 	{
+		PI_StageTimer uploadTimer(pProfile, PI_AssetProfile::Upload);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexImage2D(GL_TEXTURE_2D, 0, components, width, height, 0, format, GL_UNSIGNED_BYTE, imageData);
+		glTexImage2D(GL_TEXTURE_2D, 0, image.components, image.width, image.height, 0, image.format, GL_UNSIGNED_BYTE, &image.pixels[0]);
+		uploadTimer.Stop((unsigned int)image.pixels.size());
 	}
+}
 
-	// Success!
-	delete [] imageData;
+// Does a texture hold exactly this image? The texture is read back, so this is
+// for confirming a match, not searching for one.
+//
+// Returns					True if the image can share the texture.
+bool PI_Render::TextureHolds(unsigned int texName, const PI_Image &image)
+{
+	glActiveTextureARB(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texName);
+	activeTexStage0 = texName;
+
+	// GLU scales images that aren't a power of two before building MIP maps, so they won't match.
+	GLint width = 0, height = 0;
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	if (width != image.width || height != image.height || image.pixels.empty())
+		return false;
+
+	// Read the texels back in the image's own layout, rows tightly packed like the image's.
+	vector<unsigned char> vTexels(image.pixels.size());
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, image.format, GL_UNSIGNED_BYTE, &vTexels[0]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	return !memcmp(&vTexels[0], &image.pixels[0], vTexels.size());
+}
+
+// Swap every asset that changed on disk into its existing texture names and geometry buffers.
+void PI_Render::ApplyAssetReloads(void)
+{
+	PI_AssetWatcher::PI_ReloadedAsset *pReload;
+	while ((pReload = assetWatcher.PopReload()) != 0)
+	{
+		if (pReload->type == PI_AssetWatcher::PI_ReloadedAsset::Texture)
+			ReloadTexture(pReload->filename.c_str(), pReload->image);
+		else
+			ReloadMesh(pReload->mesh);
+		delete pReload;
+	}
+}
+
+// Replace a resident texture's image.
+//
+// Returns					True if the texture was resident.
+bool PI_Render::ReloadTexture(const char *filename, const PI_Image &image)
+{
+	// Files that aren't loaded can change all they like.
+	const unsigned int NumTextures = (unsigned int)vTextures.size();
+	for (unsigned int i = 0; i < NumTextures; i++)
+		if (!_stricmp(vTextures[i].filename.c_str(), filename))
+		{
+			// Atlas images are redrawn in place on their page, as long as they're the same size.
+			const PI_TexID &texID = vTextures[i];
+			if (texID.inAtlas)
+			{
+				if (image.width != texID.atlasWidth || image.height != texID.atlasHeight)
+				{
+					PI_Logger::GetInstance() << texID.filename << " changed size, so its atlas must be reloaded to see it.\n";
+					return true;
+				}
+
+				PI_Image padded;
+				PI_AtlasBuilder::PadImage(image, padded);
+				glActiveTextureARB(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, texID.texName);
+				activeTexStage0 = texID.texName;
+				glTexSubImage2D(GL_TEXTURE_2D, 0, texID.atlasX - PI_AtlasBuilder::Padding, texID.atlasY - PI_AtlasBuilder::Padding,
+								padded.width, padded.height, padded.format, GL_UNSIGNED_BYTE, &padded.pixels[0]);
+
+				PI_Logger::GetInstance() << "Reloaded texture " << texID.filename << " in its atlas.\n";
+				return true;
+			}
+
+			// Other files sharing the texture still have the old image, so the changed file
+			// is moved onto a texture of its own rather than overwriting theirs.
+			bool shared = false;
+			for (unsigned int j = 0; j < NumTextures && !shared; j++)
+				shared = j != i && vTextures[j].texName == texID.texName;
+			if (shared)
+			{
+				glGenTextures(1, &vTextures[i].texName);
+				PI_Logger::GetInstance() << texID.filename << " shared its texture with identical images, so it has been given its own. "
+										 << "Whatever already draws it picks the change up when it's next loaded.\n";
+			}
+			UploadTexture(texID.texName, image, texID.mipMapped);
+			vTextures[i].hash = PI_HashImage(image);
+
+			PI_Logger::GetInstance() << "Reloaded texture " << texID.filename << ".\n";
+			return true;
+		}
+	return false;
+}
+
+// Replace a resident mesh's geometry and edge data.
+//
+// Returns					True if the mesh was resident and its node layout hasn't changed.
+bool PI_Render::ReloadMesh(const PI_MeshData &data)
+{
+	PI_Logger &logger = PI_Logger::GetInstance();
+
+	// Files that aren't loaded can change all they like.
+	PI_Mesh *pMesh = 0;
+	const unsigned int NumMeshes = (unsigned int)vMeshes.size();
+	for (unsigned int i = 0; i < NumMeshes && !pMesh; i++)
+		if (!_stricmp(vMeshes[i].filename.c_str(), data.filename.c_str()))
+			pMesh = &vMeshes[i];
+	if (!pMesh)
+		return false;
+
+	// Geometry buffers can be refilled in place, but everything holding a copy of the
+	// mesh has pointers into its node array, so the layout has to stay the same.
+	// Every flag changes how a node is compiled or drawn, so they all have to match as well,
+	// including the one CreateMesh adds for a normal map - adding or dropping one needs a level reload.
+	bool sameLayout = data.vNodes.size() == pMesh->numNodes;
+	for (unsigned int n = 0; n < pMesh->numNodes && sameLayout; n++)
+	{
+		const PI_MeshNodeData &src = data.vNodes[n];
+		const PI_MeshNode &node = pMesh->pNodes[n];
+		unsigned char flags = src.flags;
+		if (src.diffTexFilename.size() && src.normTexFilename.size())
+			flags |= NORMALMAPPED;
+		sameLayout = flags == node.flags;
+	}
+	if (!sameLayout)
+	{
+		logger << "Can't reload " << pMesh->filename << " - its nodes have changed. Reload the level to pick it up.\n";
+		return false;
+	}
+
+	bool rebuildWorld = false, movedGeometry = false;
+	for (unsigned int n = 0; n < pMesh->numNodes; n++)
+	{
+		const PI_MeshNodeData &src = data.vNodes[n];
+		PI_MeshNode &node = pMesh->pNodes[n];
+
+		// New texture filenames get loaded; changes to the images themselves arrive separately.
+		// As in CreateMesh, a normal map only goes with a diffuse texture.
+		if (src.diffTexFilename.size())
+		{
+			LoadTarga(src.diffTexFilename.c_str(), node.diffTexName, true);
+			if (src.normTexFilename.size())
+				LoadTarga(src.normTexFilename.c_str(), node.normalTexName, true);
+		}
+
+		node.ltm = src.ltm;
+		node.aabb_min = src.aabb_min;
+		node.aabb_max = src.aabb_max;
+		node.boundingRadius = src.boundingRadius;
+
+		if (!(node.flags & RENDERABLE))
+			continue;
+
+		if (node.flags & WORLD)
+			rebuildWorld = true;
+		else
+		{
+			// Geometry shared with other nodes keeps their content, so the changed node is moved
+			// onto geometry of its own. Otherwise it's recompiled in place, and new loads
+			// shouldn't be matched against the old content any more.
+			if (IsGeometryShared(node))
+			{
+				node.geometry = nextGeometry++;
+				node.pGeometry = &nodeGeometry[node.geometry];
+				movedGeometry = true;
+			}
+			else
+				for (map<ULONGLONG, unsigned int>::iterator h = meshNodeHashes.begin(); h != meshNodeHashes.end(); )
+					if (h->second == node.geometry)
+						meshNodeHashes.erase(h++);
+					else
+						++h;
+			CompileMeshNode(src.vTris, node);
+			if (node.flags & CASTSHADOWS)
+				nodeGeometry[node.geometry].vEdges = src.vEdges;
+		}
+	}
+	frameLight.ClearShadowCache();
+
+	// World geometry is baked into the world tree, so the tree is rebuilt from this file.
+	if (rebuildWorld)
+	{
+		pWorld->Clear();
+		for (unsigned int n = 0; n < pMesh->numNodes; n++)
+			if ((pMesh->pNodes[n].flags & (RENDERABLE | WORLD)) == (RENDERABLE | WORLD))
+				AddNodeToWorld(data.vNodes[n].vTris, pMesh->pNodes[n]);
+		pWorld->BuildWorldTree();
+	}
+
+	if (movedGeometry)
+		logger << pMesh->filename << " shared geometry with identical nodes, so the changed nodes have been given their own. "
+			   << "Copies of the mesh already handed out pick the change up when they're next loaded.\n";
+	logger << "Reloaded mesh " << pMesh->filename << ".\n";
 	return true;
 }
 
@@ -842,358 +1535,589 @@ bool PI_Render::LoadTarga(const char *filename, unsigned int &texName, bool genM
 void PI_Render::BindTexture2D(unsigned int texName)
 {
 	if (activeTexStage0 != texName)
-	{
-		glActiveTextureARB(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, activeTexStage0 = texName);
-	}	
+		pBackend->BindTexture(0, activeTexStage0 = texName);
 }
 
 // Render the scene and display it.
+// Everything drawn comes from the frame packet, so nothing but the asset reloads needs the lock.
 void PI_Render::RenderScene(void)
 {
+	const double FrameStart = PI_GetSeconds();
+
+	// Pick up any assets that changed on disk since the last frame.
 	EnterCriticalSection(&g_cs);
-	glFlush();
+	ApplyAssetReloads();
+	LeaveCriticalSection(&g_cs);
 
-	// Clear the buffers and states.
-	glClear(/*GL_COLOR_BUFFER_BIT |*/ GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	// Clear the buffers and states. Without a scene the old one would show through.
+	pBackend->BeginFrame(!pFrame->hasScene);
 	numTrisRendered = numNodesRendered = 0;
-	pActiveDLight->ClearShadowVolume();
+	vpRenderList = &pFrame->vRenderList;
+	const unsigned int RenderListSize = vpRenderList->size();
 
+	// While a level is streaming in there may be nothing to light or look at yet, so only the GUI is drawn.
+	if (pFrame->hasScene)
+	{
+		pActiveCam = &pFrame->camera;
+		frameLight.dir = pFrame->lightDir;
+		pActiveDLight = &frameLight;
+		ApplyCamera();
+		RenderSceneGeometry();
+	}
 
-	// Set up texture stage 0 for DOT3 Normal mapping.
-	// Use GL_DOT3_RGB_EXT to find the dot-product of (N.L), where N is 
-	// stored in the normal map, and L is passed in as the PRIMARY_COLOR
-	// using the standard glColor3f call.
-	glActiveTextureARB(GL_TEXTURE0);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE_EXT);      // Perform a Dot3 operation...
-	glTexEnvf(GL_TEXTURE_ENV, GL_COMBINE_RGB_EXT, GL_DOT3_RGB_EXT); 
+	// The GUI is drawn over everything.
+	pBackend->SetDepthTest(false);
 
-	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE0_RGB_EXT, GL_TEXTURE);           // between the N (of N.L) which is stored in a normal map texture...
-	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND0_RGB_EXT, GL_SRC_COLOR);
+#if 1
+	
+	static float timeAccum = 0, frameRate = 0;
+	static ULONGLONG timeStamp = GetTickCount(), frameCount = 0;
 
-	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE1_RGB_EXT, GL_PRIMARY_COLOR_EXT); // with the L (of N.L) which is stored in the vertex's diffuse color.
-	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND1_RGB_EXT, GL_SRC_COLOR);
+	++frameCount;
+	timeAccum += (GetTickCount64() - timeStamp) / 1000.0f;
+	if (timeAccum > 1.0f)
+	{
+		frameRate = frameCount / timeAccum;
+		timeAccum = 0;
+		frameCount = 0;
+	}
 
-	// Set up texture stage 1 to modulate in the diffuse texture.
-	glActiveTextureARB(GL_TEXTURE1);
-	glEnable(GL_TEXTURE_2D);
+	ostringstream out;
+	out << " RenderListSize: " << RenderListSize << " FPS: " << frameRate;
+	pFrame->gui.AddString(out.str().c_str(), 10, 10, 24);
+	timeStamp = GetTickCount64();
 
-	// Modulate the base texture by N.L calculated in STAGE 0.
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE_EXT);  // Modulate...
-	glTexEnvf(GL_TEXTURE_ENV, GL_COMBINE_RGB_EXT, GL_MODULATE);
+	gui.RenderGUI(pFrame->gui, *pBackend);
 
-	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE0_RGB_EXT, GL_PREVIOUS_EXT);
-	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND0_RGB_EXT, GL_SRC_COLOR);    // the color argument passed down from the previous stage (stage 0) with...
-	
-	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE1_RGB_EXT, GL_TEXTURE);
-	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND1_RGB_EXT, GL_SRC_COLOR);    // the texture for this stage.
+#endif
+
+	pBackend->SetDepthTest(true);
+
+	// Put 'em on the glass. Offscreen frames are waited on instead, so the whole frame is counted.
+	pBackend->EndFrame(!offscreenWidth);
+	if (offscreenWidth && !benchmarkFinished)
+	{
+		// Frames without a scene don't count.
+		if (pFrame->hasScene)
+			frameProfiler.Add(PI_GetSeconds() - FrameStart);
+		if (frameProfiler.IsFinished())
+		{
+			PI_Logger::GetInstance() << "Benchmarked with " << (pBackend == &nullBackend ? "the null backend" : "OpenGL")
+									  << " and shadow " << (shadowTechnique == ShadowMaps ? "maps" : "volumes") << ".\n";
+			frameProfiler.WriteReport("benchmark.csv");
+			benchmarkFinished = true;
+		}
+	}
+}
+
+// Render the render list, world, shadows and particles from the active camera.
+void PI_Render::RenderSceneGeometry(void)
+{
+	pActiveDLight->ClearShadowVolume();
+
+	// Render everything in the render list, sorted so state only changes when it has to.
+	BuildRenderQueue();
+	unsigned int i, j;
+
+	// Shadow maps are drawn from the light before anything is drawn from the camera.
+	const bool UseVolumes = shadowTechnique == ShadowVolumes;
+	if (!UseVolumes)
+	{
+		RenderShadowMap();
+		ApplyCamera();
+		pBackend->BeginShadowReceivers(shadowMatrix);
+	}
+
+	// Meshes are DOT3 normal mapped, with the diffuse texture modulated in on stage 1.
+	pBackend->BeginMeshes();
 
 	// Used to compute the light vector in model space during normal mapping.
 	PI_Vec3 lightDirModel;
-
-	// Render everything in the render list.
-	unsigned int i;
 	
-	const unsigned int RenderListSize = vpRenderList->size();
+	const unsigned int RenderListSize = (unsigned int)vRenderQueue.size();
 	PI_RenderElement *pElement;
-	for (i = 0; i < RenderListSize; ++i)
+	for (i = 0; i < RenderListSize; )
 	{
 		// Store a pointer to the current element to avoid redundant dereferencing ops.
-		pElement = &(*vpRenderList)[i];
+		pElement = &(*vpRenderList)[vRenderQueue[i].index];
+		if (!pElement->pGeometry)
+		{
+			++i;
+			continue;
+		}
 
-		// Apply the transform.
-		glPushMatrix();
-		glMultMatrixf(pElement->worldXform);
+		// Elements sharing geometry and textures are sorted next to each other. Find the end of the run.
+		unsigned int runEnd = i + 1;
+		while (runEnd < RenderListSize)
+		{
+			const PI_RenderElement &next = (*vpRenderList)[vRenderQueue[runEnd].index];
+			if (next.pGeometry != pElement->pGeometry || next.normTexName != pElement->normTexName ||
+				next.diffTexName != pElement->diffTexName)
+				break;
+			++runEnd;
+		}
 
 		// Load the normal texture, if necessary.
 		if (activeTexStage0 != pElement->normTexName)
-		{
-			glActiveTextureARB(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, activeTexStage0 = pElement->normTexName);
-		}
+			pBackend->BindTexture(0, activeTexStage0 = pElement->normTexName);
 		
 		// Load the diffuse texture, if necessary.
 		if (activeTexStage1 != pElement->diffTexName)
+			pBackend->BindTexture(1, activeTexStage1 = pElement->diffTexName);
+		
+		// Consecutive elements with the same geometry only bind it once.
+		pBackend->SetGeometry(&pElement->pGeometry->buffer);
+
+		// Does the run have company? Draw it in one call, with each copy's transform
+		// and model space light vector in the instance stream.
+		if (runEnd - i > 1 && pBackend->CanDrawInstanced())
 		{
-			glActiveTextureARB(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, activeTexStage1 = pElement->diffTexName);
+			vInstances.resize(runEnd - i);
+			for (j = i; j < runEnd; ++j)
+			{
+				const PI_RenderElement &element = (*vpRenderList)[vRenderQueue[j].index];
+				PI_Instance &instance = vInstances[j - i];
+				memcpy(instance.worldXform, (const float *)element.worldXform, sizeof(instance.worldXform));
+
+				lightDirModel = pActiveDLight->dir;
+				lightDirModel.TransposedRotate(element.worldXform);
+				instance.lightColor[0] = (unsigned char)((lightDirModel.x * 0.5f + 0.5f) * 255.0f + 0.5f);
+				instance.lightColor[1] = (unsigned char)((lightDirModel.y * 0.5f + 0.5f) * 255.0f + 0.5f);
+				instance.lightColor[2] = (unsigned char)((lightDirModel.z * 0.5f + 0.5f) * 255.0f + 0.5f);
+				instance.lightColor[3] = 255;
+
+				// Does this node cast a shadow that could be seen?
+				if (UseVolumes && element.pGeometry->vEdges.size() && IsShadowVisible(element))
+					pActiveDLight->BuildShadowVolume(element.pGeometry->vEdges, element.worldXform, element.pCaster);
+			}
+			pBackend->DrawMeshInstances(&vInstances[0], runEnd - i);
 		}
-		
-		// Calculate the light vector relative to the model.
-		lightDirModel = pActiveDLight->dir;
-		lightDirModel.TransposedRotate(pElement->worldXform);
-		glColor3f(lightDirModel.x * 0.5f + 0.5f, lightDirModel.y * 0.5f + 0.5f, lightDirModel.z * 0.5f + 0.5f);			
-		
-		// Render!
-		glCallList(pElement->displayList);
+		else
+		{
+			for (j = i; j < runEnd; ++j)
+			{
+				pElement = &(*vpRenderList)[vRenderQueue[j].index];
 
-		// Does this node cast shadows?
-		vector<PI_Edge> &vEdges = edgeDataMap.find(pElement->displayList)->second;
-		if (vEdges.size())
-			pActiveDLight->BuildShadowVolume(vEdges, pElement->worldXform);
+				// Calculate the light vector relative to the model, and render!
+				lightDirModel = pActiveDLight->dir;
+				lightDirModel.TransposedRotate(pElement->worldXform);
+				pBackend->DrawMesh(pElement->worldXform, lightDirModel);
 
-		// Pop off the node's transform.
-		glPopMatrix();
+				// Does this node cast a shadow that could be seen?
+				if (UseVolumes && pElement->pGeometry->vEdges.size() && IsShadowVisible(*pElement))
+					pActiveDLight->BuildShadowVolume(pElement->pGeometry->vEdges, pElement->worldXform, pElement->pCaster);
+			}
+		}
+		i = runEnd;
 	}
-	vpRenderList->mark_all_unused();
 
-	// Shut down stage 1.
-	glActiveTextureARB(GL_TEXTURE1);
-	glDisable(GL_TEXTURE_2D);
+	// Stage 1 is shut down, so whatever's next has to rebind it.
+	pBackend->EndMeshes();
 	activeTexStage1 = 0;
 
-	// Set stage 0 back to normal.
-	glActiveTextureARB(GL_TEXTURE0);
-	glColor4f(RGBA_WHITE);
-	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-	glTexEnvf(GL_TEXTURE_ENV, GL_COMBINE_RGB_EXT, GL_REPLACE);   
-	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE0_RGB_EXT, GL_TEXTURE);
-	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND0_RGB_EXT, GL_SRC_COLOR);
-
 	// Render the world with FF lighting.
-	glEnable(GL_LIGHTING);
-	glEnable(GL_LIGHT0);
-	// OpenGL requires the fourth 0 component for directional lights,
-	// so make a copy of the main light vector.
-	float glLightDir[4] = {pActiveDLight->dir.x, pActiveDLight->dir.y, pActiveDLight->dir.z, 0};
-	glLightfv(GL_LIGHT0, GL_POSITION, glLightDir);
-	RenderWorldTreeR(pWorld->pRootNode);
-	glDisable(GL_LIGHTING);
-
-	// Render the light's volumetric shadows.
-	RenderShadows();
+	RenderWorld();
+
+	// Render the light's volumetric shadows, or stop testing against its map.
+	if (UseVolumes)
+		RenderShadows();
+	else
+		pBackend->EndShadowReceivers();
 
 	// Render all particle emitters.
-	glDisable(GL_DEPTH_TEST);
-	const unsigned int NumEmitters = (unsigned int)vpEmitterList.size();
+	pBackend->SetDepthTest(false);
+	const unsigned int NumEmitters = (unsigned int)pFrame->vEmitters.size();
 	for (i = 0; i < NumEmitters; ++i)
 	{
-		// Is the current emitter not in use?
-		if (!vpEmitterList[i])
-			// Yes, so skip it.
-			continue;
+		const PI_ParticleEmitter &emitter = pFrame->vEmitters[i];
 
 		// Do we need to switch textures?
-		if (vpEmitterList[i]->diffTex && activeTexStage0 != vpEmitterList[i]->diffTex)
-			glBindTexture(GL_TEXTURE_2D, activeTexStage0 = vpEmitterList[i]->diffTex);
-
-		RenderParticleEmitter(vpEmitterList[i]);
+		if (emitter.diffTex)
+			BindTexture2D(emitter.diffTex);
 
-		// Mark this element as "unused".
-		vpEmitterList[i] = 0;
+		RenderParticleEmitter(&emitter);
 	}
+}
 
-#if 1
-	
-	static float timeAccum = 0, frameRate = 0;
-	static ULONGLONG timeStamp = GetTickCount(), frameCount = 0;
-
-	++frameCount;
-	timeAccum += (GetTickCount64() - timeStamp) / 1000.0f;
-	if (timeAccum > 1.0f)
+// Give every element in the render list a sort key, and sort them into the render queue.
+void PI_Render::BuildRenderQueue(void)
+{
+	const unsigned int RenderListSize = vpRenderList->size();
+	vRenderQueue.resize(RenderListSize);
+	vRenderQueueScratch.resize(RenderListSize);
+	for (unsigned int i = 0; i < RenderListSize; ++i)
 	{
-		frameRate = frameCount / timeAccum;
-		timeAccum = 0;
-		frameCount = 0;
+		PI_RenderElement &element = (*vpRenderList)[i];
+
+		// Positive floats sort the same as their bits, so the top of the squared
+		// distance's bits orders elements front to back.
+		const float DistanceSq = (element.worldXform.GetTranslation() - pActiveCam->pos).MagnitudeSquared();
+		unsigned int depthBits;
+		memcpy(&depthBits, &DistanceSq, sizeof(depthBits));
+
+		element.sortKey = (ULONGLONG(PI_RenderElement::OpaquePass) << 60) |
+						  (ULONGLONG(element.normTexName & 0xFFF) << 48) |
+						  (ULONGLONG(element.diffTexName & 0xFFF) << 36) |
+						  (ULONGLONG(element.geometry & 0xFFF) << 24) |
+						  (depthBits >> 7);
+		vRenderQueue[i].key = element.sortKey;
+		vRenderQueue[i].index = i;
 	}
+	if (RenderListSize)
+		PI_RadixSort(&vRenderQueue[0], &vRenderQueueScratch[0], RenderListSize);
+}
 
-	ostringstream out;
-	out << " RenderListSize: " << RenderListSize << " FPS: " << frameRate;
-	gui.DrawString(out, 10, 10, 24);
-	timeStamp = GetTickCount64();
+// Could an element's shadow land anywhere on screen?
+//
+// Returns					False if its bounding sphere, swept along the light as far as
+//							shadows are extruded, misses the camera's frustum.
+bool PI_Render::IsShadowVisible(const PI_RenderElement &element) const
+{
+	return pActiveCam->SweptSphereInFrustum(element.worldXform.GetTranslation(), element.boundingRadius,
+											pActiveDLight->dir * -PI_DLight::ShadowLength);
+}
 
-	gui.RenderGUI();
+// Find the part of the screen a caster's shadow can touch.
+//
+// In:		caster			The caster.
+//			viewProjection	The active camera's projection times its view.
+//
+// Out:		region			The caster's window rectangle and depth range.
+//
+// Returns					False if the shadow is entirely off screen.
+bool PI_Render::ProjectShadowRegion(const PI_ShadowCaster &caster, const PI_Mat44 &viewProjection, PI_ShadowRegion &region) const
+{
+	region.firstQuad = caster.firstQuad;
+	region.numQuads = caster.numQuads;
 
-#endif
+	// Project the corners of the caster's bounds.
+	const float *m = viewProjection.mat;
+	float minX = 1, minY = 1, minZ = 1, maxX = -1, maxY = -1, maxZ = -1;
+	for (int c = 0; c < 8; ++c)
+	{
+		const PI_Vec3 Corner(c & 1 ? caster.aabbMax.x : caster.aabbMin.x,
+							 c & 2 ? caster.aabbMax.y : caster.aabbMin.y,
+							 c & 4 ? caster.aabbMax.z : caster.aabbMin.z);
+		const float W = m[3] * Corner.x + m[7] * Corner.y + m[11] * Corner.z + m[15];
 
-	glEnable(GL_DEPTH_TEST);
+		// Bounds reaching behind the camera project inside out, so they get the whole screen.
+		if (W < 0.001f)
+		{
+			region.x = region.y = 0;
+			region.width = m_width, region.height = m_height;
+			region.zMin = 0, region.zMax = 1;
+			return true;
+		}
 
-	// Put 'em on the glass.
-	SwapBuffers(m_HDC);
-	state = ReadyState;
-	LeaveCriticalSection(&g_cs);
+		const float X = (m[0] * Corner.x + m[4] * Corner.y + m[8] * Corner.z + m[12]) / W,
+					Y = (m[1] * Corner.x + m[5] * Corner.y + m[9] * Corner.z + m[13]) / W,
+					Z = (m[2] * Corner.x + m[6] * Corner.y + m[10] * Corner.z + m[14]) / W;
+		if (X < minX) minX = X;
+		if (Y < minY) minY = Y;
+		if (Z < minZ) minZ = Z;
+		if (X > maxX) maxX = X;
+		if (Y > maxY) maxY = Y;
+		if (Z > maxZ) maxZ = Z;
+	}
+
+	// Clip to the viewport, and give up if nothing's left.
+	if (minX < -1) minX = -1;
+	if (minY < -1) minY = -1;
+	if (minZ < -1) minZ = -1;
+	if (maxX > 1) maxX = 1;
+	if (maxY > 1) maxY = 1;
+	if (maxZ > 1) maxZ = 1;
+	if (minX >= maxX || minY >= maxY || minZ >= maxZ)
+		return false;
+
+	// Round outwards to whole pixels.
+	region.x = (int)floor((minX * 0.5f + 0.5f) * m_width);
+	region.y = (int)floor((minY * 0.5f + 0.5f) * m_height);
+	region.width = (int)ceil((maxX * 0.5f + 0.5f) * m_width) - region.x;
+	region.height = (int)ceil((maxY * 0.5f + 0.5f) * m_height) - region.y;
+	region.zMin = minZ * 0.5f + 0.5f;
+	region.zMax = maxZ * 0.5f + 0.5f;
+	return true;
 }
 
 // Render all active shadow volumes.
 void PI_Render::RenderShadows(void)
 {
-#if 1 // Volumetric shadow algorithm
-
-	// Disable color & z-writes.
-	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-	glDepthMask(GL_FALSE);
-	glEnable(GL_STENCIL_TEST);
-
-	// Stencil test always passes.
-	glStencilFunc(GL_ALWAYS, 0, 255);
-
-	// Draw front faces.
-	glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
-	glInterleavedArrays(GL_V3F, 0, &pActiveDLight->vShadowVolume[0]);
-	glDrawArrays(GL_QUADS, 0, pActiveDLight->shadowQuadCount * 4);
-
-	// Draw back faces.
-	glCullFace(GL_FRONT);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_DECR);
-	glInterleavedArrays(GL_V3F, 0, &pActiveDLight->vShadowVolume[0]);
-	glDrawArrays(GL_QUADS, 0, pActiveDLight->shadowQuadCount * 4);
-	glCullFace(GL_BACK);
+	// Only the part of the screen each caster's shadow can touch is filled.
+	const PI_Mat44 ViewProjection = pActiveCam->projectionMat * pActiveCam->viewMat;
+	const unsigned int NumCasters = (unsigned int)pActiveDLight->vShadowCasters.size();
+	vShadowRegions.resize(NumCasters);
+	unsigned int numRegions = 0;
+	for (unsigned int i = 0; i < NumCasters; ++i)
+		if (ProjectShadowRegion(pActiveDLight->vShadowCasters[i], ViewProjection, vShadowRegions[numRegions]))
+			++numRegions;
+
+	// Without casters on screen there's nothing to count, or darken.
+	if (!numRegions)
+		return;
 
-	// Draw the shadow.
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glStencilFunc(GL_NOTEQUAL, 0, 255);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-	glPushMatrix();
-	glLoadIdentity();
-	
-	// Switch to ortho.
-	glMatrixMode(GL_PROJECTION);
-	glPushMatrix();
-	glLoadIdentity();
-	glOrtho(-1,1,-1,1,-1,1);
-	
-	// Draw the a quad across the whole viewport.
-	glMatrixMode(GL_MODELVIEW);
-	glColor4f(0,0,0,0.5f);
-	glBegin(GL_QUADS);
-	glVertex2f(-1, 1);
-	glVertex2f(-1, -1);
-	glVertex2f(1, -1);
-	glVertex2f(1, 1);
-    glEnd();
-	glColor4f(RGBA_WHITE);
-
-	// Put perspective back.
-	glMatrixMode(GL_PROJECTION);
-	glPopMatrix();
-	glMatrixMode(GL_MODELVIEW);
-	glPopMatrix();
+	pBackend->DrawShadows(&pActiveDLight->vShadowVolume[0], &vShadowRegions[0], numRegions);
+}
 
-	// Done.
-	glDepthMask(GL_TRUE);
-	glDisable(GL_STENCIL_TEST);
-#endif
+// Draw every caster whose shadow could be seen into the shadow map, from the light.
+// Leaves the light's view loaded, and shadowMatrix ready for receivers.
+void PI_Render::RenderShadowMap(void)
+{
+	// The map covers a square around what the camera's looking at, seen down the light.
+	const PI_Vec3 &LightDir = pActiveDLight->dir;
+	lightCam.target = pActiveCam->target;
+	lightCam.pos = lightCam.target + LightDir * ShadowMapRadius;
+	lightCam.up = fabs(LightDir.y) > 0.99f ? PI_Vec3(0, 0, 1) : PI_Vec3(0, 1, 0);
+	lightCam.SetOrthographic(ShadowMapRadius, ShadowMapRadius, 0, ShadowMapRadius * 2);
+	lightCam.UpdateFrustum();
+
+	pBackend->BeginShadowMap(lightCam.projectionMat, lightCam.viewMat);
+	const unsigned int RenderListSize = (unsigned int)vRenderQueue.size();
+	for (unsigned int i = 0; i < RenderListSize; ++i)
+	{
+		const PI_RenderElement &element = (*vpRenderList)[vRenderQueue[i].index];
+		if (!element.pGeometry || element.pGeometry->vEdges.empty())
+			continue;
 
-#if 0 // Display the shadow volumes.
-	glColor4f(RGB_GREEN, 0.5f);
+		// Casters outside the map, or whose shadows can't reach the screen, are left out.
+		if (!IsShadowVisible(element) || !lightCam.SphereInFrustum(element.worldXform.GetTranslation(), element.boundingRadius))
+			continue;
 
-	glBegin(GL_QUADS);
-	for (unsigned int i = 0; i < pActiveDLight->shadowQuadCount; ++i)
-		for (int v = 0; v < 4; ++v)
-			glVertex3fv(pActiveDLight->vShadowVolume[i].verts[v]);
-	glEnd();
-	glColor4f(RGBA_WHITE);
-#endif
+		pBackend->SetGeometry(&element.pGeometry->buffer);
+		pBackend->DrawShadowCaster(element.worldXform);
+	}
+	pBackend->EndShadowMap();
+
+	// Receivers take world space through the light's view and projection, then from [-1, 1] into the map's [0, 1].
+	PI_Mat44 bias;
+	bias.SetIdentity();
+	bias.mat[0] = bias.mat[5] = bias.mat[10] = 0.5f;
+	bias.mat[12] = bias.mat[13] = bias.mat[14] = 0.5f;
+	shadowMatrix = bias * lightCam.projectionMat * lightCam.viewMat;
 }
 
-// Render a particle emitter.
+// Render a particle emitter, in one draw call.
 //
 // In:		emit			The emitter to render.
 void PI_Render::RenderParticleEmitter(const PI_ParticleEmitter *emit) const
 {
 	const vector<PI_ParticleEmitter::PI_Particle> &vParts = emit->vParticles;
 
-	// Compute vectors for billboarding.
-	PI_Vec3 normal = pActiveCam->pos - pActiveCam->target, scaled;		
-	normal.Normalize();
-	
-	const PI_Vec3 upLeft = normal.Cross(pActiveCam->up) + pActiveCam->up;
-	
-	glBegin(GL_QUADS);
+	// Find the live particles, so each one's billboard has a known place in the array.
+	vParticleIndices.clear();
 	const unsigned int NumParticles = (unsigned int)vParts.size();
 	for (unsigned int i = 0; i < NumParticles; i++)
-	{
 		if (vParts[i].flags & PI_ParticleEmitter::PI_Particle::Active)
+			vParticleIndices.push_back(i);
+	if (vParticleIndices.empty())
+		return;
+
+	PI_ParticleJob job;
+	job.pEmitter = emit;
+	job.pIndices = &vParticleIndices[0];
+	job.numParticles = (unsigned int)vParticleIndices.size();
+
+	// Compute vectors for billboarding.
+	PI_Vec3 normal = pActiveCam->pos - pActiveCam->target;
+	normal.Normalize();
+	job.upLeft = normal.Cross(pActiveCam->up) + pActiveCam->up;
+
+	// Fading particles look their color up, rather than searching the keyframes one particle at a time.
+	job.pColors = emit->BuildColorTable(particleColors, ParticleColorSteps, job.lifeBase, job.lifeScale) ? particleColors : 0;
+
+	// Big emitters are expanded across the job pool.
+	vParticleVerts.resize(job.numParticles * 4);
+	job.pVerts = &vParticleVerts[0];
+	const unsigned int NumChunks = (job.numParticles + ParticleChunkSize - 1) / ParticleChunkSize;
+	if (NumChunks > 1)
+		PI_JobPool::GetInstance().ParallelFor(ExpandParticlesJob, &job, NumChunks);
+	else
+		ExpandParticlesJob(&job, 0);
+
+	pBackend->DrawQuads(job.pVerts, job.numParticles);
+}
+
+// Expand a chunk of an emitter's particles into billboard quads. Run on the job pool.
+//
+// In:		pContext		The PI_ParticleJob.
+//			chunk			Which ParticleChunkSize particles to expand.
+void PI_Render::ExpandParticlesJob(void *pContext, unsigned int chunk)
+{
+	const PI_ParticleJob &job = *(const PI_ParticleJob *)pContext;
+	const vector<PI_ParticleEmitter::PI_Particle> &vParts = job.pEmitter->vParticles;
+	static const unsigned char White[4] = { 255, 255, 255, 255 };
+	const int LastColor = (int)ParticleColorSteps - 1;
+	const PI_AtlasRegion &Region = job.pEmitter->diffRegion;
+	const float Left = Region.U(0), Right = Region.U(1), Bottom = Region.V(0), Top = Region.V(1);
+
+	const unsigned int First = chunk * ParticleChunkSize,
+					   Last = First + ParticleChunkSize < job.numParticles ? First + ParticleChunkSize : job.numParticles;
+	PI_QuadVertex *pCorners = job.pVerts + First * 4;
+	for (unsigned int i = First; i < Last; ++i, pCorners += 4)
+	{
+		const PI_ParticleEmitter::PI_Particle &Part = vParts[job.pIndices[i]];
+		const PI_Vec3 &Pos = Part.pos, Scaled = job.upLeft * Part.size;
+
+		// Color the particle.
+		const unsigned char *pColor = White;
+		if (job.pColors)
 		{
-			// Color the particle.
-			if (emit->vColors.size() > 1)
-				glColor4fv(emit->GetInterpolatedColor(vParts[i].life));
-
-			scaled = upLeft * vParts[i].size;
-
-			//glNormal3f(normal.x, normal.y, normal.z); LIGHTING IS DISABLED WHEN RENDERING PARTICLES!
-			
-			// Upper Left
-			glTexCoord2f(0,1);
-			glVertex3f(vParts[i].pos.x + scaled.x, vParts[i].pos.y + scaled.y, vParts[i].pos.z + scaled.z);
-
-			// Lower Left
-			glTexCoord2f(0,0);
-			glVertex3f(vParts[i].pos.x + scaled.x, vParts[i].pos.y - scaled.y, vParts[i].pos.z - scaled.z);
-			
-			// Lower Right
-			glTexCoord2f(1,0);
-			glVertex3f(vParts[i].pos.x - scaled.x, vParts[i].pos.y - scaled.y, vParts[i].pos.z - scaled.z);
-			
-			// Upper Right
-			glTexCoord2f(1,1);
-			glVertex3f(vParts[i].pos.x - scaled.x, vParts[i].pos.y + scaled.y, vParts[i].pos.z + scaled.z);
+			int entry = (int)((Part.life - job.lifeBase) * job.lifeScale + 0.5f);
+			entry = entry < 0 ? 0 : entry > LastColor ? LastColor : entry;
+			pColor = job.pColors + entry * 4;
 		}
+
+		// Upper Left, Lower Left, Lower Right, Upper Right.
+		pCorners[0].Set(Pos.x + Scaled.x, Pos.y + Scaled.y, Pos.z + Scaled.z, Left, Top);
+		pCorners[1].Set(Pos.x + Scaled.x, Pos.y - Scaled.y, Pos.z - Scaled.z, Left, Bottom);
+		pCorners[2].Set(Pos.x - Scaled.x, Pos.y - Scaled.y, Pos.z - Scaled.z, Right, Bottom);
+		pCorners[3].Set(Pos.x - Scaled.x, Pos.y + Scaled.y, Pos.z + Scaled.z, Right, Top);
+		for (int c = 0; c < 4; ++c)
+			memcpy(pCorners[c].rgba, pColor, 4);
 	}
-	glColor4f(RGBA_WHITE);
-	glEnd();
 }
 
-// Render the entire world tree.
-// This function is recursive - pass the root node for the initial call.
-void PI_Render::RenderWorldTreeR(const PI_WorldTree::PI_WorldTreeNode *n) const
+// Render the visible parts of the world tree, one draw call per diffuse texture.
+// Subtrees are culled across the job pool, and their batches merged in tree order,
+// so the result is the same however many threads there are.
+void PI_Render::RenderWorld(void) const
 {
-	if (!n)
+	vpWorldBatches.clear();
+	numWorldCullTasks = 0;
+	if (pWorld->pRootNode)
+		SplitWorldCullR(pWorld->pRootNode, 0);
+	if (numWorldCullTasks > 1)
+		PI_JobPool::GetInstance().ParallelFor(CullWorldTreeJob, (void *)this, numWorldCullTasks);
+	else if (numWorldCullTasks)
+		CullWorldTreeJob((void *)this, 0);
+
+	for (unsigned int i = 0; i < numWorldCullTasks; ++i)
+	{
+		const PI_WorldCullTask &task = vWorldCullTasks[i];
+		vpWorldBatches.insert(vpWorldBatches.end(), task.vpBatches.begin(), task.vpBatches.end());
+		numTrisRendered += task.numTris;
+		numNodesRendered += task.numNodes;
+	}
+	if (vpWorldBatches.empty())
 		return;
 
+	sort(vpWorldBatches.begin(), vpWorldBatches.end(), WorldBatchLess);
+	pBackend->BeginWorld(pActiveDLight->dir, pWorld->geometry);
+	const unsigned int NumBatches = (unsigned int)vpWorldBatches.size();
+	for (unsigned int first = 0; first < NumBatches; )
+	{
+		const unsigned int DiffTexName = vpWorldBatches[first]->diffTexName;
+		if (activeTexStage0 != DiffTexName)
+			pBackend->BindTexture(0, activeTexStage0 = DiffTexName);
+
+		// Draw every visible batch with this texture at once.
+		vWorldFirstIndices.clear();
+		vWorldCounts.clear();
+		unsigned int last = first;
+		for ( ; last < NumBatches && vpWorldBatches[last]->diffTexName == DiffTexName; ++last)
+		{
+			vWorldFirstIndices.push_back(vpWorldBatches[last]->firstIndex);
+			vWorldCounts.push_back(vpWorldBatches[last]->numIndices);
+		}
+		pBackend->DrawWorldBatches(&vWorldFirstIndices[0], &vWorldCounts[0], last - first);
+		first = last;
+	}
+	pBackend->EndWorld();
+}
+
+// Sort world batches by diffuse texture.
+bool PI_Render::WorldBatchLess(const PI_WorldTree::PI_WorldTreeNode::RenderData *pLeft,
+							   const PI_WorldTree::PI_WorldTreeNode::RenderData *pRight)
+{
+	return pLeft->diffTexName < pRight->diffTexName;
+}
+
+// Is a world tree node in the active camera's frustum? The root always is.
+bool PI_Render::IsWorldNodeVisible(const PI_WorldTree::PI_WorldTreeNode *n) const
+{
+	if (n == pWorld->pRootNode)
+		return true;
+
 	// Compute cardinal axis dimension vectors for the node.
 	PI_Vec3 R(n->max.x - n->min.x, 0, 0), S(0, n->max.y - n->min.y, 0), T(0, 0, n->max.z - n->min.z);
 	float rEff;
+	for (unsigned char i = 0; i < 6; ++i)
+	{
+		// Compute the effective radius of the bounding box relative to each frustum plane.
+		rEff = sqrt(pow(R.Dot(pActiveCam->frustumPlanes[i].normal), 2.0f) +
+				pow(S.Dot(pActiveCam->frustumPlanes[i].normal), 2.0f) +
+				pow(T.Dot(pActiveCam->frustumPlanes[i].normal), 2.0f));
+
+		if (pActiveCam->frustumPlanes[i].DotHomogenous(n->center) <= -rEff)
+			// The box is not visible.
+			return false;
+	}
+	return true;
+}
 
-	// Assume the root node is always visible.
-	if (n != pWorld->pRootNode)
-		for (unsigned char i = 0; i < 6; ++i)
-		{
-			// Compute the effective radius of the bounding box relative to each frustum plane.
-			rEff = sqrt(pow(R.Dot(pActiveCam->frustumPlanes[i].normal), 2.0f) +
-					pow(S.Dot(pActiveCam->frustumPlanes[i].normal), 2.0f) +
-					pow(T.Dot(pActiveCam->frustumPlanes[i].normal), 2.0f));
-
-			if (pActiveCam->frustumPlanes[i].DotHomogenous(n->center) <= -rEff)
-				// The box is not visible, so bug out.
-				return;
-		}
+// Split the visible top of the world tree into subtrees to be culled as separate tasks.
+// Visible nodes WorldCullSplitDepth below the root, and visible leaves above it, each become a task.
+// This function is recursive - pass the root node for the initial call.
+//
+// In:		n				A node that's already known to be visible.
+//			depth			How far below the root it is.
+void PI_Render::SplitWorldCullR(const PI_WorldTree::PI_WorldTreeNode *n, unsigned int depth) const
+{
+	if (depth == WorldCullSplitDepth || (!n->leftChild && !n->rightChild))
+	{
+		// Slots are reused from frame to frame, so their lists keep their memory.
+		if (numWorldCullTasks == vWorldCullTasks.size())
+			vWorldCullTasks.push_back(PI_WorldCullTask());
+		PI_WorldCullTask &task = vWorldCullTasks[numWorldCullTasks++];
+		task.pRoot = n;
+		return;
+	}
 
+	if (n->leftChild && IsWorldNodeVisible(n->leftChild))
+		SplitWorldCullR(n->leftChild, depth + 1);
+	if (n->rightChild && IsWorldNodeVisible(n->rightChild))
+		SplitWorldCullR(n->rightChild, depth + 1);
+}
+
+// Cull a subtree of the world. Run on the job pool.
+//
+// In:		pContext		The PI_Render.
+//			task			Which of vWorldCullTasks to cull.
+void PI_Render::CullWorldTreeJob(void *pContext, unsigned int task)
+{
+	const PI_Render &render = *(const PI_Render *)pContext;
+	PI_WorldCullTask &cull = render.vWorldCullTasks[task];
+	cull.vpBatches.clear();
+	cull.numTris = cull.numNodes = 0;
+	render.CullWorldTreeR(cull.pRoot, cull);
+}
+
+// Gather the texture batches of every visible leaf under a node.
+// This function is recursive - pass a task's root for the initial call.
+//
+// In:		n				A node that's already known to be visible.
+//
+// Out:		task			Gets the batches, and counts the leaves and triangles.
+void PI_Render::CullWorldTreeR(const PI_WorldTree::PI_WorldTreeNode *n, PI_WorldCullTask &task) const
+{
 	// Check if this is a leaf node where geometry is stored.
 	if (!n->leftChild && !n->rightChild)
 	{
 		const unsigned int Size = (unsigned int)n->vRenderData.size();
 		for (unsigned int i = 0; i < Size; ++i)
-		{
-			/*if (activeTexStage0 != n->vRenderData[i].normTexName)
-			{
-				glActiveTextureARB(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, activeTexStage0 = n->vRenderData[i].normTexName);
-			}
-			if (activeTexStage1 != n->vRenderData[i].diffTexName)
-			{
-				glActiveTextureARB(GL_TEXTURE1);
-				glBindTexture(GL_TEXTURE_2D, activeTexStage1 = n->vRenderData[i].diffTexName);
-			}*/
-			if (activeTexStage0 != n->vRenderData[i].diffTexName)
-			{
-				glActiveTextureARB(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, activeTexStage0 = n->vRenderData[i].diffTexName);
-			}
-			glCallList(n->vRenderData[i].displayList);
-		}
+			task.vpBatches.push_back(&n->vRenderData[i]);
 		
 		// Nothing else below this node.
-		numTrisRendered += (unsigned int)n->vTris.size();
-		numNodesRendered++;
+		task.numTris += (unsigned int)n->vTris.size();
+		task.numNodes++;
 		return;
 	}
 	
-	// Not a leaf node, so recurse any children.
-	if (n->leftChild)
-		RenderWorldTreeR(n->leftChild);
-	if (n->rightChild)
-		RenderWorldTreeR(n->rightChild);
+	// Not a leaf node, so recurse any visible children.
+	if (n->leftChild && IsWorldNodeVisible(n->leftChild))
+		CullWorldTreeR(n->leftChild, task);
+	if (n->rightChild && IsWorldNodeVisible(n->rightChild))
+		CullWorldTreeR(n->rightChild, task);
 }
 
 // Render some simple test geometry.
@@ -1291,6 +2215,7 @@ void PI_Render::UnloadAllAssets(void)
 {
 	EnterCriticalSection(&g_cs);
 	pWorld->Clear();
+	worldFilename.clear();
 	UnloadAllTextures();
 	UnloadAllStaticMeshes();
 	state = ReadyState;
@@ -1300,21 +2225,30 @@ void PI_Render::UnloadAllAssets(void)
 // Release all textures from memory.
 void PI_Render::UnloadAllTextures(void)
 {
+	// Textures can share names, so only delete each one once.
+	vector<unsigned int> vNames;
 	const unsigned int NumTextures = (unsigned int)vTextures.size();
 	for (unsigned int i = 0; i < NumTextures; i++)
-		glDeleteTextures(1, &vTextures[i].texName);
+		vNames.push_back(vTextures[i].texName);
+	sort(vNames.begin(), vNames.end());
+	vNames.erase(unique(vNames.begin(), vNames.end()), vNames.end());
+
+	const unsigned int NumNames = (unsigned int)vNames.size();
+	for (unsigned int i = 0; i < NumNames; i++)
+		glDeleteTextures(1, &vNames[i]);
 	vTextures.clear();
 }
 
 // Release all static meshes from memory.
 void PI_Render::UnloadAllStaticMeshes(void)
 {
-	const unsigned int NumMeshes = (unsigned int)vMeshes.size();
-	for (unsigned int i = 0; i < NumMeshes; i++)
-		for (unsigned int j = 0; j < vMeshes[i].numNodes; j++)
-			glDeleteLists(vMeshes[i].pNodes[j].displayList, 1);
+	// Nodes share geometry through their handles, so each buffer is released once.
+	for (map<unsigned int, PI_NodeGeometry>::iterator iter = nodeGeometry.begin(); iter != nodeGeometry.end(); ++iter)
+		iter->second.buffer.Release();
+	nodeGeometry.clear();
+	meshNodeHashes.clear();
 	vMeshes.clear();
-	edgeDataMap.clear();
+	frameLight.ClearShadowCache();
 }
 
 // DEPRICATED FUNCTIONS
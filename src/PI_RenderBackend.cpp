@@ -0,0 +1,495 @@
+// PigIron render backend implementation.
+
+#include <cstring>
+
+#include "PI_RenderBackend.h"
+#include <gl\glu.h>
+
+#define RGBA_WHITE 1.0f, 1.0f, 1.0f, 1.0f
+
+// Loaded by the renderer along with the rendering context.
+extern PFNGLACTIVETEXTUREPROC glActiveTextureARB;
+
+// Only if the driver has EXT_depth_bounds_test.
+static PFNGLDEPTHBOUNDSEXTPROC glDepthBoundsPI;
+
+// Loaded by CreateShadowMap.
+static PFNGLGENFRAMEBUFFERSEXTPROC glGenFramebuffersPI;
+static PFNGLBINDFRAMEBUFFEREXTPROC glBindFramebufferPI;
+static PFNGLDELETEFRAMEBUFFERSEXTPROC glDeleteFramebuffersPI;
+static PFNGLFRAMEBUFFERTEXTURE2DEXTPROC glFramebufferTexture2DPI;
+static PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC glCheckFramebufferStatusPI;
+
+// Get ready to draw. Called on the render thread with a current rendering context.
+//
+// In:		hDC				The device context frames are presented to.
+void PI_GLBackend::Init(HDC hDC)
+{
+	this->hDC = hDC;
+
+	// Shadows are limited to the depths their volumes span, where the driver can.
+	const char *extstr = (const char *)glGetString(GL_EXTENSIONS);
+	glDepthBoundsPI = 0;
+	if (strstr(extstr, "GL_EXT_depth_bounds_test"))
+		glDepthBoundsPI = (PFNGLDEPTHBOUNDSEXTPROC)wglGetProcAddress("glDepthBoundsEXT");
+
+	// Repeated meshes are drawn in one call each if the driver can.
+	instancer.Init();
+}
+
+void PI_GLBackend::Shutdown(void)
+{
+	instancer.Shutdown();
+
+	if (shadowFramebuffer)
+		glDeleteFramebuffersPI(1, &shadowFramebuffer);
+	if (shadowTexture)
+		glDeleteTextures(1, &shadowTexture);
+	shadowFramebuffer = shadowTexture = 0;
+}
+
+// Start a frame by clearing depth and stencil.
+//
+// In:		clearColor		Clear the color buffer too?
+void PI_GLBackend::BeginFrame(bool clearColor)
+{
+	glFlush();
+	glClear(/*GL_COLOR_BUFFER_BIT |*/ GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	if (clearColor)
+		glClear(GL_COLOR_BUFFER_BIT);
+}
+
+// Finish a frame.
+//
+// In:		present			Swap it onto the window? Otherwise wait until it's been drawn.
+void PI_GLBackend::EndFrame(bool present)
+{
+	if (present)
+		SwapBuffers(hDC);
+	else
+		glFinish();
+}
+
+// Load the camera's matrices.
+void PI_GLBackend::SetCamera(const PI_Mat44 &projection, const PI_Mat44 &view)
+{
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(projection);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadMatrixf(view);
+}
+
+// Bind a texture to a texture stage (0 or 1).
+void PI_GLBackend::BindTexture(unsigned int stage, unsigned int texName)
+{
+	glActiveTextureARB(GL_TEXTURE0 + stage);
+	glBindTexture(GL_TEXTURE_2D, texName);
+	if (stage)
+		glActiveTextureARB(GL_TEXTURE0);
+}
+
+// Switch to DOT3 normal mapping, with the diffuse texture modulated in on stage 1.
+void PI_GLBackend::BeginMeshes(void)
+{
+	// Set up texture stage 0 for DOT3 Normal mapping.
+	// Use GL_DOT3_RGB_EXT to find the dot-product of (N.L), where N is
+	// stored in the normal map, and L is passed in as the PRIMARY_COLOR
+	// using the standard glColor3f call.
+	glActiveTextureARB(GL_TEXTURE0);
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE_EXT);      // Perform a Dot3 operation...
+	glTexEnvf(GL_TEXTURE_ENV, GL_COMBINE_RGB_EXT, GL_DOT3_RGB_EXT);
+
+	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE0_RGB_EXT, GL_TEXTURE);           // between the N (of N.L) which is stored in a normal map texture...
+	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND0_RGB_EXT, GL_SRC_COLOR);
+
+	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE1_RGB_EXT, GL_PRIMARY_COLOR_EXT); // with the L (of N.L) which is stored in the vertex's diffuse color.
+	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND1_RGB_EXT, GL_SRC_COLOR);
+
+	// Set up texture stage 1 to modulate in the diffuse texture.
+	glActiveTextureARB(GL_TEXTURE1);
+	glEnable(GL_TEXTURE_2D);
+
+	// Modulate the base texture by N.L calculated in STAGE 0.
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE_EXT);  // Modulate...
+	glTexEnvf(GL_TEXTURE_ENV, GL_COMBINE_RGB_EXT, GL_MODULATE);
+
+	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE0_RGB_EXT, GL_PREVIOUS_EXT);
+	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND0_RGB_EXT, GL_SRC_COLOR);    // the color argument passed down from the previous stage (stage 0) with...
+
+	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE1_RGB_EXT, GL_TEXTURE);
+	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND1_RGB_EXT, GL_SRC_COLOR);    // the texture for this stage.
+	glActiveTextureARB(GL_TEXTURE0);
+}
+
+// Switch back from normal mapping.
+void PI_GLBackend::EndMeshes(void)
+{
+	if (instancing)
+	{
+		instancer.End();
+		instancing = false;
+	}
+	SetGeometry(0);
+
+	// Shut down stage 1.
+	glActiveTextureARB(GL_TEXTURE1);
+	glDisable(GL_TEXTURE_2D);
+
+	// Set stage 0 back to normal.
+	glActiveTextureARB(GL_TEXTURE0);
+	glColor4f(RGBA_WHITE);
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	glTexEnvf(GL_TEXTURE_ENV, GL_COMBINE_RGB_EXT, GL_REPLACE);
+	glTexEnvf(GL_TEXTURE_ENV, GL_SOURCE0_RGB_EXT, GL_TEXTURE);
+	glTexEnvf(GL_TEXTURE_ENV, GL_OPERAND0_RGB_EXT, GL_SRC_COLOR);
+}
+
+// Pick the geometry DrawMesh and DrawMeshInstances draw. 0 unbinds it.
+void PI_GLBackend::SetGeometry(const PI_GeometryBuffer *pGeometry)
+{
+	if (this->pGeometry == pGeometry)
+		return;
+	if (this->pGeometry)
+		this->pGeometry->Unbind();
+	if ((this->pGeometry = pGeometry))
+		pGeometry->Bind();
+}
+
+// Draw the current geometry once.
+//
+// In:		worldXform		Where to draw it.
+//			lightDirModel	The light direction in model space.
+void PI_GLBackend::DrawMesh(const PI_Mat44 &worldXform, const PI_Vec3 &lightDirModel)
+{
+	if (instancing)
+	{
+		instancer.End();
+		instancing = false;
+	}
+
+	// Apply the transform.
+	glPushMatrix();
+	glMultMatrixf(worldXform);
+
+	// The light vector goes in as the color, for DOT3.
+	glColor3f(lightDirModel.x * 0.5f + 0.5f, lightDirModel.y * 0.5f + 0.5f, lightDirModel.z * 0.5f + 0.5f);
+
+	// Render!
+	pGeometry->Draw();
+
+	// Pop off the node's transform.
+	glPopMatrix();
+}
+
+// Draw the current geometry once per instance.
+void PI_GLBackend::DrawMeshInstances(const PI_Instance *pInstances, unsigned int numInstances)
+{
+	if (!instancing)
+	{
+		instancer.Begin();
+		instancing = true;
+	}
+	instancer.Draw(*pGeometry, pInstances, numInstances);
+}
+
+// Switch to lit world geometry.
+//
+// In:		lightDir		The directional light, in world space.
+//			geometry		The world's geometry.
+void PI_GLBackend::BeginWorld(const PI_Vec3 &lightDir, const PI_GeometryBuffer &geometry)
+{
+	glEnable(GL_LIGHTING);
+	glEnable(GL_LIGHT0);
+
+	// OpenGL requires the fourth 0 component for directional lights,
+	// so make a copy of the main light vector.
+	float glLightDir[4] = {lightDir.x, lightDir.y, lightDir.z, 0};
+	glLightfv(GL_LIGHT0, GL_POSITION, glLightDir);
+
+	(pWorldGeometry = &geometry)->Bind();
+}
+
+// Switch back from lit world geometry.
+void PI_GLBackend::EndWorld(void)
+{
+	pWorldGeometry->Unbind();
+	pWorldGeometry = 0;
+
+	// The color array leaves the current color undefined.
+	glColor4f(RGBA_WHITE);
+	glDisable(GL_LIGHTING);
+}
+
+// Draw several batches of the world geometry with the texture on stage 0.
+void PI_GLBackend::DrawWorldBatches(const unsigned int *pFirstIndices, const GLsizei *pCounts, unsigned int numBatches)
+{
+	pWorldGeometry->MultiDraw(pFirstIndices, pCounts, numBatches);
+}
+
+// Limit drawing to a shadow region.
+void PI_GLBackend::ApplyShadowRegion(const PI_ShadowRegion &region) const
+{
+	glScissor(region.x, region.y, region.width, region.height);
+	if (glDepthBoundsPI)
+		glDepthBoundsPI(region.zMin, region.zMax);
+}
+
+// Count the shadow volume into the stencil buffer, and darken whatever's inside it.
+// Each caster's quads and darkening are limited to its region.
+//
+// In:		pQuads			The shadow volume.
+//			pRegions		Where each caster's quads are, and where they can be seen.
+//			numRegions		How many casters there are.
+void PI_GLBackend::DrawShadows(const PI_Quad *pQuads, const PI_ShadowRegion *pRegions, unsigned int numRegions)
+{
+	// Disable color & z-writes.
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glEnable(GL_STENCIL_TEST);
+
+	// Pixels outside a caster's rectangle, or whose depth is outside its volume's, can't be in its shadow.
+	glEnable(GL_SCISSOR_TEST);
+	if (glDepthBoundsPI)
+		glEnable(GL_DEPTH_BOUNDS_TEST_EXT);
+
+	// Stencil test always passes.
+	glStencilFunc(GL_ALWAYS, 0, 255);
+	glInterleavedArrays(GL_V3F, 0, pQuads);
+	unsigned int i;
+	for (i = 0; i < numRegions; ++i)
+	{
+		const PI_ShadowRegion &Region = pRegions[i];
+		ApplyShadowRegion(Region);
+
+		// Draw front faces.
+		glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+		glDrawArrays(GL_QUADS, Region.firstQuad * 4, Region.numQuads * 4);
+
+		// Draw back faces.
+		glCullFace(GL_FRONT);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_DECR);
+		glDrawArrays(GL_QUADS, Region.firstQuad * 4, Region.numQuads * 4);
+		glCullFace(GL_BACK);
+	}
+
+	// Draw the shadow. Darkened pixels are cleared, so where regions overlap they're only darkened once.
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glStencilFunc(GL_NOTEQUAL, 0, 255);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+	glPushMatrix();
+	glLoadIdentity();
+
+	// Switch to ortho.
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(-1,1,-1,1,-1,1);
+
+	// Draw the a quad across each region.
+	glMatrixMode(GL_MODELVIEW);
+	static const float ScreenQuad[] = { -1, 1,  -1, -1,  1, -1,  1, 1 };
+	glColor4f(0,0,0,0.5f);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, ScreenQuad);
+	for (i = 0; i < numRegions; ++i)
+	{
+		ApplyShadowRegion(pRegions[i]);
+		glDrawArrays(GL_QUADS, 0, 4);
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glColor4f(RGBA_WHITE);
+
+	// Put perspective back.
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+
+	// Done.
+	if (glDepthBoundsPI)
+		glDisable(GL_DEPTH_BOUNDS_TEST_EXT);
+	glDisable(GL_SCISSOR_TEST);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_STENCIL_TEST);
+}
+
+// Create the depth texture shadow maps are drawn into. Released by Shutdown.
+//
+// In:		size			Its width and height, in texels.
+//
+// Returns					True if shadow maps can be used.
+bool PI_GLBackend::CreateShadowMap(unsigned int size)
+{
+	// The depth comparison is done by the texture unit, and receivers already use two.
+	const char *extstr = (const char *)glGetString(GL_EXTENSIONS);
+	GLint numUnits = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_UNITS, &numUnits);
+	if (numUnits < 3 || !strstr(extstr, "ARB_depth_texture") || !strstr(extstr, "ARB_shadow") ||
+		!strstr(extstr, "EXT_framebuffer_object"))
+		return false;
+
+	glGenFramebuffersPI = (PFNGLGENFRAMEBUFFERSEXTPROC)PI_GetGLProc("glGenFramebuffers", "glGenFramebuffersEXT");
+	glBindFramebufferPI = (PFNGLBINDFRAMEBUFFEREXTPROC)PI_GetGLProc("glBindFramebuffer", "glBindFramebufferEXT");
+	glDeleteFramebuffersPI = (PFNGLDELETEFRAMEBUFFERSEXTPROC)PI_GetGLProc("glDeleteFramebuffers", "glDeleteFramebuffersEXT");
+	glFramebufferTexture2DPI = (PFNGLFRAMEBUFFERTEXTURE2DEXTPROC)PI_GetGLProc("glFramebufferTexture2D", "glFramebufferTexture2DEXT");
+	glCheckFramebufferStatusPI = (PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC)PI_GetGLProc("glCheckFramebufferStatus", "glCheckFramebufferStatusEXT");
+	if (!glGenFramebuffersPI || !glBindFramebufferPI || !glDeleteFramebuffersPI || !glFramebufferTexture2DPI || !glCheckFramebufferStatusPI)
+		return false;
+
+	// Filtering the comparison softens the edges on hardware that can.
+	glGenTextures(1, &shadowTexture);
+	glBindTexture(GL_TEXTURE_2D, shadowTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE_ARB, GL_COMPARE_R_TO_TEXTURE_ARB);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC_ARB, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D, GL_DEPTH_TEXTURE_MODE_ARB, GL_LUMINANCE);
+
+	// Shadowed texels darken by half, as the volumes do. Without this they're black.
+	if (strstr(extstr, "ARB_shadow_ambient"))
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FAIL_VALUE_ARB, 0.5f);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Depth only, so there's nothing to draw or read color from.
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &previousFramebuffer);
+	glGenFramebuffersPI(1, &shadowFramebuffer);
+	glBindFramebufferPI(GL_FRAMEBUFFER_EXT, shadowFramebuffer);
+	glFramebufferTexture2DPI(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_TEXTURE_2D, shadowTexture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	const GLenum Status = glCheckFramebufferStatusPI(GL_FRAMEBUFFER_EXT);
+	glBindFramebufferPI(GL_FRAMEBUFFER_EXT, previousFramebuffer);
+	if (Status != GL_FRAMEBUFFER_COMPLETE_EXT)
+	{
+		glDeleteFramebuffersPI(1, &shadowFramebuffer);
+		glDeleteTextures(1, &shadowTexture);
+		shadowFramebuffer = shadowTexture = 0;
+		return false;
+	}
+
+	shadowMapSize = size;
+	return true;
+}
+
+// Switch to drawing casters into the shadow map, from the light.
+void PI_GLBackend::BeginShadowMap(const PI_Mat44 &lightProjection, const PI_Mat44 &lightView)
+{
+	// Whatever was being drawn to, benchmarks included, is picked up again afterwards.
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, previousViewport);
+	glBindFramebufferPI(GL_FRAMEBUFFER_EXT, shadowFramebuffer);
+	glViewport(0, 0, shadowMapSize, shadowMapSize);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	SetCamera(lightProjection, lightView);
+
+	// Only depth is written, pushed back a little so receivers don't shadow themselves.
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDisable(GL_TEXTURE_2D);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(1.1f, 4.0f);
+}
+
+// Switch back to the camera's framebuffer.
+void PI_GLBackend::EndShadowMap(void)
+{
+	SetGeometry(0);
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glEnable(GL_TEXTURE_2D);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glBindFramebufferPI(GL_FRAMEBUFFER_EXT, previousFramebuffer);
+	glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+}
+
+// Draw the current geometry into the shadow map.
+void PI_GLBackend::DrawShadowCaster(const PI_Mat44 &worldXform)
+{
+	glPushMatrix();
+	glMultMatrixf(worldXform);
+	pGeometry->Draw();
+	glPopMatrix();
+}
+
+// Switch to testing everything drawn against the shadow map, on texture stage 2.
+//
+// In:		shadowMatrix	Takes world space to shadow map coordinates, with depth in the third.
+void PI_GLBackend::BeginShadowReceivers(const PI_Mat44 &shadowMatrix)
+{
+	glActiveTextureARB(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, shadowTexture);
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	// Eye planes are taken through the inverse of the camera's view as they're set,
+	// so the coordinates come out of world space whatever each model's transform.
+	static const GLenum Coords[4] = { GL_S, GL_T, GL_R, GL_Q };
+	static const GLenum Gens[4] = { GL_TEXTURE_GEN_S, GL_TEXTURE_GEN_T, GL_TEXTURE_GEN_R, GL_TEXTURE_GEN_Q };
+	for (int i = 0; i < 4; ++i)
+	{
+		const float Plane[4] = { shadowMatrix.mat[i], shadowMatrix.mat[i + 4], shadowMatrix.mat[i + 8], shadowMatrix.mat[i + 12] };
+		glTexGeni(Coords[i], GL_TEXTURE_GEN_MODE, GL_EYE_LINEAR);
+		glTexGenfv(Coords[i], GL_EYE_PLANE, Plane);
+		glEnable(Gens[i]);
+	}
+	glActiveTextureARB(GL_TEXTURE0);
+}
+
+// Switch back from testing against the shadow map.
+void PI_GLBackend::EndShadowReceivers(void)
+{
+	glActiveTextureARB(GL_TEXTURE2);
+	glDisable(GL_TEXTURE_GEN_S);
+	glDisable(GL_TEXTURE_GEN_T);
+	glDisable(GL_TEXTURE_GEN_R);
+	glDisable(GL_TEXTURE_GEN_Q);
+	glDisable(GL_TEXTURE_2D);
+	glActiveTextureARB(GL_TEXTURE0);
+}
+
+void PI_GLBackend::SetDepthTest(bool enable)
+{
+	if (enable)
+		glEnable(GL_DEPTH_TEST);
+	else
+		glDisable(GL_DEPTH_TEST);
+}
+
+// Preserve the current matricies and switch to an ortho view with the given dimensions.
+void PI_GLBackend::BeginOverlay(int width, int height)
+{
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	gluOrtho2D(0, width, 0, height);
+
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+}
+
+// Return the matrix stack to its original state.
+void PI_GLBackend::EndOverlay(void)
+{
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+}
+
+// Draw textured quads from an array in one call, with the texture on stage 0.
+//
+// In:		pCorners		Four corners per quad, counter-clockwise from the upper left.
+//			numQuads		How many quads there are.
+void PI_GLBackend::DrawQuads(const PI_QuadVertex *pCorners, unsigned int numQuads)
+{
+	glInterleavedArrays(GL_T2F_C4UB_V3F, 0, pCorners);
+	glDrawArrays(GL_QUADS, 0, numQuads * 4);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	// The color array leaves the current color undefined.
+	glColor4f(RGBA_WHITE);
+}
@@ -3,10 +3,59 @@
 // Copyright Evan Beeton 2/1/2005
 
 #include <cstdlib>
+#include <cstring>
 
 #include "PI_Utils.h"
 
 int RandomNum(int high, int low)
 {
 	return rand() % (high - low + 1) + low;
+}
+
+// Sort items by key with a least significant byte first radix sort.
+// Bytes that are the same in every key are skipped.
+//
+// In:		pItems, count	The items to sort.
+//			pScratch		Room for count more items.
+//
+// Out:		pItems			The items in ascending key order. Items with equal keys keep their order.
+void PI_RadixSort(PI_SortItem *pItems, PI_SortItem *pScratch, unsigned int count)
+{
+	if (count < 2)
+		return;
+
+	// Count every byte of every key in one pass.
+	const unsigned int NumBytes = sizeof(unsigned long long);
+	unsigned int counts[NumBytes][256];
+	memset(counts, 0, sizeof(counts));
+	for (unsigned int i = 0; i < count; ++i)
+		for (unsigned int b = 0; b < NumBytes; ++b)
+			++counts[b][(pItems[i].key >> (b * 8)) & 0xFF];
+
+	PI_SortItem *pSrc = pItems, *pDst = pScratch;
+	for (unsigned int b = 0; b < NumBytes; ++b)
+	{
+		// If every key has the same byte here, this pass wouldn't move anything.
+		if (counts[b][(pSrc[0].key >> (b * 8)) & 0xFF] == count)
+			continue;
+
+		// Turn the counts into where each bucket starts.
+		unsigned int offsets[256], total = 0;
+		for (unsigned int d = 0; d < 256; ++d)
+		{
+			offsets[d] = total;
+			total += counts[b][d];
+		}
+
+		for (unsigned int i = 0; i < count; ++i)
+			pDst[offsets[(pSrc[i].key >> (b * 8)) & 0xFF]++] = pSrc[i];
+
+		PI_SortItem *pTemp = pSrc;
+		pSrc = pDst;
+		pDst = pTemp;
+	}
+
+	// An odd number of passes leaves the result in the scratch space.
+	if (pSrc != pItems)
+		memcpy(pItems, pSrc, count * sizeof(PI_SortItem));
 }
\ No newline at end of file
@@ -11,16 +11,9 @@ using std::map;
 using std::pair;
 
 #include "PI_WorldTree.h"
-#include "glext.h"
-
-extern PFNGLMULTITEXCOORD2FPROC glMultiTexCoord2f;
 
 PI_WorldTree::PI_WorldTreeNode::~PI_WorldTreeNode(void)
 {
-	const unsigned int Size = (unsigned int)vRenderData.size();
-	for (unsigned int i = 0; i < Size; i++)
-		glDeleteLists(vRenderData[i].displayList, 1);
-
 	delete leftChild;
 	delete rightChild;
 }
@@ -59,8 +52,9 @@ void SortNodeTrisZ(PI_WorldTree::PI_WorldTreeNode &n)
 			n.rightChild->vTris.push_back(n.vTris[t]);
 }
 
-// Recursively process all nodes up to a depth of MAX_WORLDTREE_DEPTH
-void PI_WorldTree::PI_WorldTreeNode::Process(unsigned short newDepth, unsigned int &nodeCount, unsigned int &leafNodeCount)
+// Recursively process all nodes up to a depth of MAX_WORLDTREE_DEPTH.
+// Leaf geometry is added to the world's geometry buffer.
+void PI_WorldTree::PI_WorldTreeNode::Process(unsigned short newDepth, unsigned int &nodeCount, unsigned int &leafNodeCount, PI_GeometryBuffer &geometry)
 {
 	unsigned int t, v;
 
@@ -116,61 +110,20 @@ void PI_WorldTree::PI_WorldTreeNode::Process(unsigned short newDepth, unsigned i
 	// Determine if this node should become a leaf node.
 	if (depth >= (MAX_WORLDTREE_DEPTH - 1) || vTris.size() <= LEAF_POLY_THRESHOLD)
 	{
-		// Build a display list for each group of triangles with the same textures.
+		// Add a batch to the world's geometry for each group of triangles with the same textures.
 		sort(vTris.begin(), vTris.end());
-		unsigned int curDiffTex = vTris[0].diffTex, curNormTex = vTris[0].normTex;
-		vector<PI_Triangle> temp;
-		for (unsigned int t = 0; t < NumTris; ++t)
+		unsigned int groupStart = 0;
+		for (unsigned int t = 1; t <= NumTris; ++t)
 		{
-			// Is it time to generate a new list?
-			if (curDiffTex != vTris[t].diffTex || curNormTex != vTris[t].normTex || t == vTris.size() - 1)
-			{
-				if (t == NumTris - 1)
-					// This is the last group, so include the current triangle.
-					temp.push_back(vTris[t]);
-
-				// Build a display list for what we currently have.
-				RenderData rd(0, curDiffTex, curNormTex);
-				rd.displayList = glGenLists(1);
-				
-				glNewList(rd.displayList, GL_COMPILE);
-				glBegin(GL_TRIANGLES);
-				const unsigned int TrisInGroup = (unsigned int)temp.size();
-				for (unsigned int i = 0; i < TrisInGroup; ++i)
-				{
-					glColor4f(1,1,1,temp[i].vertAlpha[0]);
-					glNormal3fv(temp[i].normals[0]);
-					glMultiTexCoord2f(GL_TEXTURE0, temp[i].texCoord[0].u, temp[i].texCoord[0].v);
-					//glMultiTexCoord2f(GL_TEXTURE1, temp[i].texCoord[0].u, temp[i].texCoord[0].v);
-					glVertex3fv(temp[i].verts[0]);
-			
-					glColor4f(1,1,1,temp[i].vertAlpha[1]);
-					glNormal3fv(temp[i].normals[1]);
-					glMultiTexCoord2f(GL_TEXTURE0, temp[i].texCoord[1].u, temp[i].texCoord[1].v);
-					//glMultiTexCoord2f(GL_TEXTURE1, temp[i].texCoord[1].u, temp[i].texCoord[1].v);
-					glVertex3fv(temp[i].verts[1]);
-
-					glColor4f(1,1,1,temp[i].vertAlpha[2]);
-					glNormal3fv(temp[i].normals[2]);
-					glMultiTexCoord2f(GL_TEXTURE0, temp[i].texCoord[2].u, temp[i].texCoord[2].v);
-					//glMultiTexCoord2f(GL_TEXTURE1, temp[i].texCoord[2].u, temp[i].texCoord[2].v);
-					glVertex3fv(temp[i].verts[2]);
-				}
-				glEnd();
-				glEndList();
-				vRenderData.push_back(rd);
-
-				// Prepare for the next group, if there is one.
-				// If there is no next group, the loop is about to end.
-				temp.clear();
-				temp.push_back(vTris[t]);
-				curDiffTex = vTris[t].diffTex;
-				curNormTex = vTris[t].normTex;
-
-			}
-			else
-				// This triangle belongs to the current group.
-				temp.push_back(vTris[t]);
+			// Keep going until the textures change or the triangles run out.
+			if (t < NumTris && vTris[t].diffTex == vTris[groupStart].diffTex && vTris[t].normTex == vTris[groupStart].normTex)
+				continue;
+
+			RenderData rd(vTris[groupStart].diffTex, vTris[groupStart].normTex);
+			rd.firstIndex = geometry.AddTriangles(&vTris[groupStart], t - groupStart);
+			rd.numIndices = (t - groupStart) * 3;
+			vRenderData.push_back(rd);
+			groupStart = t;
 		}
 
 		// This is a leaf node, so there's nothing else to do.
@@ -193,7 +146,7 @@ void PI_WorldTree::PI_WorldTreeNode::Process(unsigned short newDepth, unsigned i
 
 	// Make sure the children actually received some geometry before processing them.
 	if (leftChild->vTris.size())
-		leftChild->Process(depth + 1, nodeCount, leafNodeCount);
+		leftChild->Process(depth + 1, nodeCount, leafNodeCount, geometry);
 	else
 	{
 		delete leftChild;
@@ -201,7 +154,7 @@ void PI_WorldTree::PI_WorldTreeNode::Process(unsigned short newDepth, unsigned i
 	}
 
 	if (rightChild->vTris.size())
-		rightChild->Process(depth + 1, nodeCount, leafNodeCount);
+		rightChild->Process(depth + 1, nodeCount, leafNodeCount, geometry);
 	else
 	{
 		delete rightChild;
@@ -236,8 +189,10 @@ void PI_WorldTree::BuildWorldTree(void)
 	pRootNode = new PI_WorldTreeNode;
 	pRootNode->vTris.insert(pRootNode->vTris.begin(), pWorldTris, pWorldTris + numWorldTris);
 
-	// Build the tree recursively.
-	pRootNode->Process(0, nodeCount, leafNodeCount);
+	// Build the tree recursively, then hand the leaves' geometry to the GL in one go.
+	geometry.Release();
+	pRootNode->Process(0, nodeCount, leafNodeCount, geometry);
+	geometry.Upload(1, true);
 
 	// Once the world geometry is in the tree, there's no need to store it.
 	free(pWorldTris);
@@ -249,6 +204,7 @@ void PI_WorldTree::Clear(void)
 	delete pRootNode;
 	pRootNode = 0;
 	nodeCount = 0;
+	geometry.Release();
 
 	free(pWorldTris);
 	pWorldTris = 0;